@@ -17,629 +17,2650 @@
 #include "sd_routines.h"
 #include "rtc.h"
 #include "uart_compat.h"
+#ifdef FAT_EEPROM
+#include <avr/eeprom.h>
+#endif
 
 
 /**
- * @brief  Read boot sector data from SD card to determine FAT32 parameters.
- * 
- * Reads sector 0 to check for boot sector signature. If not found, reads MBR
- * to locate partition information. Extracts critical FAT32 parameters including
- * bytes per sector, sectors per cluster, reserved sectors, root cluster, and
- * total number of clusters available on the card.
- * 
- * @return 0 on success, 1 if boot sector not found or invalid MBR signature.
+ * @brief  Append handle whose partly filled tail sector is held in buffer
+ *         and not yet written to the card (0 - buffer holds no pending data).
  */
-unsigned char getBootSectorData (void)
+static struct appendHandle_Structure *dirtyHandle;
+
+/**
+ * @brief  Absolute sector whose contents buffer holds (0 - unknown). With
+ *         FAT_META_BUFFER only file data goes through buffer, so the tail
+ *         sector of an append handle stays there while directory, FSinfo,
+ *         journal and FAT sectors change; without it metaCache lives in buffer
+ *         too, and only one of the two holds a sector at a time.
+ */
+static unsigned long bufferSector;
+
+/**
+ * @brief  Code outside this library that fills buffer itself (claimDataBuffer),
+ *         called to write its data before buffer is reused (0 - no owner).
+ */
+static unsigned char (*bufferOwner) (void);
+
+#ifdef FAT_META_BUFFER
+static unsigned char metaData[512];
+
+/** @brief Metadata buffer: directory, FSinfo and journal sectors, and FAT sectors without FAT_CACHE. */
+static struct sectorCache_Structure metaCache = {0, 0, metaData};
+#else
+/** @brief Metadata sectors share buffer with file data (see FAT_META_BUFFER). */
+static struct sectorCache_Structure metaCache = {0, 0, (unsigned char *) buffer};
+#endif
+
+#ifdef FAT_CACHE
+static unsigned char fatData[512];
+
+/** @brief FAT sectors only, so the chain walk does not evict the directory sector. */
+static struct sectorCache_Structure fatCache = {0, 0, fatData};
+#define FAT_SECTORS fatCache
+#else
+#define FAT_SECTORS metaCache
+#endif
+
+
+/**
+ * @brief  Take buffer back from its outside owner, which writes its data first.
+ * @return 0 on success (or no owner), non-zero on SD write error of the owner.
+ */
+static unsigned char releaseDataBuffer (void)
 {
-struct BS_Structure *bpb;
-struct MBRinfo_Structure *mbr;
-struct partitionInfo_Structure *partition;
-unsigned long dataSectors;
+unsigned char (*release) (void) = bufferOwner;
 
-unusedSectors = 0;
+if(release == 0) return 0;
 
-SD_readSingleBlock(0);
-bpb = (struct BS_Structure *)buffer;
+bufferOwner = 0;
+bufferSector = 0;
+return release ();
+}
 
-if(bpb->jumpBoot[0]!=0xE9 && bpb->jumpBoot[0]!=0xEB)
+
+/**
+ * @brief  Write the pending tail sector held in buffer to the card, or let
+ *         the outside owner of buffer write its data.
+ * @return 0 on success, error code of SD_writeSingleBlock otherwise.
+ */
+static unsigned char commitTailSector (void)
 {
-  mbr = (struct MBRinfo_Structure *) buffer;
-  
-  if(mbr->signature != 0xaa55) return 1;
-    
-  partition = (struct partitionInfo_Structure *)(mbr->partitionData);
-  unusedSectors = partition->firstSector;
-  
-  SD_readSingleBlock(partition->firstSector);
-  bpb = (struct BS_Structure *)buffer;
-  if(bpb->jumpBoot[0]!=0xE9 && bpb->jumpBoot[0]!=0xEB) return 1; 
+struct appendHandle_Structure *handle = dirtyHandle;
+
+//an outside owner has no tail in buffer (claimDataBuffer committed it)
+if(bufferOwner) return releaseDataBuffer ();
+if(handle == 0) return 0;
+
+dirtyHandle = 0;
+return SD_writeSingleBlock (handle->tailSector);
 }
 
-bytesPerSector = bpb->bytesPerSector;
-sectorPerCluster = bpb->sectorPerCluster;
-reservedSectorCount = bpb->reservedSectorCount;
-rootCluster = bpb->rootCluster;
-firstDataSector = bpb->hiddenSectors + reservedSectorCount + (bpb->numberofFATs * bpb->FATsize_F32);
 
-dataSectors = bpb->totalSectors_F32
-              - bpb->reservedSectorCount
-              - ( bpb->numberofFATs * bpb->FATsize_F32);
-totalClusters = dataSectors / sectorPerCluster;
+/**
+ * @brief  Write a sector cache back to the card if it was modified.
+ * @param  cache Sector cache.
+ * @return 0 on success (or nothing to write), non-zero on SD write error.
+ */
+static unsigned char flushSectorCache (struct sectorCache_Structure *cache)
+{
+if(!cache->dirty) return 0;
 
-if((getSetFreeCluster (TOTAL_FREE, GET, 0)) > totalClusters)
-     freeClusterCountUpdated = 0;
-else
-   freeClusterCountUpdated = 1;
-return 0;
+cache->dirty = 0;
+fatCacheWrites++; //only FAT sectors are written back late
+return SD_writeBlock (cache->sector, cache->data);
 }
 
 
 /**
- * @brief  Calculate first sector address of a given cluster.
+ * @brief  Write the pending tail sector (or the data of the outside owner) and
+ *         forget what buffer holds, before a metadata sector is read into it.
+ */
+static void evictDataSector (void)
+{
+commitTailSector ();
+bufferSector = 0;
+}
+
+
+/**
+ * @brief  Write a modified metadata sector back and forget it, before file
+ *         data goes into buffer. Nothing to do with FAT_META_BUFFER.
+ */
+static void evictMetaSector (void)
+{
+#ifndef FAT_META_BUFFER
+flushSectorCache (&metaCache);
+metaCache.sector = 0;
+#endif
+}
+
+
+/**
+ * @brief  Read data sector into buffer, committing pending tail data first.
  * 
- * Uses the formula: ((clusterNumber - 2) * sectorPerCluster) + firstDataSector
- * to determine the absolute sector number for the first sector of any cluster
- * on the SD card.
+ * Returns at once if buffer already holds the sector.
  * 
- * @param  clusterNumber Cluster number for which first sector is to be found.
- * @return First sector address (absolute sector number) of the cluster.
+ * @param  sector Absolute sector number.
+ * @return 0 on success, error code of SD_readSingleBlock otherwise.
  */
-unsigned long getFirstSector(unsigned long clusterNumber)
+static unsigned char readSector (unsigned long sector)
 {
-  return (((clusterNumber - 2) * sectorPerCluster) + firstDataSector);
+unsigned char error;
+
+if(sector == bufferSector) return 0;
+
+evictDataSector ();
+evictMetaSector ();
+error = SD_readSingleBlock (sector);
+if(error == 0) bufferSector = sector;
+return error;
 }
 
 
 /**
- * @brief  Get or set cluster entry value in FAT to navigate or modify cluster chain.
+ * @brief  Hand buffer over to code outside this library that fills it itself
+ *         (e.g. the raw ring log); pending tail data is written first.
  * 
- * Locates the FAT entry for a given cluster, retrieves it if GET operation,
- * or updates it if SET operation. Each FAT entry is 4 bytes (32-bit) and contains
- * the next cluster number in the chain (or EOF marker).
+ * Before this library uses buffer again it calls release, which writes the
+ * owner's data to the card; the owner claims buffer again before it fills
+ * it next time and reads back what it needs.
  * 
- * @param  clusterNumber Current cluster number to access in FAT.
- * @param  get_set       GET to retrieve next cluster, SET to modify FAT entry.
- * @param  clusterEntry  Next cluster value when get_set=SET; 0 when get_set=GET.
- * @return Next cluster number if get_set=GET; 0 if get_set=SET.
+ * @param  release Function writing the owner's data from buffer.
+ * @return 0 on success, non-zero on SD write error.
  */
-unsigned long getSetNextCluster (unsigned long clusterNumber,
-                                 unsigned char get_set,
-                                 unsigned long clusterEntry)
+unsigned char claimDataBuffer (unsigned char (*release) (void))
 {
-unsigned int FATEntryOffset;
-unsigned long *FATEntryValue;
-unsigned long FATEntrySector;
-unsigned char retry = 0;
+unsigned char error;
 
-FATEntrySector = unusedSectors + reservedSectorCount + ((clusterNumber * 4) / bytesPerSector);
+error = commitTailSector ();
+bufferSector = 0;
+evictMetaSector ();
+bufferOwner = release;
+return error;
+}
 
-FATEntryOffset = (unsigned int) ((clusterNumber * 4) % bytesPerSector);
 
-while(retry <10)
-{ if(!SD_readSingleBlock(FATEntrySector)) break; retry++;}
+/**
+ * @brief  Get sector into a sector cache; the sector held before is written
+ *         back first if it was modified.
+ * @param  cache  Sector cache.
+ * @param  sector Absolute sector number.
+ * @return 0 on success, non-zero on SD read error (cache is empty then).
+ */
+static unsigned char cacheSector (struct sectorCache_Structure *cache, unsigned long sector)
+{
+if(sector == cache->sector) return 0;
 
-FATEntryValue = (unsigned long *) &buffer[FATEntryOffset];
+flushSectorCache (cache);
+cache->sector = 0;
+#ifndef FAT_META_BUFFER
+if(cache == &metaCache) evictDataSector ();
+#endif
+if(SD_readBlock (sector, cache->data)) return 1;
 
-if(get_set == GET)
-  return ((*FATEntryValue) & 0x0fffffff);
+cache->sector = sector;
+return 0;
+}
 
-*FATEntryValue = clusterEntry;
 
-SD_writeSingleBlock(FATEntrySector);
+/**
+ * @brief  Get directory, FSinfo or journal sector into the metadata buffer.
+ * @param  sector Absolute sector number.
+ * @return Pointer to the 512 bytes of the sector, 0 on SD read error.
+ */
+static unsigned char *loadMetaSector (unsigned long sector)
+{
+if(sector == metaCache.sector)
+  metaCacheHits++;
+else
+{
+  metaCacheMisses++;
+  if(cacheSector (&metaCache, sector)) return 0;
+}
+
+return metaCache.data;
+}
+
 
-return (0);
+/**
+ * @brief  Get the metadata buffer for a sector that is overwritten as a whole
+ *         (e.g. a new directory cluster), without reading it from the card.
+ * @param  sector Absolute sector number.
+ * @return Pointer to the 512 bytes of the metadata buffer.
+ */
+static unsigned char *newMetaSector (unsigned long sector)
+{
+flushSectorCache (&metaCache);
+#ifndef FAT_META_BUFFER
+evictDataSector ();
+#endif
+metaCache.sector = sector;
+return metaCache.data;
 }
 
 
 /**
- * @brief  Get or set free cluster information from FSinfo sector.
+ * @brief  Write the sector modified in the metadata buffer to the card.
  * 
- * Accesses the FSinfo sector (sector 1) to read or update either the total
- * free cluster count or the next available free cluster pointer. Validates
- * FSinfo sector signatures before reading/writing data.
+ * Directory, FSinfo and journal sectors are written through at once, they
+ * order the updates that make a power loss recoverable.
  * 
- * @param  totOrNext TOTAL_FREE to access free cluster count, NEXT_FREE for next free cluster pointer.
- * @param  get_set   GET to read value, SET to update FSinfo sector.
- * @param  FSEntry   New value when get_set=SET; 0 when get_set=GET.
- * @return Requested value if get_set=GET; 0xffffffff on error or if get_set=SET.
+ * @return 0 on success, non-zero on SD write error (the buffer is dropped then).
  */
-unsigned long getSetFreeCluster(unsigned char totOrNext, unsigned char get_set, unsigned long FSEntry)
+static unsigned char storeMetaSector (void)
 {
-struct FSInfo_Structure *FS = (struct FSInfo_Structure *) &buffer;
 unsigned char error;
-SD_readSingleBlock(unusedSectors + 1);
 
-if((FS->leadSignature != 0x41615252) || (FS->structureSignature != 0x61417272) || (FS->trailSignature !=0xaa550000))
-  return 0xffffffff;
+if(metaCache.sector == 0) return 1;
 
- if(get_set == GET)
- {
-   if(totOrNext == TOTAL_FREE)
-      return(FS->freeClusterCount);
-   else
-      return(FS->nextFreeCluster);
- }
- else
- {
-   if(totOrNext == TOTAL_FREE)
-      FS->freeClusterCount = FSEntry;
-   else
-    FS->nextFreeCluster = FSEntry;
- 
-   error = SD_writeSingleBlock(unusedSectors + 1);
- }
- return 0xffffffff;
+error = SD_writeBlock (metaCache.sector, metaCache.data);
+if(error) metaCache.sector = 0;
+return error;
 }
 
 
 /**
- * @brief  Search for files/directories, retrieve file address, or delete specified file.
+ * @brief  Get FAT sector into memory for reading or modification.
  * 
- * Traverses the root directory cluster chain and searches directory entries.
- * Can list all files (GET_LIST), locate a specific file (GET_FILE), or delete
- * a file (DELETE). For GET_FILE, returns pointer to directory entry and stores
- * sector/location info for later append operations.
+ * The sector is served from FAT_SECTORS, the FAT_CACHE buffer or else the
+ * metadata buffer; a different sector is read only after the cached one has
+ * been written back (if dirty).
  * 
- * @param  flag     GET_LIST to list directory contents, GET_FILE to find file, DELETE to remove file.
- * @param  fileName Pointer to file name (NULL/unused if flag=GET_LIST).
- * @return Pointer to directory entry structure if found, NULL if not found or on error.
+ * @param  sector Absolute FAT sector number.
+ * @return Pointer to the 512 bytes of the sector.
  */
-struct dir_Structure* findFiles (unsigned char flag, unsigned char *fileName)
+static unsigned char *loadFatSector (unsigned long sector)
 {
-unsigned long cluster, sector, firstSector, firstCluster, nextCluster;
-struct dir_Structure *dir;
-unsigned int i;
-unsigned char j;
-unsigned char loopCount = 0;
+unsigned char retry = 0;
 
-cluster = rootCluster;
+if(sector == FAT_SECTORS.sector)
+{
+  fatCacheHits++;
+  return FAT_SECTORS.data;
+}
 
-while(1)
+fatCacheMisses++;
+
+while(retry <10)
+{ if(!cacheSector (&FAT_SECTORS, sector)) break; retry++; }
+
+return FAT_SECTORS.data;
+}
+
+
+/**
+ * @brief  Store FAT sector modified in memory returned by loadFatSector().
+ * 
+ * The write is deferred until another sector is needed in the same buffer or
+ * flushFatCache() is called, so consecutive updates of one sector cost one write.
+ * 
+ * @param  sector Absolute FAT sector number.
+ * @return 0 on success, non-zero on SD write error.
+ */
+static unsigned char storeFatSector (unsigned long sector)
 {
-   loopCount++;
-   if(loopCount > 100) {
-       return 0;
-   }
-   
-   firstSector = getFirstSector (cluster);
-   
-   for(sector = 0; sector < sectorPerCluster; sector++)
-   {
-     SD_readSingleBlock (firstSector + sector);
+if(sector != FAT_SECTORS.sector) return 1; //sector could not be read
 
-     for(i=0; i<bytesPerSector; i+=32)
-     {
-        dir = (struct dir_Structure *) &buffer[i];
+FAT_SECTORS.dirty = 1;
+return 0;
+}
 
-        if(dir->name[0] == EMPTY)
-        {
-          if(flag == DELETE)
-              return 0;
-          return 0;   
-        }
-    if((dir->name[0] != DELETED) && (dir->attrib != ATTR_LONG_NAME))
-        {
-          if((flag == GET_FILE) || (flag == DELETE))
-          {
-            for(j=0; j<11; j++)
-            if(dir->name[j] != fileName[j]) break;
-            if(j == 11)
-            {
-              if(flag == GET_FILE)
-                    {
-                appendFileSector = firstSector + sector;
-              appendFileLocation = i;
-              appendStartCluster = (((unsigned long) dir->firstClusterHI) << 16) | dir->firstClusterLO;
-              fileSize = dir->fileSize;
-                return (dir);
-              } 
-              else
-              {
-                TX_NEWLINE;
-              TX_NEWLINE;
-              TX_NEWLINE;
-              firstCluster = (((unsigned long) dir->firstClusterHI) << 16) | dir->firstClusterLO;
-                      
-              dir->name[0] = DELETED;    
-              SD_writeSingleBlock (firstSector+sector);
-                    
-              freeMemoryUpdate (ADD, dir->fileSize);
 
-              cluster = getSetFreeCluster (NEXT_FREE, GET, 0); 
-              if(firstCluster < cluster)
-                  getSetFreeCluster (NEXT_FREE, SET, firstCluster);
+/**
+ * @brief  Write the cached FAT sector back to the card if it was modified.
+ * @return 0 on success (or nothing to write), non-zero on SD write error.
+ */
+unsigned char flushFatCache (void)
+{
+return flushSectorCache (&FAT_SECTORS);
+}
 
-                while(1)  
-                {
-                    nextCluster = getSetNextCluster (firstCluster, GET, 0);
-                getSetNextCluster (firstCluster, SET, 0);
-                if(nextCluster > 0x0ffffff6) 
-                  {uart_puts_P("File deleted!");return 0;}
-                firstCluster = nextCluster;
-                } 
-              }
-            }
-        }
-        else
-        {
-          for(j=0; j<11; j++)
-            {
-            if(j == 8) transmitByte(' ');
-          }
-            uart_puts_P("   ");
-            if((dir->attrib != 0x10) && (dir->attrib != 0x08))
-          {
-              uart_puts_P("FILE" );
-                uart_puts_P("   ");
-              displayMemory(LOW, dir->fileSize);
-          }
-          else
-            {
-              if (dir->attrib == 0x10)
-              {
-                uart_puts(("DIR" ));
-              }
-              else
-              {
-                uart_puts(("ROOT" ));
-              }
+
+/** @brief Absolute sector number of the FSinfo sector. */
+static unsigned long fsInfoSector;
+
+/** @brief Free cluster count and next free cluster hint, RAM copies of the FSinfo fields. */
+static unsigned long fsFreeCount, fsNextFree;
+
+/** @brief 1 - FSinfo signatures were valid at mount. */
+static unsigned char fsInfoValid;
+
+/** @brief 1 - RAM copies differ from the FSinfo sector on the card. */
+static unsigned char fsInfoDirty;
+
+/** @brief Absolute sector number of the journal sector (0 - no journal on this volume). */
+static unsigned long journalSector;
+
+/** @brief Bytes of the journal sector occupied by one intent record slot. */
+#define JOURNAL_SLOT_BYTES  64
+
+static void loadFSInfo (void);
+static void loadJournal (void);
+
+/** @brief Volume serial number of the mounted boot sector. */
+static unsigned long volumeID;
+
+#ifdef FAT_EEPROM
+/** @brief Geometry of the last mounted volume. */
+static struct mount_Structure EEMEM eeMount;
+
+/** @brief Ring of append cursors, written in turn. */
+static struct cursor_Structure EEMEM eeCursors[CURSOR_SLOTS];
+
+/** @brief Slot of eeCursors receiving the next cursor. */
+static unsigned char cursorSlot;
+
+/** @brief Sequence number of the next cursor. */
+static unsigned int cursorSequence;
+
+static unsigned char loadMount (void);
+static void saveMount (void);
+static void loadCursors (void);
+#endif
+
+
+/**
+ * @brief Run of contiguous free clusters remembered by the free-run map.
+ */
+struct freeRun_Structure{
+unsigned long start;    //first free cluster of the run
+unsigned long length;   //number of clusters (0 - slot unused)
+};
+
+
+/** @brief Free-run map; every run in it is free on the card, not every free run is in it. */
+static struct freeRun_Structure freeRuns[FREE_RUN_SLOTS];
+
+/** @brief Next cluster examined by fatIdleScan() (0 - scan finished). */
+static unsigned long scanCluster;
+
+/** @brief Free run found by fatIdleScan() and not stored yet. */
+static unsigned long scanRunStart, scanRunLength;
+
+
+/**
+ * @brief  Remember a run of free clusters in the free-run map.
+ * 
+ * The run is merged with runs it overlaps or touches. If all slots are used,
+ * it replaces the shortest run, or is dropped if it is shorter than all of them.
+ * 
+ * @param  start  First free cluster.
+ * @param  length Number of free clusters.
+ * @return none
+ */
+static void addFreeRun (unsigned long start, unsigned long length)
+{
+struct freeRun_Structure *run;
+unsigned char i, slot;
+
+for(i=0; i<FREE_RUN_SLOTS; i++)
+{
+  run = &freeRuns[i];
+  if(run->length == 0) continue;
+  if((run->start > start + length) || (start > run->start + run->length)) continue;
+
+  if(run->start + run->length > start + length)
+    length = run->start + run->length - start;
+  if(run->start < start)
+  {
+    length += start - run->start;
+    start = run->start;
+  }
+  run->length = 0;
+}
+
+slot = 0;
+for(i=1; i<FREE_RUN_SLOTS; i++)
+  if(freeRuns[i].length < freeRuns[slot].length) slot = i;
+
+if(freeRuns[slot].length < length)
+{
+  freeRuns[slot].start = start;
+  freeRuns[slot].length = length;
+}
+}
+
+
+/**
+ * @brief  Forget clusters that are no longer free from the free-run map.
+ * @param  start  First allocated cluster.
+ * @param  length Number of allocated clusters.
+ * @return none
+ */
+static void removeFreeRun (unsigned long start, unsigned long length)
+{
+struct freeRun_Structure *run;
+unsigned long end = start + length, runEnd;
+unsigned char i;
+
+for(i=0; i<FREE_RUN_SLOTS; i++)
+{
+  run = &freeRuns[i];
+  runEnd = run->start + run->length;
+  if((run->length == 0) || (run->start >= end) || (runEnd <= start)) continue;
+
+  if(run->start >= start)
+  {
+    run->length = (runEnd > end) ? (runEnd - end) : 0;
+    run->start = end;
+  }
+  else
+  {
+    run->length = start - run->start;
+    if(runEnd > end) addFreeRun (end, runEnd - end);
+  }
+}
+
+//cut the same clusters from the run being counted by fatIdleScan()
+runEnd = scanRunStart + scanRunLength;
+if(scanRunLength && (scanRunStart < end) && (runEnd > start))
+{
+  if(scanRunStart < start) addFreeRun (scanRunStart, start - scanRunStart);
+
+  scanRunLength = (runEnd > end) ? (runEnd - end) : 0;
+  scanRunStart = end;
+}
+}
+
+
+/**
+ * @brief  Find run of free clusters in the free-run map (no card access).
+ * 
+ * The run being counted by fatIdleScan() is a candidate as well, so a file
+ * keeps growing into the clusters behind it while the map is being built.
+ * 
+ * @param  nearCluster Prefer the first run starting after this cluster.
+ * @param  count       Required number of contiguous free clusters.
+ * @return First cluster of the run, 0 if the map knows no such run.
+ */
+static unsigned long findFreeRun (unsigned long nearCluster, unsigned long count)
+{
+unsigned long after = 0, lowest = 0, start, length;
+unsigned char i;
+
+for(i=0; i<=FREE_RUN_SLOTS; i++)
+{
+  if(i < FREE_RUN_SLOTS)
+  {
+    start = freeRuns[i].start;
+    length = freeRuns[i].length;
+  }
+  else
+  {
+    start = scanRunStart;
+    length = scanRunLength;
+  }
+  if(length < count) continue;
+
+  if((start > nearCluster) && ((after == 0) || (start < after))) after = start;
+  if((lowest == 0) || (start < lowest)) lowest = start;
+}
+
+return after ? after : lowest;
+}
+
+
+/**
+ * @brief  Build the free-run map in the background, a few FAT sectors per call.
+ * 
+ * Scans the FAT from the beginning, continuing where the previous call
+ * stopped, and stores the free runs found. Call it when the card is otherwise
+ * idle; once the scan is finished, the map is kept up to date by every FAT
+ * update and allocations are answered without reading the FAT.
+ * 
+ * @param  sectors Maximum number of FAT sectors to scan in this call.
+ * @return 1 if the scan is not finished yet, 0 if the map is complete.
+ */
+unsigned char fatIdleScan (unsigned int sectors)
+{
+unsigned long lastCluster;
+uint32_t *value;
+unsigned char *fat;
+unsigned int offset;
+
+lastCluster = totalClusters + 1;
+
+#if !defined(FAT_META_BUFFER) && !defined(FAT_CACHE)
+//FAT sectors would go through buffer: wait until it holds no data that has to be written first
+if(dirtyHandle || bufferOwner) return scanCluster != 0;
+#endif
+
+while(sectors-- && scanCluster)
+{
+  fat = loadFatSector (unusedSectors + reservedSectorCount + ((scanCluster * 4) / bytesPerSector));
+  offset = (unsigned int) ((scanCluster * 4) % bytesPerSector);
+
+  for(; (offset < bytesPerSector) && (scanCluster <= lastCluster); offset += 4, scanCluster++)
+  {
+    value = (uint32_t *) &fat[offset];
+    if(((*value) & 0x0fffffff) == 0)
+    {
+      if(scanRunLength == 0) scanRunStart = scanCluster;
+      scanRunLength++;
+    }
+    else if(scanRunLength)
+    {
+      addFreeRun (scanRunStart, scanRunLength);
+      scanRunLength = 0;
+    }
+  }
+
+  if(scanCluster > lastCluster)
+  {
+    if(scanRunLength) addFreeRun (scanRunStart, scanRunLength);
+    scanRunLength = 0;
+    scanCluster = 0;
+  }
+}
+
+return scanCluster != 0;
+}
+
+
+/**
+ * @brief  Load the volume state kept on the card once the geometry is known:
+ *         FSinfo, the journal sector and (FAT_EEPROM) the cursor ring position.
+ * @return 0
+ */
+static unsigned char mountVolume (void)
+{
+loadFSInfo ();
+loadJournal ();
+#ifdef FAT_EEPROM
+loadCursors ();
+#endif
+
+if((getSetFreeCluster (TOTAL_FREE, GET, 0)) > totalClusters)
+     freeClusterCountUpdated = 0;
+else
+   freeClusterCountUpdated = 1;
+return 0;
+}
+
+
+/**
+ * @brief  Read boot sector data from SD card to determine FAT32 parameters.
+ * 
+ * Reads sector 0 to check for boot sector signature. If not found, reads MBR
+ * to locate partition information. Extracts critical FAT32 parameters including
+ * bytes per sector, sectors per cluster, reserved sectors, root cluster, and
+ * total number of clusters available on the card.
+ * 
+ * @return 0 on success, 1 if boot sector not found or invalid MBR signature.
+ */
+unsigned char getBootSectorData (void)
+{
+struct BS_Structure *bpb;
+struct MBRinfo_Structure *mbr;
+struct partitionInfo_Structure *partition;
+unsigned long dataSectors;
+
+releaseDataBuffer ();
+unusedSectors = 0;
+dirtyHandle = 0;
+bufferSector = 0;
+metaCache.sector = 0;
+metaCache.dirty = 0;
+#ifdef FAT_CACHE
+fatCache.sector = 0;
+fatCache.dirty = 0;
+#endif
+for(scanCluster=0; scanCluster<FREE_RUN_SLOTS; scanCluster++)
+  freeRuns[scanCluster].length = 0;
+scanCluster = 2;
+scanRunLength = 0;
+
+#ifdef FAT_EEPROM
+if(loadMount () == 0) return mountVolume ();
+#endif
+
+SD_readSingleBlock(0);
+bpb = (struct BS_Structure *)buffer;
+
+if(bpb->jumpBoot[0]!=0xE9 && bpb->jumpBoot[0]!=0xEB)
+{
+  mbr = (struct MBRinfo_Structure *) buffer;
+  
+  if(mbr->signature != 0xaa55) return 1;
+    
+  partition = (struct partitionInfo_Structure *)(mbr->partitionData);
+  unusedSectors = partition->firstSector;
+  
+  SD_readSingleBlock(partition->firstSector);
+  bpb = (struct BS_Structure *)buffer;
+  if(bpb->jumpBoot[0]!=0xE9 && bpb->jumpBoot[0]!=0xEB) return 1; 
+}
+
+fsInfoSector = unusedSectors + bpb->FSinfo;
+if((bpb->FSinfo == 0) || (bpb->FSinfo >= bpb->reservedSectorCount))
+  fsInfoSector = unusedSectors + 1;
+
+//journal goes to the last reserved sector if it is behind FSinfo and the backup boot sectors
+journalSector = 0;
+if((bpb->reservedSectorCount > 3) && ((unsigned long) bpb->reservedSectorCount - 1 > fsInfoSector - unusedSectors) &&
+   ((bpb->BackupBootSector == 0) || (bpb->BackupBootSector == 0xffff) ||
+    (bpb->reservedSectorCount - 1 > bpb->BackupBootSector + 2)))
+  journalSector = unusedSectors + bpb->reservedSectorCount - 1;
+bytesPerSector = bpb->bytesPerSector;
+sectorPerCluster = bpb->sectorPerCluster;
+reservedSectorCount = bpb->reservedSectorCount;
+rootCluster = bpb->rootCluster;
+firstDataSector = bpb->hiddenSectors + reservedSectorCount + (bpb->numberofFATs * bpb->FATsize_F32);
+
+dataSectors = bpb->totalSectors_F32
+              - bpb->reservedSectorCount
+              - ( bpb->numberofFATs * bpb->FATsize_F32);
+totalClusters = dataSectors / sectorPerCluster;
+volumeID = bpb->volumeID;
+
+#ifdef FAT_EEPROM
+saveMount ();
+#endif
+
+return mountVolume ();
+}
+
+
+/**
+ * @brief  Calculate first sector address of a given cluster.
+ * 
+ * Uses the formula: ((clusterNumber - 2) * sectorPerCluster) + firstDataSector
+ * to determine the absolute sector number for the first sector of any cluster
+ * on the SD card.
+ * 
+ * @param  clusterNumber Cluster number for which first sector is to be found.
+ * @return First sector address (absolute sector number) of the cluster.
+ */
+unsigned long getFirstSector(unsigned long clusterNumber)
+{
+  return (((clusterNumber - 2) * sectorPerCluster) + firstDataSector);
+}
+
+
+/**
+ * @brief  Get or set cluster entry value in FAT to navigate or modify cluster chain.
+ * 
+ * Locates the FAT entry for a given cluster, retrieves it if GET operation,
+ * or updates it if SET operation. Each FAT entry is 4 bytes (32-bit) and contains
+ * the next cluster number in the chain (or EOF marker).
+ * 
+ * @param  clusterNumber Current cluster number to access in FAT.
+ * @param  get_set       GET to retrieve next cluster, SET to modify FAT entry.
+ * @param  clusterEntry  Next cluster value when get_set=SET; 0 when get_set=GET.
+ * @return Next cluster number if get_set=GET; 0 if get_set=SET.
+ */
+unsigned long getSetNextCluster (unsigned long clusterNumber,
+                                 unsigned char get_set,
+                                 unsigned long clusterEntry)
+{
+unsigned int FATEntryOffset;
+uint32_t *FATEntryValue;
+unsigned long FATEntrySector;
+
+FATEntrySector = unusedSectors + reservedSectorCount + ((clusterNumber * 4) / bytesPerSector);
+
+FATEntryOffset = (unsigned int) ((clusterNumber * 4) % bytesPerSector);
+
+FATEntryValue = (uint32_t *) &loadFatSector (FATEntrySector)[FATEntryOffset];
+
+if(get_set == GET)
+  return ((*FATEntryValue) & 0x0fffffff);
+
+*FATEntryValue = clusterEntry;
+
+storeFatSector (FATEntrySector);
+
+if(clusterEntry) removeFreeRun (clusterNumber, 1);
+else addFreeRun (clusterNumber, 1);
+
+return (0);
+}
+
+
+/**
+ * @brief  Read FSinfo sector into the RAM copies and validate it.
+ * 
+ * Called once at mount. The sector is used only if all three signatures are
+ * valid. A free count larger than the number of clusters is kept as is, it
+ * marks the count as unknown (freeClusterCountUpdated = 0). A next free hint
+ * outside the cluster range is replaced by 0xffffffff (no hint).
+ * 
+ * @return none
+ */
+static void loadFSInfo (void)
+{
+struct FSInfo_Structure *FS;
+
+fsInfoDirty = 0;
+fsInfoValid = 0;
+fsFreeCount = 0xffffffff;
+fsNextFree = 0xffffffff;
+
+FS = (struct FSInfo_Structure *) loadMetaSector (fsInfoSector);
+if(FS == 0) return;
+
+if((FS->leadSignature != 0x41615252) || (FS->structureSignature != 0x61417272) || (FS->trailSignature !=0xaa550000))
+  return;
+
+fsInfoValid = 1;
+fsFreeCount = FS->freeClusterCount;
+fsNextFree = FS->nextFreeCluster;
+
+if((fsNextFree < 2) || (fsNextFree > totalClusters + 1))
+  fsNextFree = 0xffffffff;
+}
+
+
+/**
+ * @brief  Get or set free cluster information of the FSinfo sector.
+ * 
+ * Works on RAM copies of the total free cluster count and the next available
+ * free cluster pointer, loaded and validated at mount. A SET does not touch
+ * the card, flushFSInfo() writes the changed values back.
+ * 
+ * @param  totOrNext TOTAL_FREE to access free cluster count, NEXT_FREE for next free cluster pointer.
+ * @param  get_set   GET to read value, SET to update FSinfo sector.
+ * @param  FSEntry   New value when get_set=SET; 0 when get_set=GET.
+ * @return Requested value if get_set=GET; 0xffffffff on error or if get_set=SET.
+ */
+unsigned long getSetFreeCluster(unsigned char totOrNext, unsigned char get_set, unsigned long FSEntry)
+{
+if(!fsInfoValid)
+  return 0xffffffff;
+
+ if(get_set == GET)
+ {
+   if(totOrNext == TOTAL_FREE)
+      return(fsFreeCount);
+   else
+      return(fsNextFree);
+ }
+ else
+ {
+   if(totOrNext == TOTAL_FREE)
+   {
+      if(fsFreeCount != FSEntry) fsInfoDirty = 1;
+      fsFreeCount = FSEntry;
+   }
+   else
+   {
+      if(fsNextFree != FSEntry) fsInfoDirty = 1;
+      fsNextFree = FSEntry;
+   }
+ }
+ return 0xffffffff;
+}
+
+
+/**
+ * @brief  Write free cluster count and next free hint back to the FSinfo sector.
+ * 
+ * Does nothing if the values did not change since mount or the last call.
+ * 
+ * @return 0 on success (or nothing to write), non-zero on SD write error.
+ */
+unsigned char flushFSInfo (void)
+{
+struct FSInfo_Structure *FS;
+
+if(!fsInfoDirty) return 0;
+
+FS = (struct FSInfo_Structure *) loadMetaSector (fsInfoSector);
+if(FS == 0) return 1;
+
+if((FS->leadSignature != 0x41615252) || (FS->structureSignature != 0x61417272) || (FS->trailSignature !=0xaa550000))
+  return 1;
+
+FS->freeClusterCount = fsFreeCount;
+FS->nextFreeCluster = fsNextFree;
+
+fsInfoDirty = 0;
+return storeMetaSector ();
+}
+
+
+/**
+ * @brief  Sum of the bytes of an intent record in front of its checksum.
+ * @param  record Intent record.
+ * @return Checksum.
+ */
+static unsigned int journalChecksum (struct journal_Structure *record)
+{
+unsigned char *bytes = (unsigned char *) record;
+unsigned int i, sum = 0;
+
+for(i=0; i<sizeof(struct journal_Structure) - sizeof(record->checksum); i++)
+  sum += bytes[i];
+
+return sum;
+}
+
+
+/**
+ * @brief  Check the journal sector at mount and disable the journal if the
+ *         sector holds foreign data.
+ * 
+ * The sector is accepted if every byte is zero except the intent records
+ * with a valid signature, so a freshly formatted card gets a journal and
+ * reserved sectors used by other software are left alone.
+ * 
+ * @return none
+ */
+static void loadJournal (void)
+{
+unsigned char *data;
+unsigned int i;
+
+if(journalSector == 0) return;
+
+data = loadMetaSector (journalSector);
+if(data == 0)
+{
+  journalSector = 0;
+  return;
+}
+
+for(i=0; i<bytesPerSector; i++)
+{
+  if(((i % JOURNAL_SLOT_BYTES) == 0) && (i < JOURNAL_SLOTS * JOURNAL_SLOT_BYTES) &&
+     (((struct journal_Structure *) &data[i])->signature == JOURNAL_SIGNATURE))
+  {
+    i += JOURNAL_SLOT_BYTES - 1;
+    continue;
+  }
+
+  if(data[i])
+  {
+    journalSector = 0;
+    return;
+  }
+}
+}
+
+
+/**
+ * @brief  Write or clear the intent record of an append handle.
+ * 
+ * The record holds the directory entry location, the tail cluster and the
+ * size committed to the card and the reserved run linked after the tail.
+ * A handle gets a free slot when its first record is written; if all slots
+ * are used, the handle is not journaled.
+ * 
+ * @param  handle Append handle.
+ * @param  used   1 - write the record, 0 - clear it and release the slot.
+ * @return 0 on success (or no journal), 1 on SD write error.
+ */
+static unsigned char writeJournal (struct appendHandle_Structure *handle, unsigned char used)
+{
+struct journal_Structure *record;
+unsigned char *data;
+unsigned char slot, j;
+unsigned int i;
+
+if(journalSector == 0) return 0;
+if(!used && (handle->journalSlot >= JOURNAL_SLOTS)) return 0;
+
+data = loadMetaSector (journalSector);
+if(data == 0) return 1;
+
+slot = handle->journalSlot;
+if(slot >= JOURNAL_SLOTS)
+{
+  for(slot=0; slot<JOURNAL_SLOTS; slot++)
+    if(((struct journal_Structure *) &data[slot * JOURNAL_SLOT_BYTES])->signature != JOURNAL_SIGNATURE) break;
+  if(slot >= JOURNAL_SLOTS) return 0;
+}
+
+for(i=0; i<JOURNAL_SLOT_BYTES; i++)
+  data[slot * JOURNAL_SLOT_BYTES + i] = 0;
+
+handle->journalSlot = 0xff;
+
+if(used)
+{
+  record = (struct journal_Structure *) &data[slot * JOURNAL_SLOT_BYTES];
+  record->signature = JOURNAL_SIGNATURE;
+  for(j=0; j<11; j++)
+    record->fileName[j] = handle->fileName[j];
+  record->dirSector = handle->dirSector;
+  record->dirLocation = handle->dirLocation;
+  record->firstCluster = handle->firstCluster;
+  record->baseCluster = handle->tailCluster;
+  record->baseSize = handle->fileSize;
+  if(handle->tailCluster < handle->reservedEnd)
+  {
+    record->runStart = handle->tailCluster + 1;
+    record->runEnd = handle->reservedEnd;
+  }
+  record->checksum = journalChecksum (record);
+  handle->journalSlot = slot;
+}
+
+return storeMetaSector ();
+}
+
+
+#ifdef FAT_EEPROM
+/**
+ * @brief  Sum of the bytes of an EEPROM record in front of its checksum.
+ * @param  bytes  Record.
+ * @param  length Number of bytes in front of the checksum.
+ * @param  seed   Value mixed into the sum (volume ID for cursors).
+ * @return Checksum.
+ */
+static uint16_t eepromChecksum (const unsigned char *bytes, unsigned int length, unsigned long seed)
+{
+uint16_t sum = 0x5aa5 ^ (uint16_t) seed ^ (uint16_t) (seed >> 16);
+
+while(length--)
+  sum += *bytes++;
+
+return sum;
+}
+
+
+/**
+ * @brief  Restore the geometry of the last mounted volume from EEPROM.
+ * 
+ * The record is used if its checksum is valid and the boot sector it names
+ * still carries the same volume ID (a formatted or another card has a new
+ * one), so only that sector is read instead of the MBR and the boot sector.
+ * 
+ * @return 0 - geometry restored, 1 - no record or the card has changed.
+ */
+static unsigned char loadMount (void)
+{
+struct mount_Structure mount;
+struct BS_Structure *bpb = (struct BS_Structure *) buffer;
+
+eeprom_read_block (&mount, &eeMount, sizeof(mount));
+if(mount.checksum != eepromChecksum ((unsigned char *) &mount, sizeof(mount) - sizeof(mount.checksum), 0)) return 1;
+if((mount.sectorPerCluster == 0) || (mount.bytesPerSector != 512)) return 1;
+
+if(SD_readSingleBlock (mount.bootSector)) return 1;
+if(((bpb->jumpBoot[0] != 0xE9) && (bpb->jumpBoot[0] != 0xEB)) || (bpb->volumeID != mount.volumeID)) return 1;
+
+volumeID = mount.volumeID;
+unusedSectors = mount.bootSector;
+firstDataSector = mount.firstDataSector;
+rootCluster = mount.rootCluster;
+totalClusters = mount.totalClusters;
+fsInfoSector = mount.fsInfoSector;
+journalSector = mount.journalSector;
+bytesPerSector = mount.bytesPerSector;
+reservedSectorCount = mount.reservedSectorCount;
+sectorPerCluster = mount.sectorPerCluster;
+return 0;
+}
+
+
+/**
+ * @brief  Store the geometry of the mounted volume in EEPROM; only bytes that
+ *         changed are programmed, so remounting the same card costs no write.
+ * @return none
+ */
+static void saveMount (void)
+{
+struct mount_Structure mount;
+
+mount.volumeID = volumeID;
+mount.bootSector = unusedSectors;
+mount.firstDataSector = firstDataSector;
+mount.rootCluster = rootCluster;
+mount.totalClusters = totalClusters;
+mount.fsInfoSector = fsInfoSector;
+mount.journalSector = journalSector;
+mount.bytesPerSector = bytesPerSector;
+mount.reservedSectorCount = reservedSectorCount;
+mount.sectorPerCluster = (unsigned char) sectorPerCluster;
+mount.checksum = eepromChecksum ((unsigned char *) &mount, sizeof(mount) - sizeof(mount.checksum), 0);
+
+eeprom_update_block (&mount, &eeMount, sizeof(mount));
+}
+
+
+/**
+ * @brief  Read a cursor slot from EEPROM.
+ * @param  slot   Slot of the ring.
+ * @param  cursor Destination.
+ * @return 0 - cursor of the mounted volume, 1 - empty, broken or of another card.
+ */
+static unsigned char readCursor (unsigned char slot, struct cursor_Structure *cursor)
+{
+eeprom_read_block (cursor, &eeCursors[slot], sizeof(*cursor));
+if(cursor->checksum != eepromChecksum ((unsigned char *) cursor, sizeof(*cursor) - sizeof(cursor->checksum), volumeID)) return 1;
+if((cursor->tailCluster < 2) || (cursor->tailCluster > totalClusters + 1)) return 1;
+if(cursor->dirLocation > bytesPerSector - sizeof(struct dir_Structure)) return 1;
+return 0;
+}
+
+
+/**
+ * @brief  Continue the cursor ring after the newest cursor of the mounted volume.
+ * @return none
+ */
+static void loadCursors (void)
+{
+struct cursor_Structure cursor;
+unsigned char slot, found = 0;
+
+cursorSlot = 0;
+cursorSequence = 0;
+
+for(slot=0; slot<CURSOR_SLOTS; slot++)
+{
+  if(readCursor (slot, &cursor)) continue;
+
+  //sequence numbers of the ring are close together, compare them across the wrap
+  if(!found || ((uint16_t) (cursor.sequence - cursorSequence) < 0x8000))
+  {
+    cursorSlot = (slot + 1) % CURSOR_SLOTS;
+    cursorSequence = cursor.sequence + 1;
+    found = 1;
+  }
+}
+}
+
+
+/**
+ * @brief  Save the append cursor of a handle to the next slot of the ring.
+ * 
+ * Called by syncFile() after the directory entry was written, when the tail
+ * has moved to another cluster since the last save, so the EEPROM is written
+ * about once per cluster of a file and the writes rotate over CURSOR_SLOTS.
+ * 
+ * @param  handle Open append handle with a tail cluster.
+ * @return none
+ */
+static void saveCursor (struct appendHandle_Structure *handle)
+{
+struct cursor_Structure cursor;
+unsigned char j;
+
+cursor.sequence = cursorSequence++;
+for(j=0; j<11; j++)
+  cursor.fileName[j] = handle->fileName[j];
+cursor.dirLocation = handle->dirLocation;
+cursor.dirSector = handle->dirSector;
+cursor.firstCluster = handle->firstCluster;
+cursor.tailCluster = handle->tailCluster;
+cursor.tailStart = handle->fileSize - ((unsigned long) handle->sectorIndex * bytesPerSector + handle->sectorOffset);
+cursor.checksum = eepromChecksum ((unsigned char *) &cursor, sizeof(cursor) - sizeof(cursor.checksum), volumeID);
+
+eeprom_update_block (&cursor, &eeCursors[cursorSlot], sizeof(cursor));
+cursorSlot = (cursorSlot + 1) % CURSOR_SLOTS;
+handle->savedCluster = handle->tailCluster;
+}
+
+
+/**
+ * @brief  Set up an append handle from the newest EEPROM cursor of its file.
+ * 
+ * The cursor is trusted only if the directory entry it names still holds the
+ * file with the same first cluster and a size that ends inside the saved
+ * tail cluster, and the chain from the first cluster reaches the tail cluster
+ * in the saved number of links; a file deleted and created again, changed
+ * elsewhere or repaired by recoverJournal() falls back to the directory
+ * search and the chain walk of openFile(). The check reads one FAT sector
+ * per 128 clusters of the file, the directory search is still skipped.
+ * 
+ * @param  handle Append handle holding the file name.
+ * @return 0 - handle set up, 1 - no usable cursor.
+ */
+static unsigned char openCursor (struct appendHandle_Structure *handle)
+{
+struct cursor_Structure cursor, newest = {0};
+struct dir_Structure *dir;
+unsigned char *data;
+unsigned long size, inCluster, cluster, clusterBytes, links;
+unsigned char slot, j, found = 0;
+
+for(slot=0; slot<CURSOR_SLOTS; slot++)
+{
+  if(readCursor (slot, &cursor)) continue;
+  for(j=0; j<11; j++)
+    if(cursor.fileName[j] != handle->fileName[j]) break;
+  if(j < 11) continue;
+  if(!found || ((uint16_t) (cursor.sequence - newest.sequence) < 0x8000))
+  {
+    newest = cursor;
+    found = 1;
+  }
+}
+if(!found) return 1;
+
+data = loadMetaSector (newest.dirSector);
+if(data == 0) return 1;
+dir = (struct dir_Structure *) &data[newest.dirLocation];
+for(j=0; j<11; j++)
+  if(dir->name[j] != handle->fileName[j]) return 1;
+if((((unsigned long) dir->firstClusterHI << 16) | dir->firstClusterLO) != newest.firstCluster) return 1;
+
+size = dir->fileSize;
+inCluster = size - newest.tailStart;
+clusterBytes = (unsigned long) sectorPerCluster * bytesPerSector;
+if((size && (size <= newest.tailStart)) || (inCluster > clusterBytes)) return 1;
+if(newest.tailStart % clusterBytes) return 1;
+
+//the tail cluster must be on the chain of this file, not only in use
+cluster = newest.firstCluster;
+for(links = newest.tailStart / clusterBytes; links; links--)
+{
+  cluster = getSetNextCluster (cluster, GET, 0);
+  if((cluster < 2) || (cluster > 0x0ffffff6)) return 1;
+}
+if(cluster != newest.tailCluster) return 1;
+
+cluster = getSetNextCluster (newest.tailCluster, GET, 0);
+if(cluster == 0) return 1; //tail cluster is free, the chain was changed elsewhere
+
+handle->dirSector = newest.dirSector;
+handle->dirLocation = newest.dirLocation;
+handle->firstCluster = newest.firstCluster;
+handle->fileSize = size;
+handle->tailCluster = newest.tailCluster;
+handle->sectorIndex = (unsigned char) (inCluster / bytesPerSector);
+handle->sectorOffset = (unsigned int) (inCluster % bytesPerSector);
+handle->tailSector = getFirstSector (newest.tailCluster) + handle->sectorIndex;
+if((cluster >= 2) && (cluster <= 0x0ffffff6)) handle->linkedAhead = 1;
+handle->savedCluster = newest.tailCluster;
+return 0;
+}
+#endif
+
+
+/**
+ * @brief  Search for files/directories, retrieve file address, or delete specified file.
+ * 
+ * Traverses the root directory cluster chain and searches directory entries.
+ * Can list all files (GET_LIST), locate a specific file (GET_FILE), or delete
+ * a file (DELETE). For GET_FILE, returns pointer to directory entry and stores
+ * sector/location info for later append operations.
+ * 
+ * @param  flag     GET_LIST to list directory contents, GET_FILE to find file, DELETE to remove file.
+ * @param  fileName Pointer to file name (NULL/unused if flag=GET_LIST).
+ * @return Pointer to directory entry structure if found, NULL if not found or on error.
+ */
+struct dir_Structure* findFiles (unsigned char flag, unsigned char *fileName)
+{
+unsigned long cluster, sector, firstSector, firstCluster, nextCluster;
+struct dir_Structure *dir;
+unsigned char *data;
+unsigned int i;
+unsigned char j;
+unsigned char loopCount = 0;
+
+cluster = rootCluster;
+
+while(1)
+{
+   loopCount++;
+   if(loopCount > 100) {
+       return 0;
+   }
+   
+   firstSector = getFirstSector (cluster);
+   
+   for(sector = 0; sector < sectorPerCluster; sector++)
+   {
+     data = loadMetaSector (firstSector + sector);
+     if(data == 0) return 0;
+
+     for(i=0; i<bytesPerSector; i+=32)
+     {
+        dir = (struct dir_Structure *) &data[i];
+
+        if(dir->name[0] == EMPTY)
+        {
+          if(flag == DELETE)
+              return 0;
+          return 0;   
+        }
+    if((dir->name[0] != DELETED) && (dir->attrib != ATTR_LONG_NAME))
+        {
+          if((flag == GET_FILE) || (flag == DELETE))
+          {
+            for(j=0; j<11; j++)
+            if(dir->name[j] != fileName[j]) break;
+            if(j == 11)
+            {
+              if(flag == GET_FILE)
+                    {
+                appendFileSector = firstSector + sector;
+              appendFileLocation = i;
+              appendStartCluster = (((unsigned long) dir->firstClusterHI) << 16) | dir->firstClusterLO;
+              fileSize = dir->fileSize;
+                return (dir);
+              } 
+              else
+              {
+                TX_NEWLINE;
+              TX_NEWLINE;
+              TX_NEWLINE;
+              firstCluster = (((unsigned long) dir->firstClusterHI) << 16) | dir->firstClusterLO;
+                      
+              dir->name[0] = DELETED;    
+              storeMetaSector ();
+                    
+              cluster = getSetFreeCluster (NEXT_FREE, GET, 0); 
+              if(firstCluster < cluster)
+                  getSetFreeCluster (NEXT_FREE, SET, firstCluster);
+
+              //free the whole chain, it can be longer than fileSize (reserved clusters)
+              cluster = 0;
+                while((firstCluster >= 2) && (firstCluster <= 0x0ffffff6))  
+                {
+                    nextCluster = getSetNextCluster (firstCluster, GET, 0);
+                getSetNextCluster (firstCluster, SET, 0);
+                cluster++;
+                firstCluster = nextCluster;
+                } 
+
+              freeMemoryUpdate (ADD, cluster * sectorPerCluster * bytesPerSector);
+              uart_puts_P("File deleted!");
+              return 0;
+              }
+            }
+        }
+        else
+        {
+          for(j=0; j<11; j++)
+            {
+            if(j == 8) transmitByte(' ');
+          }
+            uart_puts_P("   ");
+            if((dir->attrib != 0x10) && (dir->attrib != 0x08))
+          {
+              uart_puts_P("FILE" );
+                uart_puts_P("   ");
+              displayMemory(LOW, dir->fileSize);
+          }
+          else
+            {
+              if (dir->attrib == 0x10)
+              {
+                uart_puts(("DIR" ));
+              }
+              else
+              {
+                uart_puts(("ROOT" ));
+              }
             }
         }
        }
      }
    }
 
-   cluster = (getSetNextCluster (cluster, GET, 0));
+   cluster = (getSetNextCluster (cluster, GET, 0));
+
+   if(cluster > 0x0ffffff6) {
+          return 0;
+   }
+   if(cluster == 0) {
+       return 0;
+   }
+}
+return 0;
+}
+
+
+/**
+ * @brief  Initialise a read handle from the directory entry of a file.
+ * 
+ * Walks the cluster chain once and caches it as runs of contiguous clusters,
+ * so later seeks cost no FAT access. The walk stops when READ_EXTENTS runs
+ * are used; the clusters behind them are reached on demand by readCluster().
+ * A chain shorter than the file size limits the size to the clusters found.
+ * 
+ * @param  handle Read handle to initialise.
+ * @param  dir    Directory entry of the file (may point into buffer).
+ * @return none
+ */
+static void openReadHandle (struct readHandle_Structure *handle, struct dir_Structure *dir)
+{
+struct extent_Structure *run = 0;
+unsigned long cluster, clusters, index, clusterBytes;
+
+cluster = (((unsigned long) dir->firstClusterHI) << 16) | dir->firstClusterLO;
+
+handle->fileSize = dir->fileSize;
+handle->position = 0;
+handle->extentCount = 0;
+handle->complete = 1;
+handle->walkIndex = 0;
+
+clusterBytes = (unsigned long) sectorPerCluster * bytesPerSector;
+clusters = (handle->fileSize + clusterBytes - 1) / clusterBytes;
+
+for(index=0; index<clusters; index++)
+{
+  if((cluster < 2) || (cluster > 0x0ffffff6))
+  {
+    handle->fileSize = index * clusterBytes; //chain ends early, read what it holds
+    break;
+  }
+
+  if(run && (cluster == run->cluster + run->length))
+    run->length++;
+  else if(handle->extentCount < READ_EXTENTS)
+  {
+    run = &handle->extent[handle->extentCount++];
+    run->fileCluster = index;
+    run->cluster = cluster;
+    run->length = 1;
+  }
+  else
+  {
+    handle->complete = 0; //the rest is walked on demand
+    break;
+  }
+
+  if(index + 1 < clusters)
+    cluster = getSetNextCluster (cluster, GET, 0);
+}
+
+handle->open = 1;
+}
+
+
+/**
+ * @brief  Find the cluster with a given index inside a file opened for reading.
+ * 
+ * The cached runs answer without FAT access. An index behind them is reached
+ * by walking the chain on from the walk cursor, or from the last cached
+ * cluster if the cursor lies behind the index, so a sequential read follows
+ * every link only once.
+ * 
+ * @param  handle Open read handle.
+ * @param  index  Cluster index inside the file.
+ * @return Cluster number, 0 if the chain ends before the index.
+ */
+static unsigned long readCluster (struct readHandle_Structure *handle, unsigned long index)
+{
+struct extent_Structure *run;
+unsigned char i;
+
+for(i=0; i<handle->extentCount; i++)
+{
+  run = &handle->extent[i];
+  if(index - run->fileCluster < run->length) //also false for index < fileCluster
+    return run->cluster + (index - run->fileCluster);
+}
+
+if(handle->complete || (handle->extentCount == 0)) return 0;
+
+if((handle->walkIndex == 0) || (handle->walkIndex > index))
+{
+  run = &handle->extent[handle->extentCount - 1];
+  handle->walkIndex = run->fileCluster + run->length - 1;
+  handle->walkCluster = run->cluster + run->length - 1;
+}
+
+while(handle->walkIndex < index)
+{
+  handle->walkCluster = getSetNextCluster (handle->walkCluster, GET, 0);
+  if((handle->walkCluster < 2) || (handle->walkCluster > 0x0ffffff6))
+  {
+    handle->walkIndex = 0;
+    return 0;
+  }
+  handle->walkIndex++;
+}
+
+return handle->walkCluster;
+}
+
+
+/**
+ * @brief  Read file from SD card or verify file existence.
+ * 
+ * If flag=READ, reads file contents from SD card and outputs to UART.
+ * If flag=VERIFY, checks whether a specified file already exists on the card
+ * without reading contents.
+ * 
+ * @param  flag     READ to output file contents to UART, VERIFY to check file existence.
+ * @param  fileName Pointer to file name to read or verify.
+ * @return 0 if normal operation or flag=READ; 1 if file exists (VERIFY) or not found (READ); 2 if invalid filename format.
+ */
+unsigned char readFile (unsigned char flag, unsigned char *fileName)
+{
+struct dir_Structure *dir;
+struct readHandle_Structure handle;
+unsigned char data[32];
+unsigned int k, length;
+unsigned char error;
+
+error = convertFileName (fileName);
+if(error) {
+    return 2;
+}
+
+dir = findFiles (GET_FILE, fileName);
+
+if(dir == 0) 
+{
+  if(flag == READ) return (1);
+  else return (0);
+}
+
+if(flag == VERIFY) return (1);
+
+openReadHandle (&handle, dir);
+
+TX_NEWLINE;
+TX_NEWLINE;
+
+while((length = readFileData (&handle, data, sizeof(data))) != 0)
+{
+  for(k=0; k<length; k++)
+    transmitByte (data[k]);
+}
+
+closeReadFile (&handle);
+return 0;
+}
+
+
+/**
+ * @brief  Open file for reading.
+ * 
+ * Looks the file up in the root directory and caches its cluster runs (see
+ * openReadHandle). The size is taken from the directory entry, so data of a
+ * file open for appending is visible up to its last syncFile().
+ * 
+ * @param  handle   Read handle to initialise.
+ * @param  fileName Pointer to filename (will be converted to FAT format).
+ * @return 0 on success, 1 on error (invalid filename or file not found).
+ */
+unsigned char openReadFile (struct readHandle_Structure *handle, unsigned char *fileName)
+{
+struct dir_Structure *dir;
+
+handle->open = 0;
+
+if(convertFileName (fileName)) return 1;
+
+dir = findFiles (GET_FILE, fileName);
+if(dir == 0) return 1;
+
+openReadHandle (handle, dir);
+return 0;
+}
+
+
+/**
+ * @brief  Move the read position of an open file.
+ * 
+ * Only the position is stored; the cluster is looked up in the cached runs
+ * by the next readFileData(), so a seek costs no SD access.
+ * 
+ * @param  handle Open read handle.
+ * @param  offset Byte offset from the start of the file (0 to fileSize).
+ * @return 0 on success, 1 on error (handle not open or offset past the end).
+ */
+unsigned char seekFile (struct readHandle_Structure *handle, unsigned long offset)
+{
+if(!handle->open || (offset > handle->fileSize)) return 1;
+
+handle->position = offset;
+return 0;
+}
+
+
+/**
+ * @brief  Move the read position to the start of the last lines of a text file.
+ * 
+ * Scans the file backwards from its end one sector at a time and counts
+ * line feeds; a line feed ending the file does not start a new line. Only
+ * the sectors holding the requested lines are read.
+ * 
+ * @param  handle Open read handle.
+ * @param  lines  Number of lines to keep (a shorter file is read from its start).
+ * @return 0 on success, 1 on error (handle not open or SD error).
+ */
+unsigned char seekLastLines (struct readHandle_Structure *handle, unsigned int lines)
+{
+unsigned long position, cluster, clusterBytes;
+unsigned int i, count = 0;
+
+if(!handle->open) return 1;
+
+clusterBytes = (unsigned long) sectorPerCluster * bytesPerSector;
+position = handle->fileSize;
+
+if(lines == 0) return seekFile (handle, position);
+if(position) position--; //skip the line feed ending the last line
+
+while(position)
+{
+  cluster = readCluster (handle, (position - 1) / clusterBytes);
+  if(cluster == 0) return 1;
+  if(readSector (getFirstSector (cluster) + ((position - 1) % clusterBytes) / bytesPerSector)) return 1;
+
+  //bytes of this sector below position, from the last one down
+  for(i = (unsigned int) ((position - 1) % bytesPerSector) + 1; i; i--, position--)
+  {
+    if((buffer[i - 1] == '\n') && (++count == lines))
+    {
+      handle->position = position;
+      return 0;
+    }
+  }
+}
+
+handle->position = 0;
+return 0;
+}
+
+
+/**
+ * @brief  Read bytes from the read position into caller memory.
+ * 
+ * The data goes straight from the card into data (buffer is not used), in
+ * pieces of at most one sector. Consecutive sectors, also across clusters of
+ * one cached run, are received through a single multiple block read that
+ * stays open between calls (SD_readStream); a seek or a jump to another run
+ * restarts it. Pending tail data of an append handle is committed first.
+ * 
+ * @param  handle Open read handle.
+ * @param  data   Destination.
+ * @param  length Number of bytes to read.
+ * @return Number of bytes read, less than length at the end of the file or on SD error.
+ */
+unsigned int readFileData (struct readHandle_Structure *handle, unsigned char *data, unsigned int length)
+{
+unsigned long cluster, clusterBytes, sector;
+unsigned int offset, chunk, done = 0;
+
+if(!handle->open) return 0;
+
+commitTailSector ();
+
+clusterBytes = (unsigned long) sectorPerCluster * bytesPerSector;
+if(length > handle->fileSize - handle->position)
+  length = (unsigned int) (handle->fileSize - handle->position);
+
+while(done < length)
+{
+  cluster = readCluster (handle, handle->position / clusterBytes);
+  if(cluster == 0) break;
+
+  sector = getFirstSector (cluster) + (handle->position % clusterBytes) / bytesPerSector;
+  offset = (unsigned int) (handle->position % bytesPerSector);
+  chunk = bytesPerSector - offset;
+  if(chunk > length - done) chunk = length - done;
+
+  if(SD_readStream (sector, offset, &data[done], chunk)) break;
+
+  handle->position += chunk;
+  done += chunk;
+}
+
+return done;
+}
+
+
+/**
+ * @brief  Close a read handle and end its multiple block read.
+ * @param  handle Read handle.
+ * @return none
+ */
+void closeReadFile (struct readHandle_Structure *handle)
+{
+SD_stopStream ();
+handle->open = 0;
+}
+
+
+/**
+ * @brief  Convert filename from standard format to FAT 8.3 format.
+ * 
+ * Transforms filename into 11-byte FAT format: 8 bytes for name, 3 bytes for extension.
+ * Pads with spaces and converts lowercase to uppercase. Validates that filename
+ * does not exceed 8 characters before extension.
+ * 
+ * @param  fileName Pointer to filename (input: standard format, output: FAT 8.3 format).
+ * @return 0 on success, 1 if filename exceeds 8 characters before extension.
+ */
+unsigned char convertFileName (unsigned char *fileName)
+{
+unsigned char fileNameFAT[11];
+unsigned char j, k;
+
+for(j=0; j<12; j++)
+  if(fileName[j] == '.') break;
+
+if(j>8) {
+  return 1;
+}
+
+for(k=0; k<j; k++)
+  fileNameFAT[k] = fileName[k];
+
+for(k=j; k<=7; k++)
+  fileNameFAT[k] = ' ';
+
+j++;
+for(k=8; k<11; k++)
+{
+  if(fileName[j] != 0)
+    fileNameFAT[k] = fileName[j++];
+  else
+    while(k<11)
+      fileNameFAT[k++] = ' ';
+}
+
+for(j=0; j<11; j++)
+  if((fileNameFAT[j] >= 0x61) && (fileNameFAT[j] <= 0x7a))
+    fileNameFAT[j] -= 0x20;
+
+for(j=0; j<11; j++)
+  fileName[j] = fileNameFAT[j];
+
+return 0;
+}
+
+
+/**
+ * @brief  Append handle used by writeFile().
+ */
+static struct appendHandle_Structure writeHandle;
+
+
+/**
+ * @brief  Compare two file names in FAT 8.3 format.
+ * @param  name1 First name (11 bytes).
+ * @param  name2 Second name (11 bytes).
+ * @return 1 if the names are equal, 0 otherwise.
+ */
+static unsigned char sameFileName (const unsigned char *name1, const unsigned char *name2)
+{
+unsigned char j;
+
+for(j=0; j<11; j++)
+  if(name1[j] != name2[j]) return 0;
+
+return 1;
+}
+
+
+/**
+ * @brief  Create directory entry for a new file in the root directory.
+ * 
+ * Takes the first empty or deleted slot of the root directory. If the root
+ * directory is full, it is extended by one (zeroed) cluster.
+ * 
+ * @param  handle Append handle; fileName and firstCluster are used, the location
+ *                of the new entry is stored to dirSector and dirLocation.
+ * @return 0 on success, 1 if the root directory cannot be extended.
+ */
+static unsigned char createDirEntry (struct appendHandle_Structure *handle)
+{
+struct dir_Structure *dir;
+unsigned char *data;
+unsigned long cluster, prevCluster, firstSector;
+unsigned int i;
+unsigned char j, sector;
+
+cluster = rootCluster;
+
+while(1)
+{
+  firstSector = getFirstSector (cluster);
+
+  for(sector = 0; sector < sectorPerCluster; sector++)
+  {
+    data = loadMetaSector (firstSector + sector);
+    if(data == 0) return 1;
+
+    for(i=0; i<bytesPerSector; i+=32)
+    {
+      dir = (struct dir_Structure *) &data[i];
+
+      if((dir->name[0] == EMPTY) || (dir->name[0] == DELETED))
+      {
+        for(j=0; j<11; j++)
+          dir->name[j] = handle->fileName[j];
+        dir->attrib = ATTR_ARCHIVE;
+        dir->NTreserved = 0;
+        dir->timeTenth = 0;
+        dir->createTime = timeFAT;
+        dir->createDate = dateFAT;
+        dir->lastAccessDate = 0;
+        dir->writeTime = timeFAT;
+        dir->writeDate = dateFAT;
+        dir->firstClusterHI = (unsigned int) ((handle->firstCluster & 0xffff0000) >> 16 );
+        dir->firstClusterLO = (unsigned int) ( handle->firstCluster & 0x0000ffff);
+        dir->fileSize = 0;
+
+        storeMetaSector ();
+
+        handle->dirSector = firstSector + sector;
+        handle->dirLocation = i;
+        return 0;
+      }
+    }
+  }
+
+  prevCluster = cluster;
+  cluster = getSetNextCluster (prevCluster, GET, 0);
+
+  if(cluster > 0x0ffffff6)
+  {
+    if(cluster != EOF) return 1;
+
+    cluster = searchNextFreeCluster (prevCluster);
+    if(cluster == 0) return 1;
+
+    getSetNextCluster (prevCluster, SET, cluster);
+    getSetNextCluster (cluster, SET, EOF);
+    flushFatCache ();
+    freeMemoryUpdate (REMOVE, (unsigned long) sectorPerCluster * bytesPerSector);
+
+    //new directory cluster has to start with empty entries
+    firstSector = getFirstSector (cluster);
+    for(sector = 0; sector < sectorPerCluster; sector++)
+    {
+      data = newMetaSector (firstSector + sector);
+      for(i=0; i<512; i++)
+        data[i] = 0x00;
+      storeMetaSector ();
+    }
+  }
+  if(cluster == 0) return 1;
+}
+}
+
+
+/**
+ * @brief  Search for a run of contiguous free clusters.
+ * 
+ * Takes the run from the free-run map if it knows one that is long enough.
+ * Otherwise scans the FAT one sector at a time from startCluster to the end of
+ * the FAT, then once more from the beginning, and returns the first run that
+ * is long enough.
+ * 
+ * @param  startCluster Starting search point.
+ * @param  count        Required number of contiguous free clusters.
+ * @return First cluster of the run, 0 if there is no such run.
+ */
+static unsigned long searchFreeRun (unsigned long startCluster, unsigned long count)
+{
+unsigned long cluster, runStart, runLength, lastCluster, sector;
+uint32_t *value;
+unsigned char *fat;
+unsigned char i, pass;
+
+cluster = findFreeRun (startCluster, count);
+if(cluster) return cluster;
+
+lastCluster = totalClusters + 1;
+startCluster -= (startCluster % 128);
+
+for(pass=0; pass<2; pass++)
+{
+  runStart = 0;
+  runLength = 0;
+
+  for(cluster = startCluster; cluster <= lastCluster; cluster += 128)
+  {
+    sector = unusedSectors + reservedSectorCount + ((cluster * 4) / bytesPerSector);
+    fat = loadFatSector (sector);
+    for(i=0; i<128; i++)
+    {
+      if((cluster + i) > lastCluster) break;
+
+      value = (uint32_t *) &fat[i*4];
+      if(((*value) & 0x0fffffff) != 0)
+      {
+        runLength = 0;
+        continue;
+      }
+
+      if(runLength == 0) runStart = cluster + i;
+      if(++runLength >= count)
+      {
+        if(scanCluster == 0) scanCluster = 2; //map missed it, rebuild when idle
+        return runStart;
+      }
+    }
+  }
+
+  if(startCluster == 0) break;
+  startCluster = 0;
+}
+
+return 0;
+}
+
+
+/**
+ * @brief  Link or free a run of contiguous clusters in one pass over the FAT.
+ * 
+ * Each FAT sector covering the run is read and written once. When linking,
+ * every cluster points to the following one and the last one gets EOF.
+ * 
+ * @param  firstCluster First cluster of the run.
+ * @param  count        Number of clusters in the run.
+ * @param  link         1 to link the run into a chain, 0 to mark it free.
+ * @return 0 on success, 1 on SD write error.
+ */
+static unsigned char setClusterRun (unsigned long firstCluster, unsigned long count, unsigned char link)
+{
+unsigned long cluster, lastCluster, sector;
+uint32_t *value;
+unsigned char *fat;
+unsigned int offset;
+
+cluster = firstCluster;
+lastCluster = firstCluster + count - 1;
+
+while(cluster <= lastCluster)
+{
+  sector = unusedSectors + reservedSectorCount + ((cluster * 4) / bytesPerSector);
+  fat = loadFatSector (sector);
+
+  do
+  {
+    offset = (unsigned int) ((cluster * 4) % bytesPerSector);
+    value = (uint32_t *) &fat[offset];
+    if(!link) *value = 0;
+    else if(cluster == lastCluster) *value = EOF;
+    else *value = cluster + 1;
+    cluster++;
+  } while((cluster <= lastCluster) && ((cluster * 4) % bytesPerSector));
+
+  if(storeFatSector (sector)) return 1;
+}
+
+if(link) removeFreeRun (firstCluster, count);
+else addFreeRun (firstCluster, count);
+
+return 0;
+}
+
+
+/**
+ * @brief  Open file given by its FAT 8.3 name for appending.
+ * 
+ * Locates the directory entry (or creates the file) and walks the cluster chain
+ * once to find the cluster, sector and offset where the next byte has to be
+ * written. Later appends continue from this cursor. A new file gets a run of
+ * reserve contiguous clusters linked in one pass over the FAT; if no such run
+ * is free, it gets a single cluster as usual. With FAT_EEPROM an existing file
+ * is reopened from its saved cursor (openCursor) when that is still valid.
+ * 
+ * @param  handle   Append handle to initialise.
+ * @param  fileName Filename in FAT 8.3 format (11 bytes).
+ * @param  reserve  Number of contiguous clusters to reserve for a new file.
+ * @return 0 on success, 1 on error (no free cluster or broken cluster chain).
+ */
+static unsigned char openFile (struct appendHandle_Structure *handle, unsigned char *fileName, unsigned long reserve)
+{
+struct dir_Structure *dir;
+unsigned long cluster, remaining, clusterBytes;
+unsigned char j;
+
+handle->open = 0;
+handle->reservedEnd = 0;
+handle->linkedAhead = 0;
+handle->journalSlot = 0xff;
+handle->savedCluster = 0;
+clusterBytes = (unsigned long) sectorPerCluster * bytesPerSector;
+
+for(j=0; j<11; j++)
+  handle->fileName[j] = fileName[j];
+
+#ifdef FAT_EEPROM
+//cursor of the last session: no directory search and no chain walk
+if(openCursor (handle) == 0)
+{
+  if(writeJournal (handle, 1)) return 1;
+  handle->newClusters = 0;
+  handle->open = 1;
+  return 0;
+}
+#endif
+
+dir = findFiles (GET_FILE, fileName);
+
+if(dir == 0)
+{
+  //empty entry first, the first cluster is stored by the first syncFile()
+  if(getDateTime_FAT()) { dateFAT = 0; timeFAT = 0;}
+
+  handle->firstCluster = 0;
+  if(createDirEntry (handle)) return 1;
+  handle->fileSize = 0;
+
+  cluster = getSetFreeCluster (NEXT_FREE, GET, 0);
+  if(cluster > totalClusters)
+     cluster = rootCluster;
+
+  if(reserve > 1)
+  {
+    handle->reservedEnd = searchFreeRun (cluster, reserve);
+    if(handle->reservedEnd)
+    {
+      cluster = handle->reservedEnd;
+      handle->reservedEnd += reserve - 1;
+    }
+  }
+
+  if(handle->reservedEnd == 0)
+  {
+    reserve = 1;
+    cluster = searchNextFreeCluster (cluster);
+    if(cluster == 0) return 1;
+  }
+
+  //the intent record names the clusters before they are linked
+  handle->firstCluster = cluster;
+  handle->tailCluster = cluster;
+  if(writeJournal (handle, 1)) return 1;
+
+  if(reserve > 1)
+  {
+    if(setClusterRun (cluster, reserve, 1)) return 1;
+  }
+  else
+    getSetNextCluster (cluster, SET, EOF);
+
+  if(flushFatCache ()) return 1;
+  getSetFreeCluster (NEXT_FREE, SET, cluster + reserve - 1);
+  freeMemoryUpdate (REMOVE, reserve * clusterBytes);
+}
+else
+{
+  handle->dirSector = appendFileSector;
+  handle->dirLocation = (unsigned int) appendFileLocation;
+  handle->firstCluster = appendStartCluster;
+  handle->fileSize = fileSize;
+  reserve = 0;
+}
+
+cluster = handle->firstCluster;
+remaining = handle->fileSize;
+
+if(cluster == 0)
+{
+  if(remaining) return 1;
+
+  //empty file without any cluster, first append allocates one
+  handle->tailCluster = 0;
+  handle->tailSector = 0;
+  handle->sectorIndex = sectorPerCluster;
+  handle->sectorOffset = 0;
+}
+else
+{
+  while(remaining > clusterBytes)
+  {
+    cluster = getSetNextCluster (cluster, GET, 0);
+    if((cluster < 2) || (cluster > 0x0ffffff6)) return 1;
+    remaining -= clusterBytes;
+  }
+
+  handle->tailCluster = cluster;
+  handle->sectorIndex = (unsigned char) (remaining / bytesPerSector);
+  handle->sectorOffset = (unsigned int) (remaining % bytesPerSector);
+  handle->tailSector = getFirstSector (cluster) + handle->sectorIndex;
+
+  //clusters reserved by an earlier open are reused before allocating new ones
+  if(handle->reservedEnd == 0)
+  {
+    cluster = getSetNextCluster (cluster, GET, 0);
+    if((cluster >= 2) && (cluster <= 0x0ffffff6)) handle->linkedAhead = 1;
+  }
+}
+
+//a new file has its record already, an existing one gets it with its cursor
+if(!reserve)
+  if(writeJournal (handle, 1)) return 1;
+
+handle->newClusters = 0;
+handle->open = 1;
+return 0;
+}
+
+
+/**
+ * @brief  Open file for appending, create it if it does not exist.
+ * @param  handle   Append handle to initialise.
+ * @param  fileName Pointer to filename (will be converted to FAT format).
+ * @return 0 on success, 1 on error (invalid filename, no free cluster or broken chain).
+ */
+unsigned char openAppendFile (struct appendHandle_Structure *handle, unsigned char *fileName)
+{
+handle->open = 0;
+
+if(convertFileName (fileName)) return 1;
+
+return openFile (handle, fileName, 1);
+}
+
+
+/**
+ * @brief  Open file for appending, create it with reserved contiguous clusters.
+ * 
+ * A new file gets a run of contiguous clusters linked at once, so appends cross
+ * cluster boundaries without touching the FAT and full sectors can be streamed
+ * to the card in one multiple block write. Clusters left unused are released
+ * by closeAppendFile(). An existing file is opened as by openAppendFile().
+ * 
+ * @param  handle   Append handle to initialise.
+ * @param  fileName Pointer to filename (will be converted to FAT format).
+ * @param  clusters Number of clusters to reserve for a new file.
+ * @return 0 on success, 1 on error (invalid filename, no free cluster or broken chain).
+ */
+unsigned char openAppendFileContiguous (struct appendHandle_Structure *handle, unsigned char *fileName, unsigned long clusters)
+{
+handle->open = 0;
+
+if(convertFileName (fileName)) return 1;
+
+return openFile (handle, fileName, clusters);
+}
 
-   if(cluster > 0x0ffffff6) {
-          return 0;
-   }
-   if(cluster == 0) {
-       return 0;
-   }
+
+/**
+ * @brief  Append bytes at the end of a file opened by openAppendFile().
+ * 
+ * Continues from the cached cursor. Bytes are collected in buffer and a sector
+ * is written only when it is full (write-behind); a partly filled tail sector
+ * stays in RAM until syncFile() or until buffer is needed for another data
+ * sector; syncFile() leaves it in buffer, so the next append does not read it.
+ * Full sectors are streamed, so consecutive sectors go to the card as one
+ * multiple block write. When the tail cluster is full, the next reserved
+ * cluster is used; a new cluster is searched and linked only if there is none.
+ * The directory entry is not touched, call syncFile() to update it.
+ * 
+ * @param  handle Open append handle.
+ * @param  data   Bytes to append.
+ * @param  length Number of bytes to append.
+ * @return 0 on success, 1 on error (handle not open, no free cluster or SD write error).
+ */
+unsigned char appendData (struct appendHandle_Structure *handle, const unsigned char *data, unsigned int length)
+{
+unsigned long cluster;
+unsigned int i, start;
+
+if(!handle->open) return 1;
+
+while(length)
+{
+  if(handle->sectorIndex >= sectorPerCluster)
+  {
+    cluster = 0;
+
+    if(handle->tailCluster < handle->reservedEnd)
+      cluster = handle->tailCluster + 1; //reserved run is contiguous, no FAT access
+    else if(handle->linkedAhead)
+    {
+      cluster = getSetNextCluster (handle->tailCluster, GET, 0);
+      if((cluster < 2) || (cluster > 0x0ffffff6))
+      {
+        cluster = 0;
+        handle->linkedAhead = 0;
+      }
+    }
+
+    if(cluster == 0)
+    {
+      cluster = searchNextFreeCluster (handle->tailCluster ? handle->tailCluster : rootCluster);
+      if(cluster == 0) return 1;
+
+      if(handle->tailCluster)
+        getSetNextCluster (handle->tailCluster, SET, cluster);
+      else
+        handle->firstCluster = cluster;
+      getSetNextCluster (cluster, SET, EOF);
+      handle->newClusters++;
+    }
+
+    handle->tailCluster = cluster;
+    handle->tailSector = getFirstSector (cluster);
+    handle->sectorIndex = 0;
+  }
+
+  start = handle->sectorOffset;
+
+  //with FAT_META_BUFFER buffer keeps the tail across syncFile(), it is read back only if other data (or metadata) replaced it
+  if(start == 0)
+  {
+    if(dirtyHandle != handle)
+    {
+      commitTailSector ();
+      evictMetaSector ();
+      for(i=0; i<bytesPerSector; i++)
+        buffer[i] = 0x00;
+    }
+    bufferSector = handle->tailSector;
+  }
+  else
+    readSector (handle->tailSector);
+
+  for(i=start; (i<bytesPerSector) && length; i++, length--)
+    buffer[i] = *data++;
+
+  handle->fileSize += i - start;
+
+  if(i < bytesPerSector)
+  {
+    handle->sectorOffset = i;
+    dirtyHandle = handle;
+  }
+  else
+  {
+    dirtyHandle = 0;
+    if(SD_writeStreamBlock (handle->tailSector))
+    {
+      bufferSector = 0;
+      return 1;
+    }
+
+    handle->sectorOffset = 0;
+    handle->sectorIndex++;
+    handle->tailSector++;
+  }
 }
+
 return 0;
 }
 
 
 /**
- * @brief  Read file from SD card or verify file existence.
+ * @brief  Write pending data of an append handle and update its directory entry.
  * 
- * If flag=READ, reads file contents from SD card and outputs to UART.
- * If flag=VERIFY, checks whether a specified file already exists on the card
- * without reading contents.
+ * Commits the partly filled tail sector, stores the new size, first cluster and
+ * write time to the cached directory entry and updates the RAM copy of FSinfo
+ * if clusters were linked since the last call (see flushFSInfo()).
  * 
- * @param  flag     READ to output file contents to UART, VERIFY to check file existence.
- * @param  fileName Pointer to file name to read or verify.
- * @return 0 if normal operation or flag=READ; 1 if file exists (VERIFY) or not found (READ); 2 if invalid filename format.
+ * @param  handle Open append handle.
+ * @return 0 on success, 1 on error (handle not open or SD write error).
  */
-unsigned char readFile (unsigned char flag, unsigned char *fileName)
+unsigned char syncFile (struct appendHandle_Structure *handle)
 {
 struct dir_Structure *dir;
-unsigned long cluster, byteCounter = 0, fileSize, firstSector;
-unsigned int k;
-unsigned char j, error;
+unsigned char *data;
+unsigned char error = 0;
 
-error = convertFileName (fileName);
-if(error) {
-    return 2;
-}
+if(!handle->open) return 1;
 
-dir = findFiles (GET_FILE, fileName);
+if(dirtyHandle == handle)
+  if(commitTailSector ()) error = 1;
 
-if(dir == 0) 
+//clusters are linked on the card before the new size makes them reachable
+if(flushFatCache ()) error = 1;
+
+//clusters linked on demand are recorded before the directory entry refers to them
+if(handle->newClusters)
+  if(writeJournal (handle, 1)) error = 1;
+
+if(getDateTime_FAT()) { dateFAT = 0; timeFAT = 0;}
+
+data = loadMetaSector (handle->dirSector);
+if(data == 0) return 1;
+dir = (struct dir_Structure *) &data[handle->dirLocation];
+
+dir->lastAccessDate = 0;
+dir->writeTime = timeFAT;
+dir->writeDate = dateFAT;
+dir->firstClusterHI = (unsigned int) ((handle->firstCluster & 0xffff0000) >> 16 );
+dir->firstClusterLO = (unsigned int) ( handle->firstCluster & 0x0000ffff);
+dir->fileSize = handle->fileSize;
+if(storeMetaSector ()) error = 1;
+
+#ifdef FAT_EEPROM
+//the entry now ends inside the tail cluster, a restart can continue from there
+if(!error && handle->tailCluster && (handle->tailCluster != handle->savedCluster))
+  saveCursor (handle);
+#endif
+
+if(handle->newClusters)
 {
-  if(flag == READ) return (1);
-  else return (0);
+  getSetFreeCluster (NEXT_FREE, SET, handle->tailCluster);
+  freeMemoryUpdate (REMOVE, (unsigned long) handle->newClusters * sectorPerCluster * bytesPerSector);
+  handle->newClusters = 0;
 }
 
-if(flag == VERIFY) return (1);
+return error;
+}
 
-cluster = (((unsigned long) dir->firstClusterHI) << 16) | dir->firstClusterLO;
 
-fileSize = dir->fileSize;
+/**
+ * @brief  Write pending tail data of an append handle only.
+ * 
+ * The block write returns without waiting for the card to program the sector,
+ * so a caller can split syncFile() in two and do other work in between: once
+ * the card is ready again (SD_poll), syncFile() finds the tail clean and only
+ * updates the directory entry.
+ * 
+ * @param  handle Open append handle.
+ * @return 0 on success, 1 on error (handle not open or SD write error).
+ */
+unsigned char flushFileTail (struct appendHandle_Structure *handle)
+{
+if(!handle->open) return 1;
+
+if(dirtyHandle == handle)
+  if(commitTailSector ()) return 1;
 
-TX_NEWLINE;
-TX_NEWLINE;
+return 0;
+}
 
-while(1)
+
+/**
+ * @brief  Release clusters linked after the tail cluster of a file.
+ * 
+ * Terminates the chain at the tail cluster and frees the clusters behind it,
+ * the contiguous reserved run in one pass, other chains cluster by cluster.
+ * 
+ * @param  handle Open append handle.
+ * @return 0 on success, 1 on SD write error.
+ */
+static unsigned char trimFile (struct appendHandle_Structure *handle)
 {
-  firstSector = getFirstSector (cluster);
+unsigned long cluster, nextCluster, freed = 0;
+unsigned char error = 0;
 
-  for(j=0; j<sectorPerCluster; j++)
+if(handle->tailCluster == 0) return 0;
+
+if(handle->tailCluster < handle->reservedEnd)
+{
+  freed = handle->reservedEnd - handle->tailCluster;
+  if(setClusterRun (handle->tailCluster + 1, freed, 0)) error = 1;
+}
+else if(handle->linkedAhead)
+{
+  cluster = getSetNextCluster (handle->tailCluster, GET, 0);
+  while((cluster >= 2) && (cluster <= 0x0ffffff6))
   {
-    SD_readSingleBlock(firstSector + j);
-    
-  for(k=0; k<512; k++)
-    {
-      if ((byteCounter++) >= fileSize ) return 0;
-    }
+    nextCluster = getSetNextCluster (cluster, GET, 0);
+    getSetNextCluster (cluster, SET, 0);
+    freed++;
+    cluster = nextCluster;
   }
-  cluster = getSetNextCluster (cluster, GET, 0);
-  if(cluster == 0) {
-    return 0;}
 }
-return 0;
+else return 0;
+
+getSetNextCluster (handle->tailCluster, SET, EOF);
+handle->reservedEnd = 0;
+handle->linkedAhead = 0;
+
+if(freed)
+  freeMemoryUpdate (ADD, freed * sectorPerCluster * bytesPerSector);
+
+return error;
 }
 
 
 /**
- * @brief  Convert filename from standard format to FAT 8.3 format.
+ * @brief  Synchronise and close append handle.
  * 
- * Transforms filename into 11-byte FAT format: 8 bytes for name, 3 bytes for extension.
- * Pads with spaces and converts lowercase to uppercase. Validates that filename
- * does not exceed 8 characters before extension.
+ * Clusters reserved for the file but not filled are released, so a closed
+ * file occupies only the clusters covering its size.
  * 
- * @param  fileName Pointer to filename (input: standard format, output: FAT 8.3 format).
- * @return 0 on success, 1 if filename exceeds 8 characters before extension.
+ * @param  handle Append handle.
+ * @return 0 on success, 1 on error of the final syncFile() or of the trim.
  */
-unsigned char convertFileName (unsigned char *fileName)
+unsigned char closeAppendFile (struct appendHandle_Structure *handle)
 {
-unsigned char fileNameFAT[11];
-unsigned char j, k;
+unsigned char error;
 
-for(j=0; j<12; j++)
-  if(fileName[j] == '.') break;
+if(!handle->open) return 0;
 
-if(j>8) {
-  return 1;
+error = syncFile (handle);
+if(trimFile (handle)) error = 1;
+if(flushFatCache ()) error = 1;
+if(flushFSInfo ()) error = 1;
+
+//a failed close keeps the record, recoverJournal() finishes it at the next mount
+if(!error)
+  if(writeJournal (handle, 0)) error = 1;
+handle->open = 0;
+
+return error;
 }
 
-for(k=0; k<j; k++)
-  fileNameFAT[k] = fileName[k];
 
-for(k=j; k<=7; k++)
-  fileNameFAT[k] = ' ';
+/**
+ * @brief  Get the sector range of a contiguous file, create the file if needed.
+ * 
+ * A new file gets a run of contiguous clusters linked in one pass and a size
+ * covering all of them, so its sectors can later be written directly (e.g. as
+ * a raw ring buffer) without any FAT or directory update. Its sectors are
+ * zeroed once, in one multiple block write, so blocks left there by a deleted
+ * file cannot be taken for data of the new one. An existing file is accepted
+ * only if its cluster chain is contiguous; an entry without clusters (a
+ * creation cut short, rolled back by recoverJournal) is created again.
+ * 
+ * @param  fileName    Pointer to filename (will be converted to FAT format).
+ * @param  clusters    Number of clusters of a new file.
+ * @param  firstSector Receives the first data sector of the file.
+ * @param  sectors     Receives the number of sectors of the file.
+ * @return 0 on success, 1 on error (invalid filename, no free run or fragmented file).
+ */
+unsigned char openContiguousFile (unsigned char *fileName, unsigned long clusters, unsigned long *firstSector, unsigned long *sectors)
+{
+struct appendHandle_Structure handle;
+struct dir_Structure *dir;
+unsigned long cluster, nextCluster, count, sector;
+unsigned int i;
 
-j++;
-for(k=8; k<11; k++)
+if(convertFileName (fileName)) return 1;
+
+dir = findFiles (GET_FILE, fileName);
+
+if(dir && (appendStartCluster < 2))
 {
-  if(fileName[j] != 0)
-    fileNameFAT[k] = fileName[j++];
-  else
-    while(k<11)
-      fileNameFAT[k++] = ' ';
+  dir->name[0] = DELETED;
+  if(storeMetaSector ()) return 1;
+  dir = 0;
 }
 
-for(j=0; j<11; j++)
-  if((fileNameFAT[j] >= 0x61) && (fileNameFAT[j] <= 0x7a))
-    fileNameFAT[j] -= 0x20;
+if(dir == 0)
+{
+  if(clusters == 0) return 1;
 
-for(j=0; j<11; j++)
-  fileName[j] = fileNameFAT[j];
+  //openFile() falls back to a single cluster, check the run is there first
+  cluster = getSetFreeCluster (NEXT_FREE, GET, 0);
+  if(cluster > totalClusters) cluster = rootCluster;
+  if((clusters > 1) && (searchFreeRun (cluster, clusters) == 0)) return 1;
+
+  if(openFile (&handle, fileName, clusters)) return 1;
+
+  //the entry gets its clusters only after the run is zeroed
+  evictDataSector ();
+  evictMetaSector ();
+  for(i=0; i<bytesPerSector; i++)
+    buffer[i] = 0x00;
+
+  sector = getFirstSector (handle.firstCluster);
+  for(count = clusters * sectorPerCluster; count; count--)
+    if(SD_writeStreamBlock (sector++)) return 1;
+  if(SD_stopStream ()) return 1;
+
+  //the whole run belongs to the file, closeAppendFile() has nothing to trim
+  handle.fileSize = clusters * sectorPerCluster * bytesPerSector;
+  handle.tailCluster = handle.firstCluster + clusters - 1;
+  handle.sectorIndex = sectorPerCluster;
+  if(closeAppendFile (&handle)) return 1;
+
+  cluster = handle.firstCluster;
+  count = clusters;
+}
+else
+{
+  cluster = appendStartCluster;
+  if(cluster < 2) return 1;
+
+  count = 1;
+  nextCluster = getSetNextCluster (cluster, GET, 0);
+  while((nextCluster >= 2) && (nextCluster <= 0x0ffffff6))
+  {
+    if(nextCluster != cluster + count) return 1;
+    count++;
+    nextCluster = getSetNextCluster (nextCluster, GET, 0);
+  }
+}
 
+*firstSector = getFirstSector (cluster);
+*sectors = count * sectorPerCluster;
 return 0;
 }
 
 
 /**
- * @brief  Create new file in FAT32 format or append data to existing file.
+ * @brief  Repair one file described by an intent record.
  * 
- * If file exists, appends data to it. If file does not exist, creates new file
- * in root directory with proper directory entry. Allocates new clusters as needed,
- * updates FAT chain, and writes timestamp information from RTC.
+ * The directory entry decides: a size below the recorded size is rolled
+ * forward to it (the data and the FAT links were on the card before the
+ * record was written), otherwise the size stays. Every cluster linked
+ * behind the cluster holding the last byte is released: the rest of the
+ * reserved run in one pass and the clusters linked on demand after the
+ * record by following the chain. Only the directory sector and the FAT
+ * sectors of these clusters are read.
  * 
- * @param  fileName Pointer to filename (will be converted to FAT format).
- * @return 0 on success, 1 on failure (invalid filename, no free clusters, or SD write error).
+ * @param  record Intent record.
+ * @return 0 on success, 1 on SD error or broken chain.
  */
-unsigned char writeFile (unsigned char *fileName)
+static unsigned char repairFile (struct journal_Structure *record)
 {
-unsigned char j,k, data, error, fileCreatedFlag = 0, start = 0, appendFile = 0, sector=0;
-unsigned int i, firstClusterHigh=0, firstClusterLow=0;
 struct dir_Structure *dir;
-unsigned long cluster, nextCluster, prevCluster, firstSector, clusterCount, extraMemory;
+unsigned char *data;
+unsigned long size, first, clusterBytes, baseCount, keep, steps, runLength;
+unsigned long tail, cluster, nextCluster, freed;
+unsigned char j;
+
+clusterBytes = (unsigned long) sectorPerCluster * bytesPerSector;
+
+data = loadMetaSector (record->dirSector);
+if(data == 0) return 1;
+dir = (struct dir_Structure *) &data[record->dirLocation];
 
-j = readFile (VERIFY, fileName);
+//entry deleted or reused since, the record is stale
+for(j=0; j<11; j++)
+  if(dir->name[j] != record->fileName[j]) return 0;
+
+size = dir->fileSize;
+first = (((unsigned long) dir->firstClusterHI) << 16) | dir->firstClusterLO;
 
-if(j == 1) 
+if(size < record->baseSize)
 {
-  appendFile = 1;
-  cluster = appendStartCluster;
-  clusterCount=0;
-  while(1)
+  size = record->baseSize;
+  first = record->firstCluster;
+  dir->fileSize = size;
+  dir->firstClusterHI = (unsigned int) ((first & 0xffff0000) >> 16 );
+  dir->firstClusterLO = (unsigned int) ( first & 0x0000ffff);
+  if(storeMetaSector ()) return 1;
+}
+
+runLength = record->runStart ? (record->runEnd - record->runStart + 1) : 0;
+tail = 0;
+
+if(first)
+{
+  //clusters needed for the size, never less than the file had at the record
+  baseCount = (record->baseSize + clusterBytes - 1) / clusterBytes;
+  if(record->baseCluster && (baseCount == 0)) baseCount = 1;
+  keep = (size + clusterBytes - 1) / clusterBytes;
+  if(keep == 0) keep = 1;
+
+  tail = record->baseCluster;
+  steps = (keep > baseCount) ? (keep - baseCount) : 0;
+  if(tail == 0)
   {
-    nextCluster = getSetNextCluster (cluster, GET, 0);
-    if(nextCluster == EOF) break;
-  cluster = nextCluster;
-  clusterCount++;
+    tail = first;
+    steps = keep - 1;
+  }
+  else if(steps && (steps <= runLength))
+  {
+    tail = record->runStart + steps - 1;
+    steps = 0;
+  }
+  else if(steps)
+  {
+    if(runLength) tail = record->runEnd;
+    steps -= runLength;
   }
 
-  sector = (fileSize - (clusterCount * sectorPerCluster * bytesPerSector)) / bytesPerSector;
-  start = 1;
-}
-else if(j == 2) 
-{
-   return 1;
+  while(steps--)
+  {
+    tail = getSetNextCluster (tail, GET, 0);
+    if((tail < 2) || (tail > 0x0ffffff6)) return 1;
+  }
 }
+
+//chain linked on demand behind the run (or behind the tail without a run)
+if(runLength && ((tail == 0) || (tail == record->baseCluster) ||
+                 ((tail >= record->runStart) && (tail <= record->runEnd))))
+  cluster = getSetNextCluster (record->runEnd, GET, 0);
+else if(tail)
+  cluster = getSetNextCluster (tail, GET, 0);
 else
+  cluster = record->baseCluster ? getSetNextCluster (record->baseCluster, GET, 0) : 0;
+
+freed = 0;
+while((cluster >= 2) && (cluster <= 0x0ffffff6) && (freed < totalClusters))
 {
-  cluster = getSetFreeCluster (NEXT_FREE, GET, 0);
-  
-  if(cluster > totalClusters)
-     cluster = rootCluster;
+  nextCluster = getSetNextCluster (cluster, GET, 0);
+  getSetNextCluster (cluster, SET, 0);
+  freed++;
+  cluster = nextCluster;
+}
 
-  cluster = searchNextFreeCluster(cluster);
-  if(cluster == 0)
+if(runLength)
+{
+  if((tail >= record->runStart) && (tail <= record->runEnd))
   {
-    return 1;
+    if(tail < record->runEnd)
+      if(setClusterRun (tail + 1, record->runEnd - tail, 0)) return 1;
+  }
+  else if((tail == 0) || (tail == record->baseCluster))
+  {
+    if(setClusterRun (record->runStart, runLength, 0)) return 1;
   }
-  
-  getSetNextCluster(cluster, SET, EOF);
-  firstClusterHigh = (unsigned int) ((cluster & 0xffff0000) >> 16 );
-  firstClusterLow = (unsigned int) ( cluster & 0x0000ffff);
-  fileSize = 0;
 }
 
-k=0;
+if(tail)
+  getSetNextCluster (tail, SET, EOF);
+else if(record->baseCluster)
+  getSetNextCluster (record->baseCluster, SET, 0); //first cluster never reached the directory
 
-while(1)
+return flushFatCache ();
+}
+
+
+/**
+ * @brief  Roll back or forward the appends interrupted by a power loss.
+ * 
+ * Reads the journal sector and repairs every file whose intent record is
+ * still present (the file was not closed). The work is bounded by the
+ * records: one directory sector per file and the FAT sectors of its
+ * reserved run and of the clusters linked since the record was written; the
+ * FAT and the directory are not scanned. The free cluster count of FSinfo
+ * is marked unknown afterwards, as it may not match the repaired FAT.
+ * Call right after getBootSectorData(), before any file is opened.
+ * 
+ * @return Number of files repaired (0 - clean shutdown), 0xff on SD error.
+ */
+unsigned char recoverJournal (void)
 {
-   if(start)
-   {
-      start = 0;
-    startBlock = getFirstSector (cluster) + sector;
-    SD_readSingleBlock (startBlock);
-    i = fileSize % bytesPerSector;
-    j = sector;
-   }
-   else
-   {
-      startBlock = getFirstSector (cluster);
-    i=0;
-    j=0;
-   }
-   
-   do
-   {
-   data = dataString[k++];
-     buffer[i++] = data;
-   fileSize++;
-     
-     if(i >= 512)
-   {
-     i=0;
-     error = SD_writeSingleBlock (startBlock);
-       j++;
-     if(j == sectorPerCluster) {j = 0; break;}
-     startBlock++; 
-     }
-   } while((data != '\n') && (k < MAX_STRING_SIZE));
+struct journal_Structure record;
+unsigned char *data;
+unsigned char slot, j, repaired = 0;
+unsigned int i;
 
-   if((data == '\n') || (k >= MAX_STRING_SIZE))
-   {
-      for(;i<512;i++)
-        buffer[i]= 0x00;
-      error = SD_writeSingleBlock (startBlock);
-      break;
-   } 
- 
-   prevCluster = cluster;
-   cluster = searchNextFreeCluster(prevCluster);
-
-   if(cluster == 0)
-   {
-    return 1;
-   }
+if(journalSector == 0) return 0;
 
-   getSetNextCluster(prevCluster, SET, cluster);
-   getSetNextCluster(cluster, SET, EOF);
-}        
+for(slot=0; slot<JOURNAL_SLOTS; slot++)
+{
+  data = loadMetaSector (journalSector);
+  if(data == 0) return 0xff;
 
-getSetFreeCluster (NEXT_FREE, SET, cluster);
+  for(j=0; j<sizeof(record); j++)
+    ((unsigned char *) &record)[j] = data[slot * JOURNAL_SLOT_BYTES + j];
 
-error = getDateTime_FAT();
-if(error) { dateFAT = 0; timeFAT = 0;}
+  if(record.signature != JOURNAL_SIGNATURE) continue;
 
-if(appendFile)
-{
-  SD_readSingleBlock (appendFileSector);    
-  dir = (struct dir_Structure *) &buffer[appendFileLocation]; 
+  //a torn record is dropped, its file keeps the state of the directory entry
+  if(record.checksum == journalChecksum (&record))
+  {
+    if(repairFile (&record)) return 0xff;
+    repaired++;
+  }
 
-  dir->lastAccessDate = 0;
-  dir->writeTime = timeFAT;
-  dir->writeDate = dateFAT;
-  extraMemory = fileSize - dir->fileSize;
-  dir->fileSize = fileSize;
-  SD_writeSingleBlock (appendFileSector);
-  freeMemoryUpdate (REMOVE, extraMemory);
+  data = loadMetaSector (journalSector);
+  if(data == 0) return 0xff;
+  for(i=0; i<JOURNAL_SLOT_BYTES; i++)
+    data[slot * JOURNAL_SLOT_BYTES + i] = 0;
+  if(storeMetaSector ()) return 0xff;
+}
 
-  return 0;
+if(repaired)
+{
+  getSetFreeCluster (TOTAL_FREE, SET, 0xffffffff);
+  freeClusterCountUpdated = 0;
+  if(flushFSInfo ()) return 0xff;
+}
+
+return repaired;
 }
 
-prevCluster = rootCluster;
 
-while(1)
+/**
+ * @brief  Create new file in FAT32 format or append data to existing file.
+ * 
+ * Appends dataString (up to and including the first '\n') to the file and
+ * updates its directory entry. If the file does not exist, it is created in
+ * the root directory. The file stays open in an internal append handle, so
+ * consecutive calls with the same name skip the directory search and the
+ * cluster chain walk.
+ * 
+ * @param  fileName Pointer to filename (will be converted to FAT format).
+ * @return 0 on success, 1 on failure (invalid filename, no free clusters, or SD write error).
+ */
+unsigned char writeFile (unsigned char *fileName)
 {
-   firstSector = getFirstSector (prevCluster);
+unsigned int length;
+unsigned char error;
 
-   for(sector = 0; sector < sectorPerCluster; sector++)
-   {
-     SD_readSingleBlock (firstSector + sector);
+if(convertFileName (fileName)) return 1;
 
-     for(i=0; i<bytesPerSector; i+=32)
-     {
-      dir = (struct dir_Structure *) &buffer[i];
+if(writeHandle.open && !sameFileName (writeHandle.fileName, fileName))
+  closeAppendFile (&writeHandle);
 
-    if(fileCreatedFlag)
-     {
-           return 0;
-         }
+if(!writeHandle.open)
+  if(openFile (&writeHandle, fileName, 1)) return 1;
 
-        if((dir->name[0] == EMPTY) || (dir->name[0] == DELETED))
-    {
-      for(j=0; j<11; j++)
-        dir->name[j] = fileName[j];
-      dir->attrib = ATTR_ARCHIVE;
-      dir->NTreserved = 0;
-      dir->timeTenth = 0;
-      dir->createTime = timeFAT;
-      dir->createDate = dateFAT;
-      dir->lastAccessDate = 0;
-      dir->writeTime = timeFAT;
-      dir->writeDate = dateFAT;
-      dir->firstClusterHI = firstClusterHigh;
-      dir->firstClusterLO = firstClusterLow;
-      dir->fileSize = fileSize;
-
-      SD_writeSingleBlock (firstSector + sector);
-      fileCreatedFlag = 1;
-
-      freeMemoryUpdate (REMOVE, fileSize);
-       
-        }
-     }
-   }
+for(length=0; length<MAX_STRING_SIZE; )
+  if(dataString[length++] == '\n') break;
 
-   cluster = getSetNextCluster (prevCluster, GET, 0);
+error = appendData (&writeHandle, (const unsigned char *) dataString, length);
+if(syncFile (&writeHandle)) error = 1;
+if(flushFSInfo ()) error = 1; //writes only when a cluster was linked
 
-   if(cluster > 0x0ffffff6)
-   {
-      if(cluster == EOF)
-    {  
-    cluster = searchNextFreeCluster(prevCluster);
-    getSetNextCluster(prevCluster, SET, cluster);
-    getSetNextCluster(cluster, SET, EOF);
-      } 
-      else
-      { 
-      return 1;
-      }
-   }
-   if(cluster == 0) {
-     return 1;}
-   
-   prevCluster = cluster;
- }
- 
- return 0;
+return error;
 }
 
 
 /**
  * @brief  Search for next free cluster in FAT starting from specified cluster.
  * 
- * Scans through the FAT (File Allocation Table) to locate the first available
- * free cluster starting from the given cluster number. Searches in 128-cluster
- * increments (one FAT sector at a time) for efficiency.
+ * Takes the cluster from the free-run map when it knows a free run, without
+ * reading the card. Otherwise scans through the FAT (File Allocation Table) to
+ * locate the first available free cluster starting from the given cluster
+ * number. Searches in 128-cluster increments (one FAT sector at a time).
  * 
  * @param  startCluster Starting cluster number for search.
  * @return First free cluster found, 0 if no free clusters available or error.
  */
 unsigned long searchNextFreeCluster (unsigned long startCluster)
 {
-  unsigned long cluster, *value, sector;
+  unsigned long cluster, sector;
+  uint32_t *value;
+  unsigned char *fat;
   unsigned char i;
+
+  cluster = findFreeRun (startCluster, 1);
+  if(cluster) return cluster;
     
   startCluster -=  (startCluster % 128);
     for(cluster =startCluster; cluster <totalClusters; cluster+=128) 
     {
       sector = unusedSectors + reservedSectorCount + ((cluster * 4) / bytesPerSector);
-      SD_readSingleBlock(sector);
+      fat = loadFatSector(sector);
       for(i=0; i<128; i++)
       {
-         value = (unsigned long *) &buffer[i*4];
+         value = (uint32_t *) &fat[i*4];
          if(((*value) & 0x0fffffff) == 0)
+         {
+            if(scanCluster == 0) scanCluster = 2; //map missed it, rebuild when idle
             return(cluster+i);
+         }
       }  
     } 
 
@@ -694,16 +2715,22 @@ void deleteFile (unsigned char *fileName)
   error = convertFileName (fileName);
   if(error) return;
 
+  if(writeHandle.open && sameFileName (writeHandle.fileName, fileName))
+    closeAppendFile (&writeHandle);
+
   findFiles (DELETE, fileName);
+  flushFatCache ();
+  flushFSInfo ();
 }
 
 
 /**
- * @brief  Update free cluster count in FSinfo sector.
+ * @brief  Update free cluster count of FSinfo.
  * 
  * Maintains accurate free space information by adding or removing cluster
  * counts when files are created or deleted. Converts file size (Bytes) to
- * cluster count before updating FSinfo sector.
+ * cluster count using the cluster size of the volume. Only the RAM copy is
+ * updated, flushFSInfo() writes it to the card.
  * 
  * @param  flag ADD to increase free clusters, REMOVE to decrease.
  * @param  size File size in Bytes (converted to clusters internally).
@@ -711,11 +2738,10 @@ void deleteFile (unsigned char *fileName)
  */
 void freeMemoryUpdate (unsigned char flag, unsigned long size)
 {
-  unsigned long freeClusters;
-  if((size % 512) == 0) size = size / 512;
-  else size = (size / 512) +1;
-  if((size % 8) == 0) size = size / 8;
-  else size = (size / 8) +1;
+  unsigned long freeClusters, clusterBytes;
+
+  clusterBytes = (unsigned long) sectorPerCluster * bytesPerSector;
+  size = (size + clusterBytes - 1) / clusterBytes;
 
   if(freeClusterCountUpdated)
   {
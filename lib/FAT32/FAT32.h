@@ -13,6 +13,8 @@
 #ifndef _FAT32_H_
 #define _FAT32_H_
 
+#include <stdint.h>
+
 
 /**
  * @brief Structure to access Master Boot Record (MBR) for getting info about partitions.
@@ -20,8 +22,8 @@
 struct MBRinfo_Structure{
 unsigned char   nothing[446];       //ignore, placed here to fill the gap in the structure
 unsigned char   partitionData[64];  //partition records (16x4)
-unsigned int    signature;      //0xaa55
-};
+uint16_t        signature;      //0xaa55
+} __attribute__((packed));
 
 
 /**
@@ -30,13 +32,13 @@ unsigned int    signature;      //0xaa55
 struct partitionInfo_Structure{                 
 unsigned char   status;             //0x80 - active partition
 unsigned char   headStart;          //starting head
-unsigned int    cylSectStart;       //starting cylinder and sector
+uint16_t        cylSectStart;       //starting cylinder and sector
 unsigned char   type;               //partition type 
 unsigned char   headEnd;            //ending head of the partition
-unsigned int    cylSectEnd;         //ending cylinder and sector
-unsigned long   firstSector;        //total sectors between MBR & the first sector of the partition
-unsigned long   sectorsTotal;       //size of this partition in sectors
-};
+uint16_t        cylSectEnd;         //ending cylinder and sector
+uint32_t        firstSector;        //total sectors between MBR & the first sector of the partition
+uint32_t        sectorsTotal;       //size of this partition in sectors
+} __attribute__((packed));
 
 
 /**
@@ -45,33 +47,33 @@ unsigned long   sectorsTotal;       //size of this partition in sectors
 struct BS_Structure{
 unsigned char jumpBoot[3]; //default: 0x009000EB
 unsigned char OEMName[8];
-unsigned int bytesPerSector; //deafault: 512
+uint16_t bytesPerSector; //deafault: 512
 unsigned char sectorPerCluster;
-unsigned int reservedSectorCount;
+uint16_t reservedSectorCount;
 unsigned char numberofFATs;
-unsigned int rootEntryCount;
-unsigned int totalSectors_F16; //must be 0 for FAT32
+uint16_t rootEntryCount;
+uint16_t totalSectors_F16; //must be 0 for FAT32
 unsigned char mediaType;
-unsigned int FATsize_F16; //must be 0 for FAT32
-unsigned int sectorsPerTrack;
-unsigned int numberofHeads;
-unsigned long hiddenSectors;
-unsigned long totalSectors_F32;
-unsigned long FATsize_F32; //count of sectors occupied by one FAT
-unsigned int extFlags;
-unsigned int FSversion; //0x0000 (defines version 0.0)
-unsigned long rootCluster; //first cluster of root directory (=2)
-unsigned int FSinfo; //sector number of FSinfo structure (=1)
-unsigned int BackupBootSector;
+uint16_t FATsize_F16; //must be 0 for FAT32
+uint16_t sectorsPerTrack;
+uint16_t numberofHeads;
+uint32_t hiddenSectors;
+uint32_t totalSectors_F32;
+uint32_t FATsize_F32; //count of sectors occupied by one FAT
+uint16_t extFlags;
+uint16_t FSversion; //0x0000 (defines version 0.0)
+uint32_t rootCluster; //first cluster of root directory (=2)
+uint16_t FSinfo; //sector number of FSinfo structure (=1)
+uint16_t BackupBootSector;
 unsigned char reserved[12];
 unsigned char reserved1;
 unsigned char bootSignature;
-unsigned long volumeID;
+uint32_t volumeID;
 unsigned char volumeLabel[11]; //"NO NAME "
 unsigned char fileSystemType[8]; //"FAT32"
 unsigned char bootData[420];
-unsigned int bootEndSignature; //0xaa55
-};
+uint16_t bootEndSignature; //0xaa55
+} __attribute__((packed));
 
 
 
@@ -81,14 +83,14 @@ unsigned int bootEndSignature; //0xaa55
  */
 struct FSInfo_Structure
 {
-unsigned long leadSignature; //0x41615252
+uint32_t leadSignature; //0x41615252
 unsigned char reserved1[480];
-unsigned long structureSignature; //0x61417272
-unsigned long freeClusterCount; //initial: 0xffffffff
-unsigned long nextFreeCluster; //initial: 0xffffffff
+uint32_t structureSignature; //0x61417272
+uint32_t freeClusterCount; //initial: 0xffffffff
+uint32_t nextFreeCluster; //initial: 0xffffffff
 unsigned char reserved2[12];
-unsigned long trailSignature; //0xaa550000
-};
+uint32_t trailSignature; //0xaa550000
+} __attribute__((packed));
 
 
 /**
@@ -99,14 +101,143 @@ unsigned char name[11];
 unsigned char attrib; //file attributes
 unsigned char NTreserved; //always 0
 unsigned char timeTenth; //tenths of seconds, set to 0 here
-unsigned int createTime; //time file was created
-unsigned int createDate; //date file was created
-unsigned int lastAccessDate;
-unsigned int firstClusterHI; //higher word of the first cluster number
-unsigned int writeTime; //time of last write
-unsigned int writeDate; //date of last write
-unsigned int firstClusterLO; //lower word of the first cluster number
-unsigned long fileSize; //size of file in bytes
+uint16_t createTime; //time file was created
+uint16_t createDate; //date file was created
+uint16_t lastAccessDate;
+uint16_t firstClusterHI; //higher word of the first cluster number
+uint16_t writeTime; //time of last write
+uint16_t writeDate; //date of last write
+uint16_t firstClusterLO; //lower word of the first cluster number
+uint32_t fileSize; //size of file in bytes
+} __attribute__((packed));
+
+
+/**
+ * @brief Open-file append handle.
+ * Caches the tail of the file and the location of its directory entry, so an
+ * append neither searches the directory nor walks the cluster chain.
+ */
+struct appendHandle_Structure{
+unsigned char   fileName[11];   //name of the open file in FAT 8.3 format
+unsigned char   open;           //1 - handle holds a valid cursor
+unsigned char   sectorIndex;    //sector of tailCluster being filled, sectorPerCluster = cluster full
+unsigned int    sectorOffset;   //offset of the next byte inside tailSector
+unsigned long   firstCluster;   //first cluster of the file (0 - no cluster yet)
+unsigned long   tailCluster;    //cluster holding the end of the file
+unsigned long   tailSector;     //absolute sector receiving the next byte
+unsigned long   dirSector;      //sector holding the directory entry of the file
+unsigned int    dirLocation;    //byte offset of the directory entry inside dirSector
+unsigned long   fileSize;       //current size of the file in bytes
+unsigned int    newClusters;    //clusters linked since the last syncFile()
+unsigned long   reservedEnd;    //last cluster of the contiguous run reserved at creation (0 - none)
+unsigned char   linkedAhead;    //1 - chain continues after tailCluster (clusters reserved before open)
+unsigned char   journalSlot;    //slot of the intent record in the journal sector (0xff - none)
+unsigned long   savedCluster;   //tail cluster of the cursor saved to EEPROM (FAT_EEPROM, 0 - none)
+};
+
+
+/**
+ * @brief Intent record of an open append handle, kept in the journal sector.
+ *
+ * The journal sector is the last reserved sector of the volume. A record is
+ * written when a file is opened, when clusters were linked on demand before a
+ * directory update and cleared when the file is closed; recoverJournal()
+ * repairs the files whose records are still present after a power loss.
+ */
+struct journal_Structure{
+uint32_t        signature;      //JOURNAL_SIGNATURE - slot is used
+unsigned char   fileName[11];   //FAT 8.3 name, checked against the directory entry
+unsigned char   reserved;
+uint32_t        dirSector;      //sector holding the directory entry of the file
+uint16_t        dirLocation;    //byte offset of the directory entry inside dirSector
+uint32_t        firstCluster;   //first cluster of the file
+uint32_t        baseCluster;    //tail cluster when the record was written (0 - file had no cluster)
+uint32_t        baseSize;       //file size committed to the card when the record was written
+uint32_t        runStart;       //first cluster of the contiguous run linked after baseCluster (0 - none)
+uint32_t        runEnd;         //last cluster of that run
+uint16_t        checksum;       //sum of the previous bytes of the record
+} __attribute__((packed));
+
+
+/** @brief Number of cluster runs cached by a read handle (12 bytes of SRAM each). */
+#define READ_EXTENTS        4
+
+
+/**
+ * @brief Geometry of the last mounted volume, kept in EEPROM (FAT_EEPROM).
+ * Used at mount instead of the MBR and the BPB while the boot sector at
+ * bootSector carries the same volume ID.
+ */
+struct mount_Structure{
+uint32_t        volumeID;       //volume serial number of the boot sector
+uint32_t        bootSector;     //absolute sector of the boot sector (unusedSectors)
+uint32_t        firstDataSector;
+uint32_t        rootCluster;
+uint32_t        totalClusters;
+uint32_t        fsInfoSector;   //absolute sector of FSinfo
+uint32_t        journalSector;  //absolute sector of the journal (0 - no journal)
+uint16_t        bytesPerSector;
+uint16_t        reservedSectorCount;
+unsigned char   sectorPerCluster;
+uint16_t        checksum;       //sum of the previous bytes of the record
+} __attribute__((packed));
+
+
+/**
+ * @brief Append cursor of a file, kept in an EEPROM ring (FAT_EEPROM).
+ * Saved by syncFile() when the tail moves to another cluster, so openFile()
+ * finds the directory entry and the tail cluster without a directory search
+ * or a chain walk. The checksum includes the volume ID of the card.
+ */
+struct cursor_Structure{
+uint16_t        sequence;       //save counter, the highest valid one is the newest cursor
+unsigned char   fileName[11];   //name of the file in FAT 8.3 format
+uint16_t        dirLocation;    //byte offset of the directory entry inside dirSector
+uint32_t        dirSector;      //sector holding the directory entry of the file
+uint32_t        firstCluster;   //first cluster of the file
+uint32_t        tailCluster;    //cluster holding the end of the file when saved
+uint32_t        tailStart;      //file offset of the first byte of tailCluster
+uint16_t        checksum;       //sum of the previous bytes of the record and the volume ID
+} __attribute__((packed));
+
+
+/**
+ * @brief 512-byte sector buffer with the sector it holds: the metadata buffer
+ *        (buffer itself without FAT_META_BUFFER), and the FAT sector buffer
+ *        with FAT_CACHE.
+ */
+struct sectorCache_Structure{
+unsigned long   sector;         //absolute sector held in data (0 - empty)
+unsigned char   dirty;          //1 - data was modified and is not yet written to the card
+unsigned char   *data;          //the 512 bytes holding the sector
+};
+
+
+/**
+ * @brief Contiguous run of clusters of a file, cached by a read handle.
+ */
+struct extent_Structure{
+unsigned long   fileCluster;    //index of the first cluster of the run inside the file
+unsigned long   cluster;        //first cluster of the run
+unsigned long   length;         //number of clusters in the run
+};
+
+
+/**
+ * @brief Open-file read handle.
+ * Caches the cluster runs of the file (up to READ_EXTENTS), so a seek does
+ * not walk the cluster chain; clusters behind the cached runs are reached by
+ * walking on from the last cached cluster.
+ */
+struct readHandle_Structure{
+unsigned char   open;           //1 - handle holds a valid cursor
+unsigned char   extentCount;    //runs held in extent[]
+unsigned char   complete;       //1 - extent[] covers every cluster of the file
+unsigned long   fileSize;       //size of the file in bytes when it was opened
+unsigned long   position;       //offset of the next byte to read
+unsigned long   walkIndex;      //index inside the file of walkCluster (0 - no walk cursor)
+unsigned long   walkCluster;    //last cluster reached behind the cached runs
+struct extent_Structure extent[READ_EXTENTS];
 };
 
 
@@ -144,13 +275,54 @@ unsigned long fileSize; //size of file in bytes
 #define GET_LIST     0
 #define GET_FILE     1
 #define DELETE       2
-#define EOF     0x0fffffff
+#undef  EOF       //stdio EOF (-1), here the end-of-chain mark
+#define EOF     0x0fffffffUL
 /** @} */
 
 
 #define MAX_STRING_SIZE     100  //defining the maximum size of the dataString
 
 
+/**
+ * @brief Use this macro to give directory, FSinfo, journal and FAT sectors a
+ *        512-byte metadata buffer of their own. Without it they share buffer
+ *        with file data: the pending tail sector is written before a metadata
+ *        sector is read into buffer and read back on the next append.
+ *        Costs 512 bytes of SRAM, a quarter of the ATmega328P, for about 0.14
+ *        sector reads saved per record (tools/host/fatbench), so it is off by
+ *        default; the default firmware would not leave room for the stack.
+ */
+//#define FAT_META_BUFFER
+
+/**
+ * @brief Use this macro to give FAT sectors a buffer of their own as well, so
+ *        the chain walk does not evict the directory sector. Without it the
+ *        last FAT sector shares the metadata buffer (or buffer, see
+ *        FAT_META_BUFFER). Costs another 512 bytes of SRAM, so it is off by
+ *        default.
+ */
+//#define FAT_CACHE
+
+/**
+ * @brief Use this macro to keep the volume geometry and the append cursors in
+ *        EEPROM, so a restart skips the MBR and reopens log files without a
+ *        directory search or a cluster chain walk.
+ */
+#define FAT_EEPROM
+
+/** @brief Number of append cursors in the EEPROM ring; each save goes to the next slot to spread wear (33 bytes each). */
+#define CURSOR_SLOTS        16
+
+/** @brief Number of free cluster runs remembered by the free-run map (8 bytes of SRAM each). */
+#define FREE_RUN_SLOTS      8
+
+/** @brief Number of append handles that can be journaled at the same time (intent records in the journal sector). */
+#define JOURNAL_SLOTS       4
+
+/** @brief Signature of a used intent record ("JRNL"). */
+#define JOURNAL_SIGNATURE   0x4c4e524a
+
+
 
 //************* external variables *************
 volatile unsigned long firstDataSector, rootCluster, totalClusters;
@@ -162,6 +334,13 @@ unsigned long unusedSectors, appendFileSector, appendFileLocation, fileSize, app
 unsigned char freeClusterCountUpdated;
 
 
+//FAT sector lookups served from RAM, sectors read, sectors written back
+unsigned long fatCacheHits, fatCacheMisses, fatCacheWrites;
+
+//directory, FSinfo and journal sector lookups served from the metadata buffer, sectors read
+unsigned long metaCacheHits, metaCacheMisses;
+
+
 //data string where data is collected before sending to the card
 volatile unsigned char dataString[MAX_STRING_SIZE];
 
@@ -176,6 +355,14 @@ volatile unsigned char dataString[MAX_STRING_SIZE];
  */
 unsigned char getBootSectorData (void);
 
+/**
+ * @brief  Roll back or forward the appends interrupted by a power loss,
+ *         using the intent records of the journal sector; call right after
+ *         getBootSectorData(), before any file is opened.
+ * @return Number of files repaired (0 - clean shutdown), 0xff on SD error.
+ */
+unsigned char recoverJournal (void);
+
 /**
  * @brief  Calculate first sector address of a given cluster.
  * @param  clusterNumber Cluster number.
@@ -184,7 +371,7 @@ unsigned char getBootSectorData (void);
 unsigned long getFirstSector(unsigned long clusterNumber);
 
 /**
- * @brief  Get or set free cluster information from FSinfo sector.
+ * @brief  Get or set free cluster information of FSinfo (RAM copy, see flushFSInfo).
  * @param  totOrNext    TOTAL_FREE for count, NEXT_FREE for pointer.
  * @param  get_set      GET to read, SET to update.
  * @param  FSEntry      Value to set (if SET).
@@ -192,6 +379,12 @@ unsigned long getFirstSector(unsigned long clusterNumber);
  */
 unsigned long getSetFreeCluster(unsigned char totOrNext, unsigned char get_set, unsigned long FSEntry);
 
+/**
+ * @brief  Write changed free cluster count and next free hint to the FSinfo sector.
+ * @return 0 on success (or nothing to write), non-zero on SD write error.
+ */
+unsigned char flushFSInfo (void);
+
 /**
  * @brief  Find file or list directory contents.
  * @param  flag      GET_LIST, GET_FILE, or DELETE.
@@ -217,6 +410,47 @@ unsigned long getSetNextCluster (unsigned long clusterNumber,unsigned char get_s
  */
 unsigned char readFile (unsigned char flag, unsigned char *fileName);
 
+/**
+ * @brief  Open file for reading and cache its cluster runs.
+ * @param  handle    Read handle to initialise.
+ * @param  fileName  Pointer to filename in standard format.
+ * @return 0 on success, 1 on error (invalid name or file not found).
+ */
+unsigned char openReadFile (struct readHandle_Structure *handle, unsigned char *fileName);
+
+/**
+ * @brief  Move the read position of an open file.
+ * @param  handle  Open read handle.
+ * @param  offset  Byte offset from the start of the file (0 to fileSize).
+ * @return 0 on success, 1 on error (handle not open or offset past the end).
+ */
+unsigned char seekFile (struct readHandle_Structure *handle, unsigned long offset);
+
+/**
+ * @brief  Move the read position to the start of the last lines of a text file.
+ * @param  handle  Open read handle.
+ * @param  lines   Number of lines to keep (a shorter file is read from its start).
+ * @return 0 on success, 1 on error.
+ */
+unsigned char seekLastLines (struct readHandle_Structure *handle, unsigned int lines);
+
+/**
+ * @brief  Read bytes from the read position into caller memory.
+ *         Consecutive sectors are read through one multiple block read.
+ * @param  handle  Open read handle.
+ * @param  data    Destination.
+ * @param  length  Number of bytes to read.
+ * @return Number of bytes read, less than length at the end of the file or on SD error.
+ */
+unsigned int readFileData (struct readHandle_Structure *handle, unsigned char *data, unsigned int length);
+
+/**
+ * @brief  Close a read handle and end its multiple block read.
+ * @param  handle  Read handle.
+ * @return none
+ */
+void closeReadFile (struct readHandle_Structure *handle);
+
 /**
  * @brief  Convert standard filename to FAT 8.3 format.
  * @param  fileName  Filename buffer (in/out).
@@ -226,15 +460,98 @@ unsigned char convertFileName (unsigned char *fileName);
 
 /**
  * @brief  Write data to file (create new or append).
+ *         Keeps the file open in an internal append handle, so repeated
+ *         writes to the same file cost a constant number of block I/Os.
  * @param  fileName  Pointer to filename.
  * @return 0 on success, 1 on error.
  */
 unsigned char writeFile (unsigned char *fileName);
 
 /**
- * @brief  Append data to existing file (helper/legacy).
+ * @brief  Open file for appending (create it if it does not exist).
+ * @param  handle    Append handle to initialise.
+ * @param  fileName  Pointer to filename in standard format.
+ * @return 0 on success, 1 on error.
+ */
+unsigned char openAppendFile (struct appendHandle_Structure *handle, unsigned char *fileName);
+
+/**
+ * @brief  Open file for appending, create it with a contiguous run of clusters
+ *         reserved up front if it does not exist.
+ * @param  handle    Append handle to initialise.
+ * @param  fileName  Pointer to filename in standard format.
+ * @param  clusters  Number of clusters to reserve for a new file.
+ * @return 0 on success, 1 on error.
+ */
+unsigned char openAppendFileContiguous (struct appendHandle_Structure *handle, unsigned char *fileName, unsigned long clusters);
+
+/**
+ * @brief  Append bytes at the end of an open file.
+ *         Full sectors are written at once, a partly filled tail sector is
+ *         kept in buffer until syncFile() (write-behind).
+ * @param  handle  Open append handle.
+ * @param  data    Bytes to append.
+ * @param  length  Number of bytes.
+ * @return 0 on success, 1 on error (no free cluster or SD error).
+ */
+unsigned char appendData (struct appendHandle_Structure *handle, const unsigned char *data, unsigned int length);
+
+/**
+ * @brief  Write pending tail data and update directory entry (FSinfo in RAM).
+ * @param  handle  Open append handle.
+ * @return 0 on success, 1 on error.
+ */
+unsigned char syncFile (struct appendHandle_Structure *handle);
+
+/**
+ * @brief  Write pending tail data only, without the directory entry
+ *         (first half of syncFile, see there).
+ * @param  handle  Open append handle.
+ * @return 0 on success, 1 on error.
+ */
+unsigned char flushFileTail (struct appendHandle_Structure *handle);
+
+/**
+ * @brief  Synchronise and close an append handle, release reserved clusters
+ *         that were not filled and write FSinfo back.
+ * @param  handle  Append handle.
+ * @return 0 on success, 1 on error.
+ */
+unsigned char closeAppendFile (struct appendHandle_Structure *handle);
+
+/**
+ * @brief  Get the sector range of a contiguous file, create it with the given
+ *         number of clusters (all counted in its size) if it does not exist.
+ * @param  fileName    Pointer to filename in standard format.
+ * @param  clusters    Number of clusters of a new file.
+ * @param  firstSector Receives the first data sector of the file.
+ * @param  sectors     Receives the number of sectors of the file.
+ * @return 0 on success, 1 on error (no free run or fragmented file).
+ */
+unsigned char openContiguousFile (unsigned char *fileName, unsigned long clusters, unsigned long *firstSector, unsigned long *sectors);
+
+/**
+ * @brief  Write the cached FAT sector back to the card if it was modified.
+ * @return 0 on success (or nothing to write), non-zero on SD write error.
+ */
+unsigned char flushFatCache (void);
+
+/**
+ * @brief  Hand buffer over to code outside this library that fills it itself
+ *         (e.g. the raw ring log); pending tail data is written first.
+ * @param  release Called before this library reuses buffer, writes the owner's data.
+ * @return 0 on success, non-zero on SD write error.
+ */
+unsigned char claimDataBuffer (unsigned char (*release) (void));
+
+/**
+ * @brief  Build the free-run map in the background, a few FAT sectors per call.
+ *         Without FAT_META_BUFFER and FAT_CACHE it does nothing while buffer
+ *         holds pending tail data or belongs to claimDataBuffer()'s caller.
+ * @param  sectors Maximum number of FAT sectors to scan in this call.
+ * @return 1 if the scan is not finished yet, 0 if the map is complete.
  */
-void appendFile (void);
+unsigned char fatIdleScan (unsigned int sectors);
 
 /**
  * @brief  Search for next free cluster in FAT.
@@ -257,7 +574,7 @@ void displayMemory (unsigned char flag, unsigned long memory);
 void deleteFile (unsigned char *fileName);
 
 /**
- * @brief  Update free space count in FSinfo.
+ * @brief  Update free space count of FSinfo (RAM copy, see flushFSInfo).
  * @param  flag  ADD or REMOVE free space.
  * @param  size  Size in bytes.
  */
@@ -12,8 +12,169 @@
 
 #include <avr/io.h>
 #include "SPI_routines.h"
+#ifdef SPI_BENCH
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include <uart.h>
+#endif
 
 
+#if !defined(SPI_MSPIM) || defined(SPI_BENCH)
+
+/** @brief Wait until the SPI module has shifted the current byte. */
+#define SPDR_WAIT  while(!(SPSR & (1<<SPIF)))
+
+/**
+ * @brief Receive one byte and start the next transfer before storing it, so
+ *        the store runs while the next byte shifts.
+ */
+#define SPDR_RX_NEXT(p) do { unsigned char b; SPDR_WAIT; b = SPDR; SPDR = 0xff; *(p)++ = b; } while(0)
+
+/**
+ * @brief Fetch the next byte while the current one shifts and start it as
+ *        soon as the module is free (SPIF is cleared by the SPDR write).
+ */
+#define SPDR_TX_NEXT(p) do { unsigned char b = *(p)++; SPDR_WAIT; SPDR = b; } while(0)
+
+
+/**
+ * @brief  Transmit a block through the SPI module.
+ *
+ * The loop is unrolled by four: at SPI2X a byte takes 16 cycles, and the
+ * poll, the SPDR write and the next load fit in that time once the loop
+ * counter is left out, so the next byte starts right after SPIF.
+ *
+ * @param  data   Bytes to send.
+ * @param  length Number of bytes.
+ * @return none
+ */
+static void spdrTransmitBlock(const unsigned char *data, unsigned int length)
+{
+unsigned int n;
+
+if(!length) return;
+
+SPDR = *data++;
+n = length - 1; //bytes still to start
+while(n >= 4)
+{
+  SPDR_TX_NEXT(data);
+  SPDR_TX_NEXT(data);
+  SPDR_TX_NEXT(data);
+  SPDR_TX_NEXT(data);
+  n -= 4;
+}
+while(n--)
+  SPDR_TX_NEXT(data);
+
+SPDR_WAIT;
+(void) SPDR; //clear SPIF for the next SPI_transmit()
+}
+
+
+/**
+ * @brief  Receive a block through the SPI module (see spdrTransmitBlock).
+ * @param  data   Destination.
+ * @param  length Number of bytes.
+ * @return none
+ */
+static void spdrReceiveBlock(unsigned char *data, unsigned int length)
+{
+unsigned int n;
+
+if(!length) return;
+
+SPDR = 0xff;
+n = length - 1; //bytes followed by another transfer
+while(n >= 4)
+{
+  SPDR_RX_NEXT(data);
+  SPDR_RX_NEXT(data);
+  SPDR_RX_NEXT(data);
+  SPDR_RX_NEXT(data);
+  n -= 4;
+}
+while(n--)
+  SPDR_RX_NEXT(data);
+
+SPDR_WAIT;
+*data = SPDR;
+}
+
+#endif
+
+
+#ifdef SPI_MSPIM
+
+/**
+ * @brief  Set up USART0 as SPI master: mode 0, MSB first.
+ * @param  ubrr Baud rate register, f_XCK = F_CPU / (2 * (ubrr + 1)).
+ * @return none
+ */
+static void mspimInit(unsigned int ubrr)
+{
+UBRR0 = 0;
+DDRD |= (1<<PD4) | (1<<PD1); //XCK0 output selects master mode, TXD is MOSI
+DDRD &= ~(1<<PD0);           //RXD is MISO
+UCSR0C = (1<<UMSEL01) | (1<<UMSEL00); //MSPIM, UCPHA0 = UCPOL0 = 0 (SPI mode 0), MSB first
+UCSR0B = (1<<RXEN0) | (1<<TXEN0);
+UBRR0 = ubrr; //baud rate must be set after the transmitter is enabled
+}
+
+
+/**
+ * @brief  Transmit a block through MSPIM.
+ *
+ * A byte is written to the transmit buffer while the previous one is still
+ * shifting, so the clock runs without gaps. At most two bytes are in flight,
+ * which the two-level receive buffer holds; received bytes are dropped.
+ *
+ * @param  data   Bytes to send.
+ * @param  length Number of bytes.
+ * @return none
+ */
+static void mspimTransmitBlock(const unsigned char *data, unsigned int length)
+{
+if(!length) return;
+
+UDR0 = *data++;
+while(--length)
+{
+  UDR0 = *data++; //queued behind the byte being shifted
+  while(!(UCSR0A & (1<<RXC0)));
+  (void) UDR0;
+}
+while(!(UCSR0A & (1<<RXC0)));
+(void) UDR0;
+}
+
+
+/**
+ * @brief  Receive a block through MSPIM (see mspimTransmitBlock).
+ * @param  data   Destination.
+ * @param  length Number of bytes.
+ * @return none
+ */
+static void mspimReceiveBlock(unsigned char *data, unsigned int length)
+{
+if(!length) return;
+
+UDR0 = 0xff;
+while(--length)
+{
+  UDR0 = 0xff; //queued behind the byte being shifted
+  while(!(UCSR0A & (1<<RXC0)));
+  *data++ = UDR0;
+}
+while(!(UCSR0A & (1<<RXC0)));
+*data = UDR0;
+}
+
+#endif
+
+
+#ifndef SPI_MSPIM
+
 /**
  * @brief  Initialize SPI for SD card communication.
  *         Sets Master mode, MSB first, SCK phase low, SCK idle low.
@@ -22,12 +183,12 @@
  */
 void spi_init(void)
 {
-    
+
     // Enable SPI, Set as Master
     //- Prescaler: Fosc/16, Enable Interrupts
     //The MOSI, SCK pins
     //SPCR=(1<<SPE)|(1<<MSTR)|(1<<SPR0)|(1<<SPIE);
-    //SPR01 
+    //SPR01
 SPCR = 0x52; //setup SPI: Master mode, MSB first, SCK phase low, SCK idle low
 SPSR = 0x00;
 }
@@ -76,4 +237,211 @@ return data;
 }
 
 
+/**
+ * @brief  Transmit a block of bytes via SPI, received bytes are dropped.
+ * @param  data   Bytes to send.
+ * @param  length Number of bytes.
+ * @return none
+ */
+void SPI_transmitBlock(const unsigned char *data, unsigned int length)
+{
+spdrTransmitBlock(data, length);
+}
+
+
+/**
+ * @brief  Receive a block of bytes via SPI (0xFF is sent).
+ * @param  data   Destination.
+ * @param  length Number of bytes.
+ * @return none
+ */
+void SPI_receiveBlock(unsigned char *data, unsigned int length)
+{
+spdrReceiveBlock(data, length);
+}
+
+#else
+
+/**
+ * @brief  Initialize USART0 in SPI master mode for SD card communication.
+ *         Mode 0, MSB first, initial clock rate 125 kHz for SD initialization.
+ * @return none
+ */
+void spi_init(void)
+{
+mspimInit(63);
+}
+
+
+/**
+ * @brief  Transmit a byte via MSPIM.
+ * @param  data Byte to transmit.
+ * @return Received byte (simultaneous duplex exchange).
+ */
+unsigned char SPI_transmit(unsigned char data)
+{
+UDR0 = data;
+while(!(UCSR0A & (1<<RXC0)));
+return UDR0;
+}
+
+
+/**
+ * @brief  Receive a byte via MSPIM.
+ *         Sends 0xFF dummy byte to generate clock pulses.
+ * @return Received byte.
+ */
+unsigned char SPI_receive(void)
+{
+return SPI_transmit(0xff);
+}
+
+
+/**
+ * @brief  Transmit a block of bytes via MSPIM, received bytes are dropped.
+ * @param  data   Bytes to send.
+ * @param  length Number of bytes.
+ * @return none
+ */
+void SPI_transmitBlock(const unsigned char *data, unsigned int length)
+{
+mspimTransmitBlock(data, length);
+}
+
+
+/**
+ * @brief  Receive a block of bytes via MSPIM (0xFF is sent).
+ * @param  data   Destination.
+ * @param  length Number of bytes.
+ * @return none
+ */
+void SPI_receiveBlock(unsigned char *data, unsigned int length)
+{
+mspimReceiveBlock(data, length);
+}
+
+#endif
+
+
+#ifdef SPI_BENCH
+
+/** @brief Blocks moved per measurement (16 KB, ~17 ms at F_CPU/2). */
+#define BENCH_BLOCKS 32
+
+/** @brief Baud rate of the report with SPI_MSPIM, USART0 has no console then. */
+#define BENCH_BAUD 115200
+
+
+/**
+ * @brief  Convert Timer1 ticks of one measurement to bytes per second.
+ * @param  ticks Timer1 ticks (prescaler 256, 16 us at 16 MHz).
+ * @return Bytes per second.
+ */
+static unsigned long benchRate(unsigned int ticks)
+{
+if(!ticks) return 0;
+return (unsigned long) BENCH_BLOCKS * 512 * (F_CPU / 256) / ticks;
+}
+
+
+/**
+ * @brief  Send one result line to UART.
+ * @param  name  Transport name.
+ * @param  rxTicks Timer1 ticks spent receiving.
+ * @param  txTicks Timer1 ticks spent transmitting.
+ * @return none
+ */
+static void benchPrint(const char *name, unsigned int rxTicks, unsigned int txTicks)
+{
+char line[64];
+
+snprintf(line, sizeof(line), "SPI %s rx=%lu B/s tx=%lu B/s\r\n", name, benchRate(rxTicks), benchRate(txTicks));
+uart_puts(line);
+}
+
+
+/**
+ * @brief  Measure block transfer speed at F_CPU/2 and send bytes/s to UART:
+ *         the current path (one SPI_receive()/SPI_transmit() call per byte
+ *         after SPI_HIGH_SPEED), the SPI module block loops and, with
+ *         SPI_MSPIM, the MSPIM block loops.
+ *         The SD card must be deselected.
+ *
+ * With SPI_MSPIM the card is on the USART and Chip Select on PB2, so the
+ * SPI module runs with its pins idle and MSPIM clocks the deselected card.
+ * USART0 is then switched to asynchronous mode for the report (BENCH_BAUD)
+ * and back to MSPIM at the previous rate.
+ *
+ * @param  block 512-byte scratch buffer (e.g. the SD buffer).
+ * @return none
+ */
+void SPI_benchmark(unsigned char *block)
+{
+unsigned char spcr = SPCR, spsr = SPSR;
+unsigned char i;
+unsigned int t0, ticks[6], k;
+#ifdef SPI_MSPIM
+unsigned int ubrr = UBRR0;
+#endif
+
+for(k=0; k<512; k++) block[k] = k;
+
+#ifndef SPI_MSPIM
+//wait until the console has sent everything, interrupts are off below
+while(UCSR0B & (1<<UDRIE0));
+#endif
+
+cli();
+SPI_HIGH_SPEED;
+
+t0 = TCNT1; //current path: one SPI_receive()/SPI_transmit() call per byte
+for(i=0; i<BENCH_BLOCKS; i++)
+  for(k=0; k<512; k++) block[k] = SPI_receive();
+ticks[0] = TCNT1 - t0;
+t0 = TCNT1;
+for(i=0; i<BENCH_BLOCKS; i++)
+  for(k=0; k<512; k++) SPI_transmit(block[k]);
+ticks[1] = TCNT1 - t0;
+
+#ifdef SPI_MSPIM
+SPCR = 0x50; SPSR |= (1<<SPI2X); //SPI module at F_CPU/2, PB2 (Chip Select) is an output so it stays master
+
+t0 = TCNT1; //MSPIM block loops
+for(i=0; i<BENCH_BLOCKS; i++) mspimReceiveBlock(block, 512);
+ticks[4] = TCNT1 - t0;
+t0 = TCNT1;
+for(i=0; i<BENCH_BLOCKS; i++) mspimTransmitBlock(block, 512);
+ticks[5] = TCNT1 - t0;
+#endif
+
+t0 = TCNT1; //SPI module block loops
+for(i=0; i<BENCH_BLOCKS; i++) spdrReceiveBlock(block, 512);
+ticks[2] = TCNT1 - t0;
+t0 = TCNT1;
+for(i=0; i<BENCH_BLOCKS; i++) spdrTransmitBlock(block, 512);
+ticks[3] = TCNT1 - t0;
+
+SPCR = spcr; SPSR = spsr;
+
+#ifdef SPI_MSPIM
+UCSR0B = 0; //USART0 out of MSPIM for the report
+uart_init(UART_BAUD_SELECT(BENCH_BAUD, F_CPU));
+#endif
+sei();
+
+benchPrint("byte", ticks[0], ticks[1]);
+benchPrint("block", ticks[2], ticks[3]);
+#ifdef SPI_MSPIM
+benchPrint("mspim", ticks[4], ticks[5]);
+
+while(UCSR0B & (1<<UDRIE0)); //let the report drain, then back to the card
+while(!(UCSR0A & (1<<TXC0)));
+UCSR0B = 0;
+mspimInit(ubrr);
+#endif
+}
+
+#endif
+
+
 //******** END ****** [www.dharmanitech.com](https://www.dharmanitech.com) *****
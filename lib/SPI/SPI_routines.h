@@ -14,12 +14,41 @@
 #define _SPI_ROUTINES_H_
 
 
+/**
+ * @brief Use this macro to run the SD card on USART0 in SPI master mode (MSPIM)
+ *        instead of the SPI module.
+ *
+ * The USART transmit register is double-buffered, so the next byte is queued
+ * while the current one shifts and a block goes out with no gap between
+ * bytes; the SPI module has to be reloaded after every byte. MSPIM needs
+ * different wiring: MOSI on TXD (PD1), MISO on RXD (PD0), SCK on XCK (PD4),
+ * so Chip Select moves from PD4 to PB2 (sd_routines.h). The USART is then no
+ * longer available for the serial console (main.c disables UART output).
+ */
+//#define SPI_MSPIM
+
+/** @brief Use this macro to build SPI_benchmark() (block transfer speed of the SPI module, and of MSPIM with SPI_MSPIM). */
+//#define SPI_BENCH
+
+
+#ifdef SPI_MSPIM
+
+/** @brief Configure MSPIM for SD card initialization (low speed, F_CPU/128 = 125 kHz). */
+#define SPI_SD             UBRR0 = 63
+
+/** @brief Configure MSPIM for high speed data transfer (max speed, F_CPU/2). */
+#define SPI_HIGH_SPEED     UBRR0 = 0
+
+#else
+
 /** @brief Configure SPI for SD card initialization (low speed, ~125 kHz). */
 #define SPI_SD             SPCR = 0x52
 
 /** @brief Configure SPI for high speed data transfer (max speed, F_CPU/2). */
 #define SPI_HIGH_SPEED     SPCR = 0x50; SPSR |= (1<<SPI2X)
 
+#endif
+
 
 
 /**
@@ -41,5 +70,32 @@ unsigned char SPI_transmit(unsigned char data);
  */
 unsigned char SPI_receive(void);
 
+/**
+ * @brief  Transmit a block of bytes via SPI, received bytes are dropped.
+ * @param  data   Bytes to send.
+ * @param  length Number of bytes.
+ * @return none
+ */
+void SPI_transmitBlock(const unsigned char *data, unsigned int length);
+
+/**
+ * @brief  Receive a block of bytes via SPI (0xFF is sent).
+ * @param  data   Destination.
+ * @param  length Number of bytes.
+ * @return none
+ */
+void SPI_receiveBlock(unsigned char *data, unsigned int length);
+
+#ifdef SPI_BENCH
+/**
+ * @brief  Measure block transfer speed at F_CPU/2 (byte calls, SPI module
+ *         block loop and, with SPI_MSPIM, MSPIM block loop) and send bytes/s
+ *         to UART. The SD card must be deselected.
+ * @param  block 512-byte scratch buffer (e.g. the SD buffer).
+ * @return none
+ */
+void SPI_benchmark(unsigned char *block);
+#endif
+
 
 #endif
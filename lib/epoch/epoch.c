@@ -0,0 +1,44 @@
+/*
+ * Calendar time to seconds since 2000-01-01, shared by the RTC and the
+ * logger.
+ */
+
+
+// -- Includes ---------------------------------------------
+#include "epoch.h"
+#include <avr/pgmspace.h>
+
+
+// -- Local variables --------------------------------------
+/** @brief Days before the first day of each month in a non-leap year (flash). */
+static const uint16_t days_before_month[12] PROGMEM = {
+    0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+};
+
+
+// -- Functions --------------------------------------------
+/**
+ * @brief  Convert RTC calendar time to seconds since 2000-01-01 00:00:00.
+ * @param  year   Year (0-99, 2000-2099).
+ * @param  month  Month (1-12).
+ * @param  date   Day of month (1-31).
+ * @param  hour   Hour (0-23).
+ * @param  minute Minute (0-59).
+ * @param  second Second (0-59).
+ * @return Seconds since 2000-01-01.
+ */
+uint32_t epoch_seconds(uint8_t year, uint8_t month, uint8_t date,
+                       uint8_t hour, uint8_t minute, uint8_t second)
+{
+    uint16_t days;
+
+    if (month < 1 || month > 12)
+        month = 1;
+
+    /* 2000 is a leap year, so every year divisible by 4 up to 2099 is one */
+    days = 365 * year + (year + 3) / 4 + pgm_read_word(&days_before_month[month - 1]) + date - 1;
+    if (month > 2 && (year % 4) == 0)
+        days++;
+
+    return ((uint32_t)days * 24 + hour) * 3600UL + (uint16_t)minute * 60 + second;
+}
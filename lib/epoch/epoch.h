@@ -0,0 +1,31 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/**
+ * @file
+ * @brief Calendar time to seconds since 2000-01-01 00:00:00.
+ *
+ * The time base of the logger (record epochs, time index, log_set_time())
+ * and of the RTC timestamp; kept apart from both so neither library needs
+ * the other. Valid for 2000-2099, the range of the DS3231 year register.
+ */
+
+
+#include <stdint.h>
+
+
+/**
+ * @brief  Convert RTC calendar time to seconds since 2000-01-01 00:00:00.
+ * @param  year   Year (0-99, 2000-2099).
+ * @param  month  Month (1-12).
+ * @param  date   Day of month (1-31).
+ * @param  hour   Hour (0-23).
+ * @param  minute Minute (0-59).
+ * @param  second Second (0-59).
+ * @return Seconds since 2000-01-01.
+ */
+uint32_t epoch_seconds(uint8_t year, uint8_t month, uint8_t date,
+                       uint8_t hour, uint8_t minute, uint8_t second);
+
+
+#endif /* EPOCH_H */
@@ -0,0 +1,95 @@
+/*
+ * Delta/varint encoder for binary log records (see log_delta.h for the
+ * stream layout).
+ */
+
+
+// -- Includes ---------------------------------------------
+#include <string.h>
+#include "log_delta.h"
+
+
+// -- Local functions --------------------------------------
+/**
+ * @brief  Store a signed difference as a zig-zag varint.
+ * @param  out   Output position.
+ * @param  delta Difference to the previous value.
+ * @return Number of bytes stored (1-5).
+ */
+static uint8_t put_varint(uint8_t *out, int32_t delta)
+{
+    /* Zig-zag maps 0, -1, 1, -2 ... to 0, 1, 2, 3 ... so small values stay short */
+    uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    uint8_t length = 0;
+
+    while (value >= 0x80)
+    {
+        out[length++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+
+    return length;
+}
+
+
+// -- Functions --------------------------------------------
+/**
+ * @brief  Forget the reference record; the next record becomes a keyframe.
+ *         Call whenever the stream is (re)opened.
+ * @param  state Encoder state.
+ * @return none
+ */
+void log_delta_reset(struct log_delta *state)
+{
+    state->valid = 0;
+}
+
+
+/**
+ * @brief  Encode one record as a keyframe or a delta to the previous record.
+ * @param  state    Encoder state, updated to the new record.
+ * @param  rec      Record to encode (crc8 field is not used).
+ * @param  keyframe 1 - force a keyframe (start of a sector).
+ * @param  out      Output, at least LOG_DELTA_BUFFER_SIZE bytes.
+ * @return Number of bytes stored in out, at most LOG_DELTA_KEYFRAME_SIZE.
+ */
+uint8_t log_delta_encode(struct log_delta *state, const struct log_record *rec,
+                         uint8_t keyframe, uint8_t *out)
+{
+    const struct log_record *prev = &state->prev;
+    uint8_t length = 1;
+
+    if (!keyframe && state->valid)
+    {
+        out[0] = LOG_DELTA_DELTA | (rec->flags & LOG_DELTA_FLAGS_MASK);
+        length += put_varint(&out[length], (int32_t)(rec->epoch - prev->epoch));
+        length += put_varint(&out[length], (int32_t)rec->t100 - prev->t100);
+        length += put_varint(&out[length], (int32_t)(rec->press_pa - prev->press_pa));
+        length += put_varint(&out[length], (int32_t)(rec->hum_x1024 - prev->hum_x1024));
+        length += put_varint(&out[length], (int32_t)rec->voc_index - prev->voc_index);
+        length += put_varint(&out[length], (int32_t)rec->nox_index - prev->nox_index);
+
+        /* A jump (e.g. after a sensor error) can cost more than a keyframe */
+        if (length + 1 > LOG_DELTA_KEYFRAME_SIZE)
+            keyframe = 1;
+    }
+    else
+        keyframe = 1;
+
+    if (keyframe)
+    {
+        /* Payload is the record without flags and crc8 (little-endian on AVR) */
+        out[0] = LOG_DELTA_KEYFRAME | (rec->flags & LOG_DELTA_FLAGS_MASK);
+        memcpy(&out[1], rec, LOG_DELTA_KEYFRAME_SIZE - 2);
+        length = LOG_DELTA_KEYFRAME_SIZE - 1;
+    }
+
+    out[length] = log_crc8(out, length);
+    length++;
+
+    state->prev = *rec;
+    state->valid = 1;
+
+    return length;
+}
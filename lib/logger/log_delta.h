@@ -0,0 +1,81 @@
+#ifndef LOG_DELTA_H
+#define LOG_DELTA_H
+
+/**
+ * @file
+ * @brief Delta/varint compressed stream of binary log records.
+ *
+ * Each sector of a compressed file starts with a keyframe, so every 512-byte
+ * block decodes on its own. The following records store the difference of
+ * every channel to the previous record as a zig-zag varint (7 bits per byte,
+ * low group first, bit 7 = more bytes follow). A record that does not fit in
+ * the rest of the sector is moved to the next sector as a keyframe and the
+ * gap is filled with zeros. tools/bin2csv.cpp decodes such files.
+ *
+ * | tag byte     | meaning                                              |
+ * |--------------|------------------------------------------------------|
+ * | 0x00         | padding up to the end of the sector                  |
+ * | 0x40 + flags | keyframe: epoch, t100, press_pa, hum_x1024,          |
+ * |              | voc_index, nox_index as in struct log_record, crc8   |
+ * | 0x80 + flags | delta: six zig-zag varints in the same order, crc8   |
+ *
+ * The crc8 byte is CRC-8/CCITT of the tag and payload bytes (log_crc8).
+ * Flags (LOG_FLAG_...) are stored in the low bits of the tag.
+ */
+
+
+#include <stdint.h>
+#include "log_record.h"
+
+
+/**
+ * @defgroup LogDeltaTags Record tags
+ * @{
+ */
+#define LOG_DELTA_PAD           0x00    /**< @brief Rest of the sector is padding */
+#define LOG_DELTA_KEYFRAME      0x40    /**< @brief Keyframe tag (ORed with flags) */
+#define LOG_DELTA_DELTA         0x80    /**< @brief Delta tag (ORed with flags) */
+#define LOG_DELTA_FLAGS_MASK    0x3F    /**< @brief Flag bits of the tag */
+/** @} */
+
+
+/**
+ * @defgroup LogDeltaSizes Encoded sizes
+ * @{
+ */
+#define LOG_DELTA_KEYFRAME_SIZE 20  /**< @brief Tag, 18 payload bytes, crc8 */
+#define LOG_DELTA_BUFFER_SIZE   26  /**< @brief Longest delta before falling back to a keyframe */
+/** @} */
+
+
+/**
+ * @brief Encoder state: the last record written to the stream.
+ */
+struct log_delta {
+    struct log_record prev; /**< @brief Reference for the next delta */
+    uint8_t valid;          /**< @brief 0 - next record must be a keyframe */
+};
+
+
+/**
+ * @brief  Forget the reference record; the next record becomes a keyframe.
+ *         Call whenever the stream is (re)opened.
+ * @param  state Encoder state.
+ * @return none
+ */
+void log_delta_reset(struct log_delta *state);
+
+
+/**
+ * @brief  Encode one record as a keyframe or a delta to the previous record.
+ * @param  state    Encoder state, updated to the new record.
+ * @param  rec      Record to encode (crc8 field is not used).
+ * @param  keyframe 1 - force a keyframe (start of a sector).
+ * @param  out      Output, at least LOG_DELTA_BUFFER_SIZE bytes.
+ * @return Number of bytes stored in out, at most LOG_DELTA_KEYFRAME_SIZE.
+ */
+uint8_t log_delta_encode(struct log_delta *state, const struct log_record *rec,
+                         uint8_t keyframe, uint8_t *out);
+
+
+#endif /* LOG_DELTA_H */
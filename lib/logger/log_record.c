@@ -0,0 +1,62 @@
+/*
+ * Fixed-size binary log record helpers: CRC and record positions inside a
+ * file.
+ */
+
+
+// -- Includes ---------------------------------------------
+#include <util/crc16.h>
+#include "log_record.h"
+
+
+// -- Functions --------------------------------------------
+/**
+ * @brief  Compute CRC-8/CCITT (polynomial 0x07, initial value 0) of a byte block.
+ * @param  data   Bytes.
+ * @param  length Number of bytes.
+ * @return CRC value.
+ */
+uint8_t log_crc8(const uint8_t *data, uint16_t length)
+{
+    uint8_t crc = 0;
+
+    while (length--)
+        crc = _crc8_ccitt_update(crc, *data++);
+
+    return crc;
+}
+
+
+/**
+ * @brief  Store the CRC of a filled record into its crc8 field.
+ * @param  rec Record.
+ * @return none
+ */
+void log_record_seal(struct log_record *rec)
+{
+    rec->crc8 = log_crc8((const uint8_t *)rec, LOG_RECORD_SIZE - 1);
+}
+
+
+/**
+ * @brief  Byte offset of a record inside a binary log file (for seekFile).
+ * @param  index Record number, 0 is the first record of the file.
+ * @return Offset of the record.
+ */
+uint32_t log_record_offset(uint32_t index)
+{
+    return (index / LOG_RECORDS_PER_SECTOR) * 512UL +
+           (uint16_t)(index % LOG_RECORDS_PER_SECTOR) * LOG_RECORD_SIZE;
+}
+
+
+/**
+ * @brief  Number of whole records in a binary log file.
+ * @param  file_size File size in bytes.
+ * @return Number of records.
+ */
+uint32_t log_record_count(uint32_t file_size)
+{
+    return (file_size / 512) * LOG_RECORDS_PER_SECTOR +
+           (uint16_t)(file_size % 512) / LOG_RECORD_SIZE;
+}
@@ -0,0 +1,102 @@
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+/**
+ * @file
+ * @brief Fixed-size binary log record (alternative to CSV lines).
+ *
+ * A record is 20 bytes, little-endian, without padding between fields. A
+ * record never straddles a sector: LOG_RECORDS_PER_SECTOR records fill the
+ * start of each 512-byte sector and the last LOG_SECTOR_PAD bytes of the
+ * sector are zero. A zero epoch marks an unused slot, and the CRC covers the
+ * first 19 bytes. tools/bin2csv.cpp converts such files back to CSV.
+ *
+ * log_record_offset() and log_record_count() map record numbers to file
+ * offsets, e.g. the last n records of an open read handle start at
+ * log_record_offset(log_record_count(handle.fileSize) - n).
+ *
+ * | offset | size | field      | unit                              |
+ * |--------|------|------------|-----------------------------------|
+ * | 0      | 4    | epoch      | s since 2000-01-01 00:00:00 (RTC) |
+ * | 4      | 2    | t100       | 0.01 degC (signed)                |
+ * | 6      | 4    | press_pa   | Pa                                |
+ * | 10     | 4    | hum_x1024  | %RH * 1024                        |
+ * | 14     | 2    | voc_index  | Sensirion VOC index               |
+ * | 16     | 2    | nox_index  | Sensirion NOx index               |
+ * | 18     | 1    | flags      | LOG_FLAG_...                      |
+ * | 19     | 1    | crc8       | CRC-8/CCITT of bytes 0-18         |
+ */
+
+
+#include <stdint.h>
+
+
+/**
+ * @defgroup LogRecordLayout Record layout
+ * @{
+ */
+#define LOG_RECORD_SIZE         20  /**< @brief Bytes per record */
+#define LOG_RECORDS_PER_SECTOR  (512 / LOG_RECORD_SIZE)  /**< @brief Records per sector (25) */
+#define LOG_SECTOR_PAD          (512 - LOG_RECORDS_PER_SECTOR * LOG_RECORD_SIZE)  /**< @brief Zero bytes at the end of each sector (12) */
+/** @} */
+
+
+/**
+ * @defgroup LogRecordFlags Record status flags
+ * @{
+ */
+#define LOG_FLAG_RTC_ERROR  0x01    /**< @brief RTC not responding, epoch is not valid */
+#define LOG_FLAG_BME_ERROR  0x02    /**< @brief BME280 read failed, t100/press_pa/hum_x1024 are 0 */
+#define LOG_FLAG_SGP_ERROR  0x04    /**< @brief SGP41 read failed, voc_index/nox_index are 0 */
+/** @} */
+
+
+/**
+ * @brief Binary log record, packed to LOG_RECORD_SIZE bytes (AVR is little-endian).
+ */
+struct log_record {
+    uint32_t epoch;         /**< @brief Seconds since 2000-01-01 00:00:00 */
+    int16_t  t100;          /**< @brief Temperature in 0.01 degC */
+    uint32_t press_pa;      /**< @brief Pressure in Pa */
+    uint32_t hum_x1024;     /**< @brief Relative humidity in %RH * 1024 */
+    uint16_t voc_index;     /**< @brief VOC index */
+    uint16_t nox_index;     /**< @brief NOx index */
+    uint8_t  flags;         /**< @brief LOG_FLAG_... */
+    uint8_t  crc8;          /**< @brief CRC of the previous bytes (log_record_seal) */
+} __attribute__((packed));
+
+
+/**
+ * @brief  Compute CRC-8/CCITT (polynomial 0x07, initial value 0) of a byte block.
+ * @param  data   Bytes.
+ * @param  length Number of bytes.
+ * @return CRC value.
+ */
+uint8_t log_crc8(const uint8_t *data, uint16_t length);
+
+
+/**
+ * @brief  Store the CRC of a filled record into its crc8 field.
+ * @param  rec Record.
+ * @return none
+ */
+void log_record_seal(struct log_record *rec);
+
+
+/**
+ * @brief  Byte offset of a record inside a binary log file (for seekFile).
+ * @param  index Record number, 0 is the first record of the file.
+ * @return Offset of the record.
+ */
+uint32_t log_record_offset(uint32_t index);
+
+
+/**
+ * @brief  Number of whole records in a binary log file.
+ * @param  file_size File size in bytes.
+ * @return Number of records.
+ */
+uint32_t log_record_count(uint32_t file_size);
+
+
+#endif /* LOG_RECORD_H */
@@ -0,0 +1,880 @@
+/*
+ * Write-behind log writer for the FAT32 library.
+ *
+ * Collects records through the append handle of FAT32.c and commits the
+ * directory entry only on a record-count or time deadline, FSinfo only on
+ * a checkpoint. Keeps the sidecar time index of the file.
+ */
+
+
+// -- Includes ---------------------------------------------
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <uart.h>
+#include "FAT32.h"
+#include "sd_routines.h"
+#include "logger.h"
+
+
+// -- Local variables --------------------------------------
+/** @brief Append handle of the log file. */
+static struct appendHandle_Structure log_handle;
+
+/** @brief Append handle of the sidecar time index. */
+static struct appendHandle_Structure index_handle;
+
+/** @brief Index entries not yet appended to the index file. */
+static struct log_index_entry index_batch[LOG_INDEX_BATCH];
+
+/** @brief Entries held in index_batch. */
+static uint8_t index_count = 0;
+
+/** @brief Data file offset from which the next record gets an index entry. */
+static uint32_t index_next = 0;
+
+/** @brief Time of the next record written by log_write() (0 = unknown). */
+static uint32_t record_time = 0;
+
+/** @brief Logger statistics. */
+static struct log_stats stats;
+
+/** @brief Flush deadline in records. */
+static uint16_t flush_records = LOG_FLUSH_RECORDS;
+
+/** @brief Flush deadline in seconds. */
+static uint16_t flush_seconds = LOG_FLUSH_SECONDS;
+
+/** @brief Deadline flushes since FSinfo was last written. */
+static uint8_t fsinfo_syncs = 0;
+
+/** @brief File format of rotated files (LOG_FORMAT_...). */
+static uint8_t file_format = LOG_FORMAT_CSV;
+
+#ifdef LOG_DELTA_FORMAT
+/** @brief Delta encoder state of the open file (LOG_FORMAT_DELTA). */
+static struct log_delta delta;
+#endif
+
+/** @brief Rotation mode (LOG_ROTATE_...). */
+static uint8_t rotate_mode = LOG_ROTATE_NONE;
+
+/** @brief File size limit in bytes (0 = no limit). */
+static uint32_t rotate_bytes = 0;
+
+/** @brief Space reserved for each new rotated file in bytes. */
+static uint32_t rotate_reserve = 0;
+
+/** @brief Period of the open rotated file: year, month, date, hour (0 in day mode). */
+static uint8_t period[4];
+
+/** @brief Number of the file inside the period (0 = .CSV, n = .Cnn). */
+static uint8_t sequence = 0;
+
+/** @brief Records appended since the last flush. */
+static uint16_t pending_records = 0;
+
+/** @brief 1 - there are records waiting for a flush (read by log_tick ISR). */
+static volatile uint8_t pending = 0;
+
+/** @brief Seconds since the oldest unflushed record (advanced by log_tick). */
+static volatile uint16_t pending_seconds = 0;
+
+/** @brief 1 - tail sector of a deadline flush written, directory entry still to update. */
+static uint8_t sync_due = 0;
+
+
+// -- Local functions --------------------------------------
+/**
+ * @brief  Forget pending records and restart the time deadline.
+ * @return none
+ */
+static void log_restart_deadline(void)
+{
+    pending_records = 0;
+    sync_due = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        pending = 0;
+        pending_seconds = 0;
+    }
+}
+
+
+/**
+ * @brief  Check whether the time deadline has expired.
+ * @return 1 if expired, 0 otherwise.
+ */
+static uint8_t log_time_expired(void)
+{
+    uint16_t seconds;
+
+    if (flush_seconds == 0)
+        return 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        seconds = pending_seconds;
+    }
+    return seconds >= flush_seconds;
+}
+
+
+/**
+ * @brief  Derive the sidecar index name from a data file name: the extension
+ *         becomes IDX, or Inn for a continuation file .Xnn.
+ * @param  fileName Data file name in 8.3 format.
+ * @param  name     Receives the index file name (13 bytes).
+ * @return none
+ */
+static void log_index_name(const char *fileName, char *name)
+{
+    const char *ext = strchr(fileName, '.');
+    uint8_t length = ext ? (uint8_t)(ext - fileName) : (uint8_t)strlen(fileName);
+
+    if (length > 8)
+        length = 8;
+    memcpy(name, fileName, length);
+    strcpy(&name[length], ".IDX");
+
+    if (ext && ext[1] && isdigit((unsigned char)ext[2]) && isdigit((unsigned char)ext[3]) && !ext[4])
+    {
+        name[length + 2] = ext[2];
+        name[length + 3] = ext[3];
+    }
+}
+
+
+/**
+ * @brief  Get the format of a data file from its extension (.CSV/.Cnn, .BIN/.Bnn, .DLT/.Dnn).
+ * @param  fileName Data file name in 8.3 format.
+ * @return LOG_FORMAT_CSV, LOG_FORMAT_BIN or LOG_FORMAT_DELTA.
+ */
+static uint8_t log_format_of(const char *fileName)
+{
+    const char *ext = strchr(fileName, '.');
+    char kind = ext ? (char)toupper((unsigned char)ext[1]) : 'C';
+
+    if (kind == 'B')
+        return LOG_FORMAT_BIN;
+    if (kind == 'D')
+        return LOG_FORMAT_DELTA;
+    return LOG_FORMAT_CSV;
+}
+
+
+/**
+ * @brief  Check the header entry of an index opened for reading.
+ * @param  index  Read handle of the index, at its start.
+ * @param  format Format of the data file (LOG_FORMAT_...).
+ * @return 1 if the index belongs to a file of this format, 0 otherwise.
+ */
+static uint8_t log_index_valid(struct readHandle_Structure *index, uint8_t format)
+{
+    struct log_index_entry header;
+
+    if (readFileData(index, (unsigned char *)&header, sizeof(header)) != sizeof(header))
+        return 0;
+
+    return header.epoch == 0 && header.offset == LOG_INDEX_HEADER(format);
+}
+
+
+/**
+ * @brief  Open (or create) the sidecar index of a data file for appending.
+ *
+ * A new index gets its header entry with the first batch. An index holding
+ * entries of a file of another format is left alone, the data file is then
+ * written without index.
+ *
+ * @param  fileName Data file name in 8.3 format.
+ * @return none
+ */
+static void log_index_open(const char *fileName)
+{
+    struct readHandle_Structure index;
+    unsigned char name[13];
+    uint8_t valid = 1;
+
+    log_index_name(fileName, (char *)name);
+    if (openReadFile(&index, name) == 0)
+    {
+        if (index.fileSize)
+            valid = log_index_valid(&index, file_format);
+        closeReadFile(&index);
+    }
+    if (!valid)
+        return;
+
+    /* openReadFile() has converted name to the FAT format */
+    log_index_name(fileName, (char *)name);
+    if (openAppendFile(&index_handle, name))
+        return;
+
+    if (index_handle.fileSize == 0)
+    {
+        index_batch[0].epoch = 0;
+        index_batch[0].offset = LOG_INDEX_HEADER(file_format);
+        index_count = 1;
+    }
+}
+
+
+/**
+ * @brief  Append the collected index entries and update the index directory entry.
+ * @return 0 on success, 1 on error.
+ */
+static uint8_t log_index_flush(void)
+{
+    uint8_t error;
+
+    if (index_count == 0 || !index_handle.open)
+        return 0;
+
+    error = appendData(&index_handle, (const unsigned char *)index_batch,
+                       index_count * sizeof(struct log_index_entry));
+    if (syncFile(&index_handle))
+        error = 1;
+
+    stats.index_entries += index_count;
+    index_count = 0;
+
+    return error;
+}
+
+
+/**
+ * @brief  Collect an index entry for the record about to be appended if it is
+ *         the first one starting in a new index interval.
+ * @return 0 on success, 1 on error.
+ */
+static uint8_t log_index_record(void)
+{
+    const uint32_t interval = LOG_INDEX_SECTORS * 512UL;
+    uint32_t offset = log_handle.fileSize;
+
+    if (!LOG_INDEX_SECTORS || !index_handle.open || record_time == 0 || offset < index_next)
+        return 0;
+
+    index_batch[index_count].epoch = record_time;
+    index_batch[index_count].offset = offset;
+    index_next = (offset / interval + 1) * interval;
+
+    if (++index_count < LOG_INDEX_BATCH)
+        return 0;
+
+    return log_index_flush();
+}
+
+
+/**
+ * @brief  Update directory entry, restart the flush deadlines and write
+ *         FSinfo back on a checkpoint.
+ * @param  checkpoint 1 - write FSinfo now, 0 - only every LOG_FSINFO_SYNCS calls.
+ * @return 0 on success, 1 on error.
+ */
+static uint8_t log_sync(uint8_t checkpoint)
+{
+    uint8_t error = syncFile(&log_handle);
+
+    if (checkpoint || ++fsinfo_syncs >= LOG_FSINFO_SYNCS)
+    {
+        fsinfo_syncs = 0;
+        if (checkpoint && log_index_flush())
+            error = 1;
+        if (flushFSInfo())
+            error = 1;
+    }
+
+    stats.flushes++;
+    log_restart_deadline();
+
+    return error;
+}
+
+
+/**
+ * @brief  Start a deadline flush by writing the tail sector only. The block
+ *         write does not wait for the card; the directory entry is updated
+ *         (log_sync) by a later call once the card is ready, so neither step
+ *         stalls on the card while it programs.
+ * @return 0 on success, 1 on error.
+ */
+static uint8_t log_start_sync(void)
+{
+    sync_due = 1;
+    return flushFileTail(&log_handle);
+}
+
+
+/**
+ * @brief  Account block I/O and latency of one logger call.
+ * @param  t0 Timer1 value at the start of the call.
+ * @param  r0 blockReadCount at the start of the call.
+ * @param  w0 blockWriteCount at the start of the call.
+ * @param  b0 busyWaitCount at the start of the call.
+ * @return none
+ */
+static void log_account(uint16_t t0, uint32_t r0, uint32_t w0, uint32_t b0)
+{
+    uint16_t latency = (uint16_t)(TCNT1 - t0);
+
+    stats.block_reads += blockReadCount - r0;
+    stats.block_writes += blockWriteCount - w0;
+    stats.busy_waits += busyWaitCount - b0;
+
+    /* Unbuffered append costs at least a data sector and a directory write */
+    if (2 * stats.records > stats.block_writes)
+        stats.writes_saved = 2 * stats.records - stats.block_writes;
+    else
+        stats.writes_saved = 0;
+
+    stats.last_latency = latency;
+    if (latency > stats.max_latency)
+        stats.max_latency = latency;
+}
+
+
+/**
+ * @brief  Close the current file and open the file of the current period and sequence.
+ * @return 0 on success, 1 on error.
+ */
+static uint8_t log_open_period(void)
+{
+    char name[13];
+    const char *ext = "CSV";
+
+    if (file_format == LOG_FORMAT_BIN)
+        ext = "BIN";
+    else if (file_format == LOG_FORMAT_DELTA)
+        ext = "DLT";
+
+    /* Every field has two digits (period from the RTC, sequence below 100) */
+    if (sequence == 0)
+        snprintf(name, sizeof(name), "%02u%02u%02u%02u.%s",
+                 period[0] % 100, period[1] % 100, period[2] % 100, period[3] % 100, ext);
+    else
+        snprintf(name, sizeof(name), "%02u%02u%02u%02u.%c%02u",
+                 period[0] % 100, period[1] % 100, period[2] % 100, period[3] % 100, ext[0], sequence % 100);
+
+    stats.rotations++;
+    return log_open(name, rotate_reserve);
+}
+
+
+/**
+ * @brief  Move to the next file of the period when the record does not fit.
+ * @param  length Length of the record to be written.
+ * @return 0 on success or no rotation needed, 1 on error.
+ */
+static uint8_t log_check_size(uint16_t length)
+{
+    uint8_t error = 0;
+
+    /* Files that already exist (e.g. after a reset) are skipped as well */
+    while (rotate_mode != LOG_ROTATE_NONE && rotate_bytes && sequence < 99 &&
+           log_handle.open && log_handle.fileSize &&
+           log_handle.fileSize + length > rotate_bytes)
+    {
+        sequence++;
+        error = log_open_period();
+    }
+
+    return error;
+}
+
+
+// -- Functions --------------------------------------------
+/**
+ * @brief  Open (or create) the log file and reset the flush deadlines.
+ *
+ * A new file is created with reserveBytes of contiguous clusters reserved up
+ * front, so full sectors are streamed across cluster boundaries without FAT
+ * updates. Unused reserved clusters are released by log_close().
+ *
+ * The sidecar time index is opened (or created) next to it; the log works
+ * without it if it cannot be opened.
+ *
+ * @param  fileName     File name in 8.3 format, e.g. "data1.csv" (index "data1.IDX").
+ * @param  reserveBytes Space to reserve for a new file (0 = allocate on demand).
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_open(const char *fileName, uint32_t reserveBytes)
+{
+    unsigned char name[13];
+    uint32_t cluster_bytes = (uint32_t)sectorPerCluster * bytesPerSector;
+
+    log_close();
+
+    strncpy((char *)name, fileName, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+
+    log_restart_deadline();
+#ifdef LOG_DELTA_FORMAT
+    log_delta_reset(&delta);
+#endif
+
+    if (openAppendFileContiguous(&log_handle, name,
+                                 (reserveBytes + cluster_bytes - 1) / cluster_bytes))
+        return 1;
+
+    /* A reopened file gets an entry with its next record */
+    index_count = 0;
+    index_next = log_handle.fileSize;
+    if (LOG_INDEX_SECTORS)
+        log_index_open(fileName);
+
+    return 0;
+}
+
+
+/**
+ * @brief  Set rotation policy used by log_rotate() and log_write().
+ * @param  mode         LOG_ROTATE_NONE, LOG_ROTATE_DAY or LOG_ROTATE_HOUR.
+ * @param  maxBytes     Continue in the next file of the period above this size (0 = no limit).
+ * @param  reserveBytes Space to reserve for each new file (0 = allocate on demand).
+ * @return none
+ */
+void log_set_rotation(uint8_t mode, uint32_t maxBytes, uint32_t reserveBytes)
+{
+    rotate_mode = mode;
+    rotate_bytes = maxBytes;
+    rotate_reserve = reserveBytes;
+}
+
+
+/**
+ * @brief  Select format of rotated files (file name extension).
+ * @param  format LOG_FORMAT_CSV, LOG_FORMAT_BIN or LOG_FORMAT_DELTA (needs LOG_DELTA_FORMAT).
+ * @return none
+ */
+void log_set_format(uint8_t format)
+{
+#ifndef LOG_DELTA_FORMAT
+    /* No encoder built in, the records are written plain */
+    if (format == LOG_FORMAT_DELTA)
+        format = LOG_FORMAT_BIN;
+#endif
+    file_format = format;
+}
+
+
+/**
+ * @brief  Make sure the file of the period given by the RTC time is open.
+ *         Closes the old file and opens (or creates) the new one when the
+ *         day or hour changed; call before log_write().
+ * @param  year  Year (0-99).
+ * @param  month Month (1-12).
+ * @param  date  Day of month (1-31).
+ * @param  hour  Hour (0-23).
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_rotate(uint8_t year, uint8_t month, uint8_t date, uint8_t hour)
+{
+    if (rotate_mode == LOG_ROTATE_NONE)
+        return 0;
+
+    if (rotate_mode == LOG_ROTATE_DAY)
+        hour = 0;
+
+    if (log_handle.open && period[0] == year && period[1] == month &&
+        period[2] == date && period[3] == hour)
+        return 0;
+
+    period[0] = year;
+    period[1] = month;
+    period[2] = date;
+    period[3] = hour;
+    sequence = 0;
+
+    if (log_open_period())
+        return 1;
+
+    /* A reset may have left the period's files already filled */
+    return log_check_size(0);
+}
+
+
+/**
+ * @brief  Set flush deadlines at runtime.
+ * @param  records Flush after this many records (0 = no record limit).
+ * @param  seconds Flush after this many seconds (0 = no time limit).
+ * @return none
+ */
+void log_set_flush_policy(uint16_t records, uint16_t seconds)
+{
+    flush_records = records;
+    flush_seconds = seconds;
+}
+
+
+/**
+ * @brief  Set the time of the next record passed to log_write(), used for
+ *         the time index (log_write_record() takes it from the record).
+ * @param  epoch Seconds since 2000-01-01 (epoch_seconds), 0 = unknown time.
+ * @return none
+ */
+void log_set_time(uint32_t epoch)
+{
+    record_time = epoch;
+}
+
+
+/**
+ * @brief  Append one record and flush if a deadline has expired.
+ * @param  data   Record bytes.
+ * @param  length Number of bytes.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_write(const uint8_t *data, uint16_t length)
+{
+    uint16_t t0 = TCNT1;
+    uint32_t r0 = blockReadCount;
+    uint32_t w0 = blockWriteCount;
+    uint32_t b0 = busyWaitCount;
+    uint8_t error;
+
+    if (log_check_size(length) || !log_handle.open)
+        return 1;
+
+    /* A flush log_service() has not finished yet: the directory entry goes
+       out before the tail sector is dirty again */
+    error = sync_due ? log_sync(0) : 0;
+
+    if (log_index_record())
+        error = 1;
+    record_time = 0;
+
+    if (appendData(&log_handle, data, length))
+        error = 1;
+    stats.records++;
+    pending_records++;
+    pending = 1;
+
+    if ((flush_records && pending_records >= flush_records) || log_time_expired())
+    {
+        if (log_start_sync())
+            error = 1;
+    }
+
+    log_account(t0, r0, w0, b0);
+    return error;
+}
+
+
+/**
+ * @brief  Seal (or delta-encode) and append one binary record, never across
+ *         a sector boundary. The rest of a sector that cannot hold the record
+ *         is filled with zeros.
+ * @param  rec Record; the crc8 field is computed here.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_write_record(struct log_record *rec)
+{
+    uint8_t pad[LOG_RECORD_SIZE] = {0};
+#ifdef LOG_DELTA_FORMAT
+    uint8_t encoded[LOG_DELTA_BUFFER_SIZE];
+#endif
+    const uint8_t *data;
+    uint8_t length;
+    uint16_t used;
+    uint16_t t0;
+
+    /* A delta record is never longer than a plain record */
+    if (log_check_size(LOG_RECORD_SIZE) || !log_handle.open)
+        return 1;
+
+    used = (uint16_t)(log_handle.fileSize % 512);
+
+    t0 = TCNT1;
+#ifdef LOG_DELTA_FORMAT
+    if (file_format == LOG_FORMAT_DELTA)
+    {
+        length = log_delta_encode(&delta, rec, used == 0, encoded);
+        data = encoded;
+    }
+    else
+#endif
+    {
+        log_record_seal(rec);
+        data = (const uint8_t *)rec;
+        length = LOG_RECORD_SIZE;
+    }
+    stats.encode_ticks += (uint16_t)(TCNT1 - t0);
+
+    if (used + length > 512)
+    {
+        if (appendData(&log_handle, pad, 512 - used))
+            return 1;
+
+#ifdef LOG_DELTA_FORMAT
+        /* Every sector of a delta stream starts with a keyframe */
+        if (file_format == LOG_FORMAT_DELTA)
+        {
+            t0 = TCNT1;
+            length = log_delta_encode(&delta, rec, 1, encoded);
+            stats.encode_ticks += (uint16_t)(TCNT1 - t0);
+        }
+#endif
+    }
+
+    record_time = (rec->flags & LOG_FLAG_RTC_ERROR) ? 0 : rec->epoch;
+    return log_write(data, length);
+}
+
+
+/**
+ * @brief  Flush pending records with accounting.
+ * @param  checkpoint 1 - complete flush with FSinfo (see log_sync), 0 - next
+ *                    step of a deadline flush (see log_start_sync).
+ * @return 0 on success, 1 on error.
+ */
+static uint8_t log_flush_pending(uint8_t checkpoint)
+{
+    uint16_t t0 = TCNT1;
+    uint32_t r0 = blockReadCount;
+    uint32_t w0 = blockWriteCount;
+    uint32_t b0 = busyWaitCount;
+    uint8_t error;
+
+    if (!log_handle.open)
+        return 1;
+    if (!pending)
+        return 0;
+
+    if (checkpoint || sync_due)
+        error = log_sync(checkpoint);
+    else
+        error = log_start_sync();
+
+    /* A checkpoint is complete only when the card has programmed it */
+    if (checkpoint && SD_waitReady())
+        error = 1;
+
+    log_account(t0, r0, w0, b0);
+    return error;
+}
+
+
+/**
+ * @brief  Flush pending data now (tail sector, directory entry, FSinfo checkpoint).
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_flush(void)
+{
+    return log_flush_pending(1);
+}
+
+
+/**
+ * @brief  Flush if the time deadline has expired, otherwise spend the idle
+ *         time building the free-run map (fatIdleScan); call from the main loop.
+ * @return 0 on success or nothing to do, 1 on error.
+ */
+uint8_t log_service(void)
+{
+    if (SD_poll())
+    {
+        stats.busy_defers++;
+        return 0;
+    }
+
+    if (sync_due || (pending && log_time_expired()))
+        return log_flush_pending(0);
+
+    if (log_handle.open)
+        fatIdleScan(LOG_IDLE_SCAN_SECTORS);
+
+    return 0;
+}
+
+
+/**
+ * @brief  Advance the logger time base by one second; call from a 1 s ISR.
+ * @return none
+ */
+void log_tick(void)
+{
+    if (pending)
+        pending_seconds++;
+}
+
+
+/**
+ * @brief  Count a sample deadline missed by the main loop; call from the
+ *         sample ISR when the previous sample has not been taken yet.
+ * @return none
+ */
+void log_sample_missed(void)
+{
+    stats.missed_samples++;
+}
+
+
+/**
+ * @brief  Flush and close the log file.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_close(void)
+{
+    uint8_t error;
+
+    if (!log_handle.open)
+        return 0;
+
+    /* closeAppendFile() performs the final sync and writes FSinfo */
+    if (pending)
+        stats.flushes++;
+    fsinfo_syncs = 0;
+    log_restart_deadline();
+
+    error = closeAppendFile(&log_handle);
+
+    if (index_handle.open)
+    {
+        if (log_index_flush())
+            error = 1;
+        if (closeAppendFile(&index_handle))
+            error = 1;
+    }
+
+    if (SD_waitReady())
+        error = 1;
+
+    return error;
+}
+
+
+/**
+ * @brief  Open a data file for reading positioned near a point in time.
+ *
+ * The entries of the index are ordered by time and offset, so the last one
+ * older than epoch is found by a binary search reading log2(entries)
+ * entries. Entries pointing past the end of the data (lost on power failure)
+ * count as not older. Every record from epoch on lies behind this entry;
+ * without a usable index the file is read from its start.
+ *
+ * @param  handle   Read handle to open.
+ * @param  fileName Data file name in 8.3 format, e.g. "26101600.CSV".
+ * @param  epoch    Time to look for (epoch_seconds).
+ * @return 0 on success, 1 on error (data file not found).
+ */
+uint8_t log_seek_time(struct readHandle_Structure *handle, const char *fileName, uint32_t epoch)
+{
+    struct readHandle_Structure index;
+    struct log_index_entry entry;
+    unsigned char name[13];
+    uint32_t low, high, mid, offset = 0;
+
+    strncpy((char *)name, fileName, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    if (openReadFile(handle, name))
+        return 1;
+
+    log_index_name(fileName, (char *)name);
+    if (openReadFile(&index, name))
+        return 0;
+
+    /* The index of a file of another format in the same period is no help */
+    if (!log_index_valid(&index, log_format_of(fileName)))
+    {
+        closeReadFile(&index);
+        return 0;
+    }
+
+    /* Entry 0 is the header */
+    low = 1;
+    high = index.fileSize / sizeof(entry);
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (seekFile(&index, mid * sizeof(entry)) ||
+            readFileData(&index, (unsigned char *)&entry, sizeof(entry)) != sizeof(entry))
+        {
+            offset = 0;
+            break;
+        }
+
+        if (entry.epoch < epoch && entry.offset <= handle->fileSize)
+        {
+            offset = entry.offset;
+            low = mid + 1;
+        }
+        else
+            high = mid;
+    }
+
+    closeReadFile(&index);
+    return seekFile(handle, offset);
+}
+
+
+/**
+ * @brief  Get pointer to the logger statistics.
+ * @return Pointer to statistics structure.
+ */
+const struct log_stats *log_get_stats(void)
+{
+    return &stats;
+}
+
+
+/**
+ * @brief  Send logger statistics to UART; the texts stay in flash.
+ * @return none
+ */
+void log_print_stats(void)
+{
+    static const char names[SD_LATENCY_TYPES][6] PROGMEM = {"cmd", "read", "write", "busy"};
+    char line[120];
+    uint16_t missed;
+    uint8_t i;
+
+    snprintf_P(line, sizeof(line), PSTR("LOG rec=%lu flush=%lu rot=%lu rd=%lu wr=%lu saved=%lu lat=%u max=%u\r\n"),
+               (unsigned long)stats.records, (unsigned long)stats.flushes,
+               (unsigned long)stats.rotations,
+               (unsigned long)stats.block_reads, (unsigned long)stats.block_writes,
+               (unsigned long)stats.writes_saved,
+               stats.last_latency, stats.max_latency);
+    uart_puts(line);
+
+    /* One Timer1 tick is 256 CPU cycles; split to delay the overflow */
+    if (stats.encode_ticks && stats.records)
+    {
+        snprintf_P(line, sizeof(line), PSTR("REC enc=%lu cyc/rec\r\n"),
+                   (unsigned long)(stats.encode_ticks * 16 / stats.records * 16));
+        uart_puts(line);
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        missed = stats.missed_samples;
+    }
+    snprintf_P(line, sizeof(line), PSTR("SD busy wait=%lu defer=%lu missed=%u\r\n"),
+               (unsigned long)stats.busy_waits, (unsigned long)stats.busy_defers, missed);
+    uart_puts(line);
+
+    /* Average and longest SD operation per type, in us */
+    uart_puts_P("SD us");
+    for (i = 0; i < SD_LATENCY_TYPES; i++)
+    {
+        const struct latency_Structure *lat = &sdLatency[i];
+
+        uart_putc(' ');
+        uart_puts_p(names[i]);
+        snprintf_P(line, sizeof(line), PSTR("=%lu/%lu"),
+                   lat->count ? (unsigned long)(lat->ticks / lat->count * 16) : 0UL,
+                   (unsigned long)lat->maxTicks * 16);
+        uart_puts(line);
+    }
+    uart_puts_P("\r\n");
+
+    snprintf_P(line, sizeof(line), PSTR("FAT cache hit=%lu miss=%lu wr=%lu meta hit=%lu miss=%lu\r\n"),
+               (unsigned long)fatCacheHits, (unsigned long)fatCacheMisses,
+               (unsigned long)fatCacheWrites, (unsigned long)metaCacheHits,
+               (unsigned long)metaCacheMisses);
+    uart_puts(line);
+}
@@ -0,0 +1,304 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+/**
+ * @file
+ * @brief Write-behind log writer on top of the FAT32 append handle.
+ *
+ * Records are appended to an open file through appendData(), which keeps the
+ * partly filled tail sector in RAM and writes a sector only once it is full.
+ * The directory entry is updated (syncFile) only when a flush deadline
+ * expires: after a number of records or after a number of seconds. The FSinfo
+ * sector (free cluster count) is written only every LOG_FSINFO_SYNCS flushes,
+ * on log_flush() and on log_close(); it is advisory, so a stale count after
+ * a power failure does not damage the file system.
+ * Records not yet flushed are lost on power failure, so the deadline is the
+ * upper bound of data that can be lost.
+ *
+ * Block writes do not wait for the card to program the block (SD_poll), so
+ * a full sector costs the main loop only the SPI transfer: while the card is
+ * busy, records are formatted and appended to the RAM tail sector, and
+ * log_service() leaves the card alone until it is ready. A deadline flush is
+ * done in two steps for the same reason, the tail sector first and the
+ * directory entry on a later log_service() pass. Only an access that needs
+ * the card waits for it, and log_flush()/log_close() return once everything
+ * is programmed.
+ *
+ * With a rotation policy (log_set_rotation) the file name is derived from the
+ * RTC time passed to log_rotate(): YYMMDD00.CSV per day or YYMMDDhh.CSV per
+ * hour. When a file reaches the size limit, writing continues in YYMMDDhh.C01,
+ * .C02, ... The old file is closed, which finalises its directory entry and
+ * FSinfo. In binary format (log_set_format) the names end in .BIN, .B01, ...
+ * and in delta-compressed format in .DLT, .D01, ...
+ *
+ * Every data file gets a sidecar time index with the same name and the
+ * extension .IDX (.I01, ... for continuation files). It holds one
+ * struct log_index_entry every LOG_INDEX_SECTORS sectors of data, i.e. the
+ * time and offset of the first record starting in that part of the file. The
+ * entries are collected in RAM and appended LOG_INDEX_BATCH at a time, on
+ * log_flush() and on log_close(), so the index costs a few block writes per
+ * batch. The CSV, BIN and DLT files of a period share the index name, so
+ * the first entry of an index is a header (epoch 0, offset
+ * LOG_INDEX_HEADER(format)) naming the format of the file it belongs to; an
+ * index of another format is neither appended to nor used. The index is only
+ * a hint: entries lost on power failure
+ * or pointing past the end of the data are skipped by the readers, which then
+ * scan the data from the last usable entry. log_seek_time() and
+ * tools/logquery.cpp binary-search it.
+ */
+
+
+#include <stdint.h>
+#include "epoch.h"
+#include "log_record.h"
+#include "log_delta.h"
+
+
+struct readHandle_Structure;    /* FAT32.h */
+
+
+/**
+ * @defgroup LogFlushPolicy Default flush deadlines
+ * @{
+ */
+#ifndef LOG_FLUSH_RECORDS
+#define LOG_FLUSH_RECORDS   12  /**< @brief Flush after this many records (0 = no record limit) */
+#endif
+
+#ifndef LOG_FLUSH_SECONDS
+#define LOG_FLUSH_SECONDS   60  /**< @brief Flush when the oldest unflushed record is this old (0 = no time limit) */
+#endif
+
+#ifndef LOG_FSINFO_SYNCS
+#define LOG_FSINFO_SYNCS    10  /**< @brief Write FSinfo back every this many deadline flushes */
+#endif
+
+#ifndef LOG_INDEX_SECTORS
+#define LOG_INDEX_SECTORS   4   /**< @brief Time index entry every this many data sectors (0 = no index) */
+#endif
+
+#ifndef LOG_INDEX_BATCH
+#define LOG_INDEX_BATCH     4   /**< @brief Index entries kept in RAM before they are appended (8 bytes each) */
+#endif
+
+#ifndef LOG_IDLE_SCAN_SECTORS
+#define LOG_IDLE_SCAN_SECTORS 1 /**< @brief FAT sectors scanned for the free-run map per idle log_service() call */
+#endif
+/** @} */
+
+
+/**
+ * @defgroup LogRotation Rotation modes (log_set_rotation)
+ * @{
+ */
+#define LOG_ROTATE_NONE     0   /**< @brief Keep the file opened by log_open() */
+#define LOG_ROTATE_DAY      1   /**< @brief New file every day, YYMMDD00.CSV */
+#define LOG_ROTATE_HOUR     2   /**< @brief New file every hour, YYMMDDhh.CSV */
+/** @} */
+
+
+/**
+ * @defgroup LogFormat File formats (log_set_format)
+ * @{
+ */
+#define LOG_FORMAT_CSV      0   /**< @brief Text lines written by log_write(), .CSV files */
+#define LOG_FORMAT_BIN      1   /**< @brief Records written by log_write_record(), .BIN files */
+#define LOG_FORMAT_DELTA    2   /**< @brief Records written by log_write_record(), delta-compressed, .DLT files */
+/** @} */
+
+/**
+ * @brief Use this macro to build the delta encoder of LOG_FORMAT_DELTA (21 bytes
+ *        of SRAM for its state). Without it log_set_format() takes
+ *        LOG_FORMAT_DELTA as LOG_FORMAT_BIN.
+ */
+//#define LOG_DELTA_FORMAT
+
+
+/**
+ * @brief Statistics of the log writer.
+ *
+ * Latencies are measured in Timer1 ticks; with the 1 s overflow setting
+ * (prescaler 256 at 16 MHz) one tick is 16 us.
+ */
+struct log_stats {
+    uint32_t records;       /**< @brief Records accepted by log_write() */
+    uint32_t flushes;       /**< @brief Directory entry updates (syncFile calls) */
+    uint32_t rotations;     /**< @brief Files opened by log_rotate() and the size limit */
+    uint32_t block_reads;   /**< @brief SD block reads spent by the logger */
+    uint32_t block_writes;  /**< @brief SD block writes spent by the logger */
+    uint32_t writes_saved;  /**< @brief Block writes saved against a data + directory write per record */
+    uint32_t index_entries; /**< @brief Time index entries appended to the sidecar files */
+    uint32_t encode_ticks;  /**< @brief Timer1 ticks spent sealing/encoding records in log_write_record() */
+    uint32_t busy_waits;    /**< @brief Logger calls that had to wait for the card to program a block */
+    uint32_t busy_defers;   /**< @brief log_service() passes skipped because the card was still programming */
+    uint16_t missed_samples; /**< @brief Sample deadlines missed by the main loop (log_sample_missed) */
+    uint16_t last_latency;  /**< @brief Duration of the last log_write()/log_flush() in Timer1 ticks */
+    uint16_t max_latency;   /**< @brief Longest log_write()/log_flush() in Timer1 ticks */
+};
+
+
+/** @brief Offset of the index header entry: "IDX" and the LOG_FORMAT_... of the data file. */
+#define LOG_INDEX_HEADER(format)    (0x58444900UL | (format))
+
+
+/**
+ * @brief Entry of the sidecar time index, little-endian on the card.
+ */
+struct log_index_entry {
+    uint32_t epoch;         /**< @brief Time of the record (epoch_seconds) */
+    uint32_t offset;        /**< @brief Byte offset of the record in the data file */
+};
+
+
+/**
+ * @brief  Open (or create) the log file and reset the flush deadlines.
+ *
+ * A new file is created with reserveBytes of contiguous clusters reserved up
+ * front, so full sectors are streamed across cluster boundaries without FAT
+ * updates. Unused reserved clusters are released by log_close().
+ *
+ * @param  fileName     File name in 8.3 format, e.g. "data1.csv" (index "data1.IDX").
+ * @param  reserveBytes Space to reserve for a new file (0 = allocate on demand).
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_open(const char *fileName, uint32_t reserveBytes);
+
+
+/**
+ * @brief  Set rotation policy used by log_rotate() and log_write().
+ * @param  mode         LOG_ROTATE_NONE, LOG_ROTATE_DAY or LOG_ROTATE_HOUR.
+ * @param  maxBytes     Continue in the next file of the period above this size (0 = no limit).
+ * @param  reserveBytes Space to reserve for each new file (0 = allocate on demand).
+ * @return none
+ */
+void log_set_rotation(uint8_t mode, uint32_t maxBytes, uint32_t reserveBytes);
+
+
+/**
+ * @brief  Select format of rotated files (file name extension).
+ * @param  format LOG_FORMAT_CSV, LOG_FORMAT_BIN or LOG_FORMAT_DELTA (needs LOG_DELTA_FORMAT).
+ * @return none
+ */
+void log_set_format(uint8_t format);
+
+
+/**
+ * @brief  Make sure the file of the period given by the RTC time is open.
+ *         Closes the old file and opens (or creates) the new one when the
+ *         day or hour changed; call before log_write().
+ * @param  year  Year (0-99).
+ * @param  month Month (1-12).
+ * @param  date  Day of month (1-31).
+ * @param  hour  Hour (0-23).
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_rotate(uint8_t year, uint8_t month, uint8_t date, uint8_t hour);
+
+
+/**
+ * @brief  Set flush deadlines at runtime.
+ * @param  records Flush after this many records (0 = no record limit).
+ * @param  seconds Flush after this many seconds (0 = no time limit).
+ * @return none
+ */
+void log_set_flush_policy(uint16_t records, uint16_t seconds);
+
+
+/**
+ * @brief  Set the time of the next record passed to log_write(), used for
+ *         the time index (log_write_record() takes it from the record).
+ * @param  epoch Seconds since 2000-01-01 (epoch_seconds), 0 = unknown time.
+ * @return none
+ */
+void log_set_time(uint32_t epoch);
+
+
+/**
+ * @brief  Append one record and flush if a deadline has expired.
+ *         Continues in the next file of the period if the size limit would be exceeded.
+ * @param  data   Record bytes.
+ * @param  length Number of bytes.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_write(const uint8_t *data, uint16_t length);
+
+
+/**
+ * @brief  Seal (or delta-encode) and append one binary record, never across
+ *         a sector boundary. The rest of a sector that cannot hold the record
+ *         is filled with zeros.
+ * @param  rec Record; the crc8 field is computed here.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_write_record(struct log_record *rec);
+
+
+/**
+ * @brief  Flush pending data now (tail sector, directory entry, FSinfo checkpoint).
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_flush(void);
+
+
+/**
+ * @brief  Flush if the time deadline has expired, otherwise spend the idle
+ *         time building the free-run map (fatIdleScan); call from the main loop.
+ *         Does nothing while the card is still programming a block.
+ * @return 0 on success or nothing to do, 1 on error.
+ */
+uint8_t log_service(void);
+
+
+/**
+ * @brief  Advance the logger time base by one second; call from a 1 s ISR.
+ * @return none
+ */
+void log_tick(void);
+
+
+/**
+ * @brief  Count a sample deadline missed by the main loop; call from the
+ *         sample ISR when the previous sample has not been taken yet.
+ * @return none
+ */
+void log_sample_missed(void);
+
+
+/**
+ * @brief  Flush and close the log file.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t log_close(void);
+
+
+/**
+ * @brief  Open a data file for reading positioned near a point in time.
+ *
+ * Binary-searches the sidecar index for the last entry older than epoch and
+ * seeks there, so every record from epoch on lies after the read position
+ * (the records in front of it still have to be skipped by the caller).
+ * Without a usable index the file is read from its start.
+ *
+ * @param  handle   Read handle to open.
+ * @param  fileName Data file name in 8.3 format, e.g. "26101600.CSV".
+ * @param  epoch    Time to look for (epoch_seconds).
+ * @return 0 on success, 1 on error (data file not found).
+ */
+uint8_t log_seek_time(struct readHandle_Structure *handle, const char *fileName, uint32_t epoch);
+
+
+/**
+ * @brief  Get pointer to the logger statistics.
+ * @return Pointer to statistics structure.
+ */
+const struct log_stats *log_get_stats(void);
+
+
+/**
+ * @brief  Send logger statistics to UART.
+ * @return none
+ */
+void log_print_stats(void);
+
+
+#endif /* LOGGER_H */
@@ -0,0 +1,370 @@
+/*
+ * Raw-sector ring buffer log.
+ *
+ * Writes whole records into the blocks of a contiguous file created through
+ * the FAT32 library once; the head is recovered at open by a binary search
+ * over the block sequence numbers (see ringlog.h for the block layout).
+ */
+
+
+// -- Includes ---------------------------------------------
+#include <string.h>
+#include <util/crc16.h>
+#include "FAT32.h"
+#include "sd_routines.h"
+#include "ringlog.h"
+
+
+// -- Local variables --------------------------------------
+/** @brief Ring log statistics, also holds head, sequence and size of the ring. */
+static struct ringlog_stats stats;
+
+/** @brief First sector of the ring. */
+static uint32_t ring_first = 0;
+
+/** @brief Payload bytes used in the block being filled (kept in buffer). */
+static uint16_t ring_used = 0;
+
+/** @brief CRC-16 of the payload of the block being filled. */
+static uint16_t ring_crc = 0xffff;
+
+/** @brief Records appended since the block was last written. */
+static uint8_t ring_pending = 0;
+
+/** @brief 1 - ring is open. */
+static uint8_t ring_is_open = 0;
+
+/** @brief 1 - buffer holds the block being filled (claimed from the FAT32 library). */
+static uint8_t ring_has_buffer = 0;
+
+
+// -- Local functions --------------------------------------
+/**
+ * @brief  Continue CRC-16/CCITT over bytes of the SD buffer.
+ * @param  crc    CRC so far.
+ * @param  offset First byte in buffer.
+ * @param  length Number of bytes.
+ * @return Updated CRC.
+ */
+static uint16_t ringlog_crc(uint16_t crc, uint16_t offset, uint16_t length)
+{
+    while (length--)
+        crc = _crc_ccitt_update(crc, buffer[offset++]);
+
+    return crc;
+}
+
+
+/**
+ * @brief  Read a block into buffer and check its header and CRC.
+ * @param  index    Block index inside the ring.
+ * @param  sequence Receives the sequence number of a valid block.
+ * @param  length   Receives the payload length of a valid block.
+ * @return 1 if the block is valid, 0 otherwise.
+ */
+static uint8_t ringlog_read(uint32_t index, uint32_t *sequence, uint16_t *length)
+{
+    uint16_t crc;
+
+    if (SD_readSingleBlock(ring_first + index))
+        return 0;
+
+    if ((buffer[0] | (buffer[1] << 8)) != RINGLOG_MAGIC)
+        return 0;
+
+    *length = buffer[6] | (buffer[7] << 8);
+    if (*length > RINGLOG_PAYLOAD_SIZE)
+        return 0;
+
+    crc = ringlog_crc(0xffff, RINGLOG_HEADER_SIZE, *length);
+    crc = ringlog_crc(crc, 0, 8);
+    if (crc != (buffer[8] | (buffer[9] << 8)))
+        return 0;
+
+    *sequence = (uint32_t)buffer[2] | ((uint32_t)buffer[3] << 8) |
+                ((uint32_t)buffer[4] << 16) | ((uint32_t)buffer[5] << 24);
+    return 1;
+}
+
+
+/**
+ * @brief  Start an empty block in buffer.
+ * @return none
+ */
+static void ringlog_start_block(void)
+{
+    memset((void *)buffer, 0, sizeof(buffer));
+    ring_used = 0;
+    ring_crc = 0xffff;
+    ring_pending = 0;
+}
+
+
+/**
+ * @brief  Complete the header and write the block being filled.
+ * @param  full 1 - block is complete, stream it; 0 - write it as a single block.
+ * @return 0 on success, 1 on SD error.
+ */
+static uint8_t ringlog_write_block(uint8_t full)
+{
+    uint32_t sector = ring_first + stats.head;
+    uint16_t crc;
+
+    buffer[0] = (uint8_t)RINGLOG_MAGIC;
+    buffer[1] = (uint8_t)(RINGLOG_MAGIC >> 8);
+    buffer[2] = (uint8_t)stats.sequence;
+    buffer[3] = (uint8_t)(stats.sequence >> 8);
+    buffer[4] = (uint8_t)(stats.sequence >> 16);
+    buffer[5] = (uint8_t)(stats.sequence >> 24);
+    buffer[6] = (uint8_t)ring_used;
+    buffer[7] = (uint8_t)(ring_used >> 8);
+
+    crc = ringlog_crc(ring_crc, 0, 8);
+    buffer[8] = (uint8_t)crc;
+    buffer[9] = (uint8_t)(crc >> 8);
+
+    stats.block_writes++;
+    ring_pending = 0;
+
+    /* Consecutive full blocks go out in one multiple block write */
+    if (full)
+        return SD_writeStreamBlock(sector);
+
+    return SD_writeSingleBlock(sector);
+}
+
+
+/**
+ * @brief  Write the full block and move the head to the next one.
+ * @return 0 on success, 1 on SD error.
+ */
+static uint8_t ringlog_next_block(void)
+{
+    uint8_t error = ringlog_write_block(1);
+
+    if (++stats.head >= stats.blocks)
+    {
+        stats.head = 0;
+        stats.wraps++;
+    }
+    stats.sequence++;
+    ringlog_start_block();
+
+    return error;
+}
+
+
+/**
+ * @brief  Give buffer back to the FAT32 library (claimDataBuffer callback).
+ *
+ * Records not yet on the card are written with the partly filled block, so
+ * ringlog_own() can read the block back.
+ *
+ * @return 0 on success, 1 on SD error.
+ */
+static unsigned char ringlog_release(void)
+{
+    uint8_t error = 0;
+
+    if (ring_has_buffer && ring_pending)
+        error = ringlog_write_block(0);
+    ring_has_buffer = 0;
+
+    return error;
+}
+
+
+/**
+ * @brief  Claim buffer before filling it, read the head block back if the
+ *         FAT32 library used buffer since the last record.
+ * @return 0 on success, 1 on error.
+ */
+static uint8_t ringlog_own(void)
+{
+    uint32_t seq;
+    uint16_t length;
+
+    if (ring_has_buffer)
+        return 0;
+
+    if (claimDataBuffer(ringlog_release))
+        return 1;
+
+    if (ring_used == 0)
+        ringlog_start_block();
+    else if (!ringlog_read(stats.head, &seq, &length) || seq != stats.sequence || length != ring_used)
+        return 1;
+    else
+        memset((void *)&buffer[RINGLOG_HEADER_SIZE + length], 0, RINGLOG_PAYLOAD_SIZE - length);
+
+    ring_has_buffer = 1;
+    return 0;
+}
+
+
+// -- Functions --------------------------------------------
+/**
+ * @brief  Open (or create) the ring file and find the head.
+ *
+ * Block sequence n lives at index (n - 1) % blocks, so the blocks before the
+ * head hold the sequence of block 0 plus their index and the blocks behind
+ * it are older or not written yet. The last block with this property is
+ * found in log2(blocks) reads and is filled further.
+ *
+ * @param  fileName File name in 8.3 format, e.g. "ring.dat".
+ * @param  sectors  Size of a new ring in sectors (rounded up to whole clusters).
+ * @return 0 on success, 1 on error (no contiguous space, fragmented file or SD error).
+ */
+uint8_t ringlog_open(const char *fileName, uint32_t sectors)
+{
+    unsigned char name[13];
+    unsigned long first, count;
+    uint32_t low, high, mid, first_seq, seq;
+    uint16_t length;
+
+    ringlog_close();
+    memset(&stats, 0, sizeof(stats));
+
+    strncpy((char *)name, fileName, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+
+    if (openContiguousFile(name, (sectors + sectorPerCluster - 1) / sectorPerCluster, &first, &count))
+        return 1;
+
+    /* The ring fills buffer itself, the FAT32 library forgets what it held */
+    if (claimDataBuffer(ringlog_release))
+        return 1;
+    ring_has_buffer = 1;
+
+    ring_first = first;
+    stats.blocks = count;
+
+    if (!ringlog_read(0, &first_seq, &length))
+    {
+        /* Empty ring, or block 0 was torn while the ring wrapped */
+        stats.head = 0;
+        stats.sequence = 1;
+        if (ringlog_read(count - 1, &seq, &length))
+            stats.sequence = seq + 1;
+        ringlog_start_block();
+        ring_is_open = 1;
+        return 0;
+    }
+
+    low = 0;
+    high = count - 1;
+    while (low < high)
+    {
+        mid = low + (high - low + 1) / 2;
+        if (ringlog_read(mid, &seq, &length) && seq == first_seq + mid)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+
+    /* Continue filling the last block written */
+    ringlog_read(low, &seq, &length);
+    stats.head = low;
+    stats.sequence = seq;
+    ring_used = length;
+    ring_crc = ringlog_crc(0xffff, RINGLOG_HEADER_SIZE, length);
+    ring_pending = 0;
+    memset((void *)&buffer[RINGLOG_HEADER_SIZE + length], 0, RINGLOG_PAYLOAD_SIZE - length);
+
+    ring_is_open = 1;
+    return 0;
+}
+
+
+/**
+ * @brief  Append one record; a record never crosses a block boundary.
+ * @param  data   Record bytes.
+ * @param  length Number of bytes (1 to RINGLOG_PAYLOAD_SIZE).
+ * @return 0 on success, 1 on error.
+ */
+uint8_t ringlog_write(const uint8_t *data, uint16_t length)
+{
+    uint8_t error = 0;
+    uint16_t offset;
+
+    if (!ring_is_open || length == 0 || length > RINGLOG_PAYLOAD_SIZE)
+        return 1;
+
+    if (ringlog_own())
+        return 1;
+
+    if (ring_used + length > RINGLOG_PAYLOAD_SIZE)
+        error = ringlog_next_block();
+
+    offset = RINGLOG_HEADER_SIZE + ring_used;
+    memcpy((void *)&buffer[offset], data, length);
+    ring_crc = ringlog_crc(ring_crc, offset, length);
+    ring_used += length;
+    stats.records++;
+    ring_pending++;
+
+    if (ring_used == RINGLOG_PAYLOAD_SIZE)
+    {
+        if (ringlog_next_block())
+            error = 1;
+    }
+    else if (RINGLOG_FLUSH_RECORDS && ring_pending >= RINGLOG_FLUSH_RECORDS)
+    {
+        if (ringlog_write_block(0))
+            error = 1;
+    }
+
+    return error;
+}
+
+
+/**
+ * @brief  Write the partly filled block and end the multiple block write.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t ringlog_flush(void)
+{
+    uint8_t error;
+
+    if (!ring_is_open)
+        return 1;
+
+    if (ring_pending)
+        error = ringlog_write_block(0);
+    else
+        error = SD_stopStream();
+
+    /* Block writes do not wait for the card to program the block */
+    if (SD_waitReady())
+        error = 1;
+
+    return error;
+}
+
+
+/**
+ * @brief  Flush and close the ring.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t ringlog_close(void)
+{
+    uint8_t error;
+
+    if (!ring_is_open)
+        return 0;
+
+    error = ringlog_flush();
+    ring_is_open = 0;
+
+    return error;
+}
+
+
+/**
+ * @brief  Get pointer to the ring log statistics.
+ * @return Pointer to statistics structure.
+ */
+const struct ringlog_stats *ringlog_get_stats(void)
+{
+    return &stats;
+}
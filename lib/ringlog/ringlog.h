@@ -0,0 +1,106 @@
+#ifndef RINGLOG_H
+#define RINGLOG_H
+
+/**
+ * @file
+ * @brief Raw-sector ring buffer log without FAT bookkeeping.
+ *
+ * The ring is a contiguous file (e.g. RING.DAT) created once with
+ * openContiguousFile(); afterwards records are written straight to its
+ * sectors, full blocks through the multiple block write stream
+ * (SD_writeStreamBlock) and partly filled blocks through SD_writeSingleBlock.
+ * The FAT, the directory entry and FSinfo are never touched on the hot path.
+ *
+ * Every 512-byte block starts with a header; the rest holds whole records:
+ *
+ * | offset | size | field    | meaning                                      |
+ * |--------|------|----------|----------------------------------------------|
+ * | 0      | 2    | magic    | RINGLOG_MAGIC                                |
+ * | 2      | 4    | sequence | block number since the ring was created (1-) |
+ * | 6      | 2    | length   | payload bytes used                           |
+ * | 8      | 2    | crc      | CRC-16 of the payload, then bytes 0-7        |
+ *
+ * Block sequence n is stored at index (n - 1) % blocks, so the ring wraps by
+ * overwriting the oldest block. openContiguousFile() zeroes a new ring file,
+ * so a valid header is always one written to this ring. At open the head is found by binary search:
+ * the blocks before the head carry the sequence of block 0 plus their index.
+ *
+ * The block being filled is kept in the shared SD buffer. FAT32 functions
+ * may still be called while the ring is open: before the library reuses
+ * buffer it has the ring write the block (claimDataBuffer), and the next
+ * ringlog_write() reads it back.
+ * tools/ringdump.cpp extracts the records from a card image or RING.DAT.
+ */
+
+
+#include <stdint.h>
+
+
+/**
+ * @defgroup RingLogLayout Block layout
+ * @{
+ */
+#define RINGLOG_MAGIC           0x4752  /**< @brief "RG" in little-endian */
+#define RINGLOG_HEADER_SIZE     10      /**< @brief Bytes of the block header */
+#define RINGLOG_PAYLOAD_SIZE    (512 - RINGLOG_HEADER_SIZE) /**< @brief Longest record */
+/** @} */
+
+
+#ifndef RINGLOG_FLUSH_RECORDS
+#define RINGLOG_FLUSH_RECORDS   12  /**< @brief Write a partly filled block after this many records (0 = only full blocks) */
+#endif
+
+
+/**
+ * @brief Statistics of the ring log.
+ */
+struct ringlog_stats {
+    uint32_t blocks;        /**< @brief Size of the ring in blocks */
+    uint32_t head;          /**< @brief Index of the block being filled */
+    uint32_t sequence;      /**< @brief Sequence number of the block being filled */
+    uint32_t records;       /**< @brief Records accepted by ringlog_write() */
+    uint32_t block_writes;  /**< @brief Blocks written (full and partial) */
+    uint32_t wraps;         /**< @brief Times the head returned to block 0 */
+};
+
+
+/**
+ * @brief  Open (or create) the ring file and find the head.
+ * @param  fileName File name in 8.3 format, e.g. "ring.dat".
+ * @param  sectors  Size of a new ring in sectors (rounded up to whole clusters).
+ * @return 0 on success, 1 on error (no contiguous space, fragmented file or SD error).
+ */
+uint8_t ringlog_open(const char *fileName, uint32_t sectors);
+
+
+/**
+ * @brief  Append one record; a record never crosses a block boundary.
+ * @param  data   Record bytes.
+ * @param  length Number of bytes (1 to RINGLOG_PAYLOAD_SIZE).
+ * @return 0 on success, 1 on error.
+ */
+uint8_t ringlog_write(const uint8_t *data, uint16_t length);
+
+
+/**
+ * @brief  Write the partly filled block and end the multiple block write.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t ringlog_flush(void);
+
+
+/**
+ * @brief  Flush and close the ring.
+ * @return 0 on success, 1 on error.
+ */
+uint8_t ringlog_close(void);
+
+
+/**
+ * @brief  Get pointer to the ring log statistics.
+ * @return Pointer to statistics structure.
+ */
+const struct ringlog_stats *ringlog_get_stats(void);
+
+
+#endif /* RINGLOG_H */
@@ -1,5 +1,8 @@
 #include "rtc.h"
+#include "epoch.h"
 #include <twi.h>
+#include <util/atomic.h>
+#include <avr/pgmspace.h>
 
 // this library was created with help from GithubCopilot suggestions
 
@@ -17,6 +20,19 @@
 // #define RTC_CONTROL 0x07
 
 
+/** @brief Time of the last successful rtc_read_timestamp(), for getDateTime_FAT(). */
+static struct rtc_timestamp rtc_snapshot;
+static uint8_t rtc_snapshot_valid;
+
+/** @brief Software calendar, advanced by rtc_clock_tick(). */
+static volatile struct rtc_timestamp rtc_clock;
+static volatile uint32_t rtc_clock_us;  // part of the current second elapsed
+static volatile uint8_t rtc_clock_valid;
+
+/** @brief Days of each month in a non-leap year (flash). */
+static const uint8_t days_in_month[12] PROGMEM = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+
 // -- Functions --------------------------------------------
 
 /**
@@ -104,18 +120,18 @@ uint8_t rtc_set_time(uint8_t hours, uint8_t minutes, uint8_t seconds)
  * @param  hours   Output for hours.
  * @param  minutes Output for minutes.
  * @param  seconds Output for seconds.
- * @return 0 on success.
+ * @return 0 on success, TWI_ERR_* on error.
  */
 uint8_t rtc_get_time(uint8_t *hours, uint8_t *minutes, uint8_t *seconds)
 {
-    uint8_t sec_bcd = rtc_read_reg(RTC_SEC);
-    uint8_t min_bcd = rtc_read_reg(RTC_MIN);
-    uint8_t hour_bcd = rtc_read_reg(RTC_HOUR);
+    struct rtc_timestamp ts;
+    uint8_t error = rtc_read_timestamp(&ts);
+    if(error) return error;
 
 
-    *seconds = bcd_to_decimal(sec_bcd);
-    *minutes = bcd_to_decimal(min_bcd);
-    *hours = bcd_to_decimal(hour_bcd);
+    *seconds = ts.second;
+    *minutes = ts.minute;
+    *hours = ts.hour;
 
 
     return 0;
@@ -127,18 +143,18 @@ uint8_t rtc_get_time(uint8_t *hours, uint8_t *minutes, uint8_t *seconds)
  * @param  date  Output for day of month (1-31).
  * @param  month Output for month (1-12).
  * @param  year  Output for year (0-99).
- * @return 0 on success.
+ * @return 0 on success, TWI_ERR_* on error.
  */
 uint8_t rtc_get_date(uint8_t *date, uint8_t *month, uint8_t *year)
 {
-    uint8_t date_bcd = rtc_read_reg(RTC_DATE);
-    uint8_t month_bcd = rtc_read_reg(RTC_MONTH);
-    uint8_t year_bcd = rtc_read_reg(RTC_YEAR);
+    struct rtc_timestamp ts;
+    uint8_t error = rtc_read_timestamp(&ts);
+    if(error) return error;
 
 
-    *date = bcd_to_decimal(date_bcd);
-    *month = bcd_to_decimal(month_bcd);
-    *year = bcd_to_decimal(year_bcd);
+    *date = ts.date;
+    *month = ts.month;
+    *year = ts.year;
 
 
     return 0;
@@ -178,56 +194,216 @@ uint8_t rtc_set_date(uint8_t day, uint8_t date, uint8_t month, uint8_t year)
 
 /**
  * @brief  Read all RTC time/date registers (7 bytes) at once.
- * @return 0 on success.
+ * @return 0 on success, TWI_ERR_* on error.
  */
 uint8_t RTC_read(void)
 {
-    twi_readfrom_mem_into(RTC_ADDRESS, RTC_SEC, &rtc_register[0], 7);
+    return twi_readfrom_mem_into(RTC_ADDRESS, RTC_SEC, &rtc_register[0], 7);
+}
+
+
+/**
+ * @brief  Read and decode the time/date registers in one burst.
+ * @param  ts Output for the time.
+ * @return 0 on success, TWI_ERR_* on error.
+ */
+uint8_t rtc_read_timestamp(struct rtc_timestamp *ts)
+{
+    uint8_t error = RTC_read();
+    if(error)
+    {
+        rtc_snapshot_valid = 0;
+        return error;
+    }
+
+
+    // mask the CH, 12/24 and century bits
+    ts->second = bcd_to_decimal(SECONDS & 0x7f);
+    ts->minute = bcd_to_decimal(MINUTES & 0x7f);
+    ts->hour = bcd_to_decimal(HOURS & 0x3f);
+    ts->day = bcd_to_decimal(DAY & 0x07);
+    ts->date = bcd_to_decimal(DATE & 0x3f);
+    ts->month = bcd_to_decimal(MONTH & 0x1f);
+    ts->year = bcd_to_decimal(YEAR);
+    ts->epoch = epoch_seconds(ts->year, ts->month, ts->date, ts->hour, ts->minute, ts->second);
+
+
+    rtc_snapshot = *ts;
+    rtc_snapshot_valid = 1;
     return 0;
 }
 
 
 /**
- * @brief  Get current date/time and convert to FAT32 format.
+ * @brief  Convert the time of the current sample to FAT32 format.
  * @return 0 on success, 1 on error.
  */
 unsigned char getDateTime_FAT(void)
 {
-    uint8_t date, month, year;
-    uint8_t hours, minutes, seconds;
-    uint8_t error;
+    struct rtc_timestamp ts;
 
 
-    error = rtc_get_date(&date, &month, &year);
-    if(error) return 1;
-    
-    error = rtc_get_time(&hours, &minutes, &seconds);
-    if(error) return 1;
+    // time of the current sample, one burst read if there is none yet
+    if(rtc_snapshot_valid)
+        ts = rtc_snapshot;
+    else if(rtc_read_timestamp(&ts))
+        return 1;
 
 
     // Calculate year for FAT (years since 1980)
-    unsigned int yr = year + 2000 - 1980;
+    unsigned int yr = ts.year + 2000 - 1980;
     dateFAT = yr;
 
 
     // Add month
-    dateFAT = (dateFAT << 4) | month;
+    dateFAT = (dateFAT << 4) | ts.month;
 
 
     // Add date
-    dateFAT = (dateFAT << 5) | date;
+    dateFAT = (dateFAT << 5) | ts.date;
 
 
     // Add hours
-    timeFAT = hours;
+    timeFAT = ts.hour;
 
 
     // Add minutes
-    timeFAT = (timeFAT << 6) | minutes;
+    timeFAT = (timeFAT << 6) | ts.minute;
 
 
     // Add seconds (FAT32 uses 2-second resolution)
-    timeFAT = (timeFAT << 5) | (seconds / 2);
+    timeFAT = (timeFAT << 5) | (ts.second / 2);
+
+
+    return 0;
+}
+
+
+/**
+ * @brief  Seed the software calendar.
+ * @param  ts Time to start from.
+ * @return none
+ */
+void rtc_clock_set(const struct rtc_timestamp *ts)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        rtc_clock = *ts;
+        rtc_clock_us = 0;
+        rtc_clock_valid = 1;
+    }
+}
+
+
+/**
+ * @brief  Add one second to the software calendar (interrupt context).
+ * @return none
+ */
+static void rtc_clock_second(void)
+{
+    uint8_t days;
+
+
+    rtc_clock.epoch++;
+    if(++rtc_clock.second < 60) return;
+    rtc_clock.second = 0;
+    if(++rtc_clock.minute < 60) return;
+    rtc_clock.minute = 0;
+    if(++rtc_clock.hour < 24) return;
+    rtc_clock.hour = 0;
+
+
+    if(++rtc_clock.day > 7) rtc_clock.day = 1;
+    // every year divisible by 4 is a leap year from 2000 to 2099
+    days = (rtc_clock.month >= 1 && rtc_clock.month <= 12) ? pgm_read_byte(&days_in_month[rtc_clock.month - 1]) : 31;
+    if(rtc_clock.month == 2 && (rtc_clock.year % 4) == 0) days++;
+    if(++rtc_clock.date <= days) return;
+    rtc_clock.date = 1;
+    if(++rtc_clock.month <= 12) return;
+    rtc_clock.month = 1;
+    rtc_clock.year = (rtc_clock.year + 1) % 100;
+}
+
+
+/**
+ * @brief  Advance the software calendar.
+ * @param  us Time since the previous tick in microseconds.
+ * @return none
+ */
+void rtc_clock_tick(uint32_t us)
+{
+    if(!rtc_clock_valid) return;
+
+
+    rtc_clock_us += us;
+    while(rtc_clock_us >= 1000000UL)
+    {
+        rtc_clock_us -= 1000000UL;
+        rtc_clock_second();
+    }
+}
+
+
+/**
+ * @brief  Read the software calendar and keep it as the FAT snapshot.
+ * @param  ts Output for the time.
+ * @return 0 on success, 1 if not seeded.
+ */
+uint8_t rtc_clock_now(struct rtc_timestamp *ts)
+{
+    uint8_t valid;
+
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *ts = rtc_clock;
+        valid = rtc_clock_valid;
+    }
+    if(!valid) return 1;
+
+
+    rtc_snapshot = *ts;
+    rtc_snapshot_valid = 1;
+    return 0;
+}
+
+
+/**
+ * @brief  Set the software calendar to the RTC time.
+ * @param  drift Output for RTC minus calendar in seconds, may be NULL.
+ * @return 0 on success, TWI_ERR_* on error.
+ */
+uint8_t rtc_clock_sync(int32_t *drift)
+{
+    struct rtc_timestamp ts;
+    uint32_t before;
+    uint8_t error, tries, synced = 0;
+
+
+    // a tick during the read leaves it unclear which second the RTC
+    // showed, read again (the next tick is a second away)
+    for(tries = 0; tries < 2 && !synced; tries++)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            before = rtc_clock.epoch;
+        }
+        error = rtc_read_timestamp(&ts);
+        if(error) return error;
+
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if(rtc_clock.epoch == before || tries == 1)
+            {
+                if(drift) *drift = rtc_clock_valid ? (int32_t)(ts.epoch - rtc_clock.epoch) : 0;
+                rtc_clock = ts;
+                rtc_clock_us = 0;
+                rtc_clock_valid = 1;
+                synced = 1;
+            }
+        }
+    }
 
 
     return 0;
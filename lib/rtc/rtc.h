@@ -44,6 +44,19 @@
 /** @brief Buffer for reading all RTC registers. */
 unsigned char rtc_register[7];
 
+/** @brief Decoded RTC time and date, read in one burst by rtc_read_timestamp(). */
+struct rtc_timestamp
+{
+    uint8_t second;  /**< @brief Seconds (0-59) */
+    uint8_t minute;  /**< @brief Minutes (0-59) */
+    uint8_t hour;    /**< @brief Hours (0-23) */
+    uint8_t day;     /**< @brief Day of week (1-7, Sunday=1) */
+    uint8_t date;    /**< @brief Day of month (1-31) */
+    uint8_t month;   /**< @brief Month (1-12) */
+    uint8_t year;    /**< @brief Year (0-99, 2000-2099) */
+    uint32_t epoch;  /**< @brief Seconds since 2000-01-01 (epoch_seconds) */
+};
+
 /** @brief Global variables to store time in FAT32 format. */
 unsigned int dateFAT, timeFAT;
 
@@ -72,6 +85,59 @@ uint8_t rtc_read_reg(uint8_t reg_addr);
 uint8_t rtc_write_reg(uint8_t reg_addr, uint8_t data);
 
 
+/**
+ * @brief  Read all time/date registers in one I2C transaction and decode
+ *         them. The result is also kept as the snapshot used by
+ *         getDateTime_FAT(), so the file timestamps of one sample match
+ *         its record.
+ * @param  ts Pointer to store the time.
+ * @return 0 on success, TWI_ERR_* if the RTC did not answer.
+ */
+uint8_t rtc_read_timestamp(struct rtc_timestamp *ts);
+
+
+/**
+ * @brief  Seed the software calendar, e.g. from rtc_read_timestamp() or
+ *         from the compile time. The calendar then runs from
+ *         rtc_clock_tick() without any bus traffic.
+ * @param  ts Time to start from.
+ */
+void rtc_clock_set(const struct rtc_timestamp *ts);
+
+
+/**
+ * @brief  Advance the software calendar; called from the 1 s interrupts.
+ * @param  us Time since the previous tick in microseconds (1000000 for
+ *            the DS3231 square wave, the overflow period for Timer1).
+ */
+void rtc_clock_tick(uint32_t us);
+
+
+/**
+ * @brief  Read the software calendar. The result is also kept as the
+ *         snapshot used by getDateTime_FAT().
+ * @param  ts Pointer to store the time.
+ * @return 0 on success, 1 if the calendar was never seeded.
+ */
+uint8_t rtc_clock_now(struct rtc_timestamp *ts);
+
+
+/**
+ * @brief  Set the software calendar to the RTC time (one burst read).
+ * @param  drift Pointer to store RTC minus calendar in seconds, may be NULL.
+ * @return 0 on success, TWI_ERR_* if the RTC did not answer (the calendar
+ *         keeps running).
+ */
+uint8_t rtc_clock_sync(int32_t *drift);
+
+
+/**
+ * @brief  Read all 7 time/date registers into rtc_register.
+ * @return 0 on success, TWI_ERR_* on error.
+ */
+uint8_t RTC_read(void);
+
+
 /**
  * @brief  Set RTC time (decimal values).
  * @param  hours   Hours (0-23).
@@ -87,7 +153,7 @@ uint8_t rtc_set_time(uint8_t hours, uint8_t minutes, uint8_t seconds);
  * @param  hours   Pointer to store hours.
  * @param  minutes Pointer to store minutes.
  * @param  seconds Pointer to store seconds.
- * @return 0 on success.
+ * @return 0 on success, TWI_ERR_* on error.
  */
 uint8_t rtc_get_time(uint8_t *hours, uint8_t *minutes, uint8_t *seconds);
 
@@ -108,7 +174,7 @@ uint8_t rtc_set_date(uint8_t day, uint8_t date, uint8_t month, uint8_t year);
  * @param  date  Pointer to store day of month.
  * @param  month Pointer to store month.
  * @param  year  Pointer to store year.
- * @return 0 on success.
+ * @return 0 on success, TWI_ERR_* on error.
  */
 uint8_t rtc_get_date(uint8_t *date, uint8_t *month, uint8_t *year);
 
@@ -122,8 +188,9 @@ uint8_t rtc_get_day(uint8_t *day);
 
 
 /**
- * @brief  Read RTC and convert current time/date to FAT32 format.
- *         Updates global variables dateFAT and timeFAT.
+ * @brief  Convert the time of the current sample to FAT32 format.
+ *         Uses the last rtc_read_timestamp() snapshot, or reads the RTC if
+ *         there is none. Updates global variables dateFAT and timeFAT.
  * @return 0 on success, 1 on error.
  */
 unsigned char getDateTime_FAT(void);
@@ -25,6 +25,44 @@
 volatile unsigned char SDHC_flag = 0;
 volatile unsigned char cardType = 0;
 volatile unsigned char buffer[512];
+unsigned long blockReadCount = 0;
+unsigned long blockWriteCount = 0;
+unsigned long streamStartCount = 0;
+unsigned long readStreamStartCount = 0;
+unsigned long busyWaitCount = 0;
+struct latency_Structure sdLatency[SD_LATENCY_TYPES];
+
+
+/** @brief Block expected next by the open multiple block write (0 - no open stream). */
+static unsigned long streamNextBlock = 0;
+
+/** @brief Block being received by the open multiple block read (0 - no open stream). */
+static unsigned long readStreamBlock = 0;
+
+/** @brief Data bytes of readStreamBlock received so far (0 - start token not received yet). */
+static unsigned int readStreamOffset = 0;
+
+/** @brief 1 - card may still be programming the last written block (busy not seen released yet). */
+static unsigned char writeBusy = 0;
+
+/** @brief Four bytes following R1 in the last R3 (OCR) or R7 (interface condition) response. */
+static unsigned long responseTail = 0;
+
+
+/**
+ * @brief  Add one operation to the latency counters.
+ * @param  type SD_LATENCY_... operation type.
+ * @param  t0   Timer1 value at the start of the operation.
+ * @return none
+ */
+static void addLatency(unsigned char type, unsigned int t0)
+{
+unsigned int ticks = TCNT1 - t0;
+
+sdLatency[type].count++;
+sdLatency[type].ticks += ticks;
+if(ticks > sdLatency[type].maxTicks) sdLatency[type].maxTicks = ticks;
+}
 
 
 /**
@@ -37,6 +75,8 @@ unsigned char i, response, SD_version;
 unsigned int retry=0 ;
 
 
+writeBusy = 0; //the reset below does not wait for a block that timed out busy
+
  for(i=0;i<10;i++)
     SPI_transmit(0xff);
 
@@ -71,15 +111,19 @@ do
 {
 response = SD_sendCommand(SEND_IF_COND,0x000001AA); //Check power supply status, mendatory for SDHC card
 retry++;
-if(retry>0xfe) 
-   {
-      SD_version = 1;
-      cardType = 1;
-      break;
-   } //time out
+if(retry>0xfe) return 1; //time out, no response
+}while(response == 0xff);
 
 
-}while(response != 0x01);
+if(response & 0x04) //illegal command: SD ver 1.x card, no R7 follows
+{
+   SD_version = 1;
+   cardType = 1;
+}
+else if((response != 0x01) || ((responseTail & 0x0fff) != 0x01aa)) //R7 echoes voltage range and check pattern
+{
+   return 1; //card does not work at 2.7-3.6 V
+}
 
 
 retry = 0;
@@ -88,18 +132,20 @@ retry = 0;
 do
 {
 response = SD_sendCommand(APP_CMD,0); //CMD55, must be sent before sending any ACMD command
-response = SD_sendCommand(SD_SEND_OP_COND,0x40000000); //ACMD41
+response = SD_sendCommand(SD_SEND_OP_COND,(SD_version == 2) ? 0x40000000 : 0); //ACMD41, HCS bit only for ver2.x
 
 
+if(response == 0x00) break;
 retry++;
-if(retry>0xfe) 
+if(retry>1000) 
    {
       // uart_puts("SD_SEND_OP_COND timeout\r\n");
       return 1;
    } 
+_delay_ms(1); //card initialization takes up to 1 s, commands no longer delay by themselves
 
 
-}while(response != 0x00);
+}while(1);
 
 
 
@@ -123,6 +169,10 @@ if (SD_version == 2)
    }while(response != 0x00);
 
 
+   //R3: OCR bit 31 - power up done, bit 30 (CCS) - card uses block addresses (SDHC)
+   if((response == 0x00) && ((responseTail & 0xc0000000) == 0xc0000000)) SDHC_flag = 1;
+
+
    if(SDHC_flag == 1) cardType = 2;
    else cardType = 3;
 }
@@ -141,15 +191,27 @@ return 0; //successful return
 
 /**
  * @brief  Send command to SD card with argument.
+ *
+ * Waits for the card to be ready (0xFF) instead of a fixed delay, so a
+ * command costs only its bytes on a fast card. The R1 response is the first
+ * byte with bit 7 clear; the four bytes following an R3 (CMD58) or R7 (CMD8)
+ * response are kept in responseTail for SD_init().
+ *
  * @param  cmd Command byte value.
  * @param  arg 32-bit command argument.
- * @return Response byte from card.
+ * @return R1 response byte from card (0xFF on time-out, also if the card
+ *         stays busy programming the last written block).
  */
 unsigned char SD_sendCommand(unsigned char cmd, unsigned long arg)
 {
    
-unsigned char response, retry=0, status;
+unsigned char response, i;
+unsigned int retry=0, t0;
 // uart_puts_P("In SD_sendCommand\r\n");
+
+if(streamNextBlock || readStreamBlock) SD_stopStream(); //any other command ends an open multiple block transfer
+if(SD_waitReady()) return 0xff; //card does not accept a command while it is programming a block
+
 //SD card accepts byte address while SDHC accepts block address in multiples of 512
 //so, if it's SD card we need to convert block address into corresponding byte address by 
 //multipying it with 512. which is equivalent to shifting it left 9 times
@@ -169,9 +231,12 @@ if(cmd == READ_SINGLE_BLOCK     ||
       arg = arg << 9;
    }     
 }
+t0 = TCNT1;
 SD_CS_ASSERT;
 // uart_puts_P("After SD_CS_ASSERT\r\n");
-_delay_ms(1); //small delay before sending command
+if(cmd != GO_IDLE_STATE) //DO is not defined before the card is in SPI mode
+  while(SPI_receive() != 0xff) //wait until card is ready (DO high) instead of a fixed delay
+     if(retry++ > 0xfe) break; //time out, send anyway and let the response tell
 SPI_transmit(cmd | 0x40); //send command, first two bits always '01'
 SPI_transmit(arg>>24);
 SPI_transmit(arg>>16);
@@ -184,25 +249,23 @@ else
   SPI_transmit(0x95); 
 
 
-while((response = SPI_receive()) == 0xff) //wait response
+retry = 0;
+while((response = SPI_receive()) & 0x80) //R1 has bit 7 clear, sent within 8 bytes (NCR)
    if(retry++ > 0xfe) break; //time out error
 
 
-if(response == 0x00 && cmd == 58)  //checking response of CMD58
+//R3 (CMD58) and R7 (CMD8) carry four more bytes, unless the card rejected the command
+if(((cmd == READ_OCR) || (cmd == SEND_IF_COND)) && !(response & 0xfe))
 {
-  status = SPI_receive() & 0x40;     //first byte of the OCR register (bit 31:24)
-  if(status == 0x40) SDHC_flag = 1;  //we need it to verify SDHC card
-  else SDHC_flag = 0;
-
-
-  SPI_receive(); //remaining 3 bytes of the OCR register are ignored here
-  SPI_receive(); //one can use these bytes to check power supply limits of SD
-  SPI_receive(); 
+  responseTail = 0;
+  for(i=0; i<4; i++)
+    responseTail = (responseTail << 8) | SPI_receive();
 }
 
 
 SPI_receive(); //extra 8 CLK
 SD_CS_DEASSERT;
+addLatency(SD_LATENCY_COMMAND, t0);
 
 
 return response; //return state
@@ -240,31 +303,33 @@ return 0; //normal return
 
 
 /**
- * @brief  Read single 512-byte block from SD card into buffer.
+ * @brief  Read single 512-byte block from SD card into given memory.
  * @param  startBlock Block address to read.
+ * @param  data       Destination (512 bytes).
  * @return 0 on success, error code otherwise.
  */
-unsigned char SD_readSingleBlock(unsigned long startBlock)
+unsigned char SD_readBlock(unsigned long startBlock, unsigned char *data)
 {
    // uart_puts_P("In SD_readSingleBlock\r\n");
    // uart_pu
 unsigned char response;
-unsigned int i, retry=0;
+unsigned int retry=0, t0;
+blockReadCount++;
 // uart_puts_P("re1\r\n");
+t0 = TCNT1;
  response = SD_sendCommand(READ_SINGLE_BLOCK, startBlock); //read a Block command
 //  uart_puts_P("re2\r\n");
  if(response != 0x00) return response; //check for SD status: 0x00 - OK (No flags set)
 
 
 SD_CS_ASSERT;
-_delay_ms(1); //small delay before reading data
 retry = 0;
 while(SPI_receive() != 0xfe) //wait for start block token 0xfe (0x11111110)
   if(retry++ > 0xfffe){SD_CS_DEASSERT; return 1;} //return if time-out
+addLatency(SD_LATENCY_READ, t0);
 
 
-for(i=0; i<512; i++) //read 512 bytes
-  buffer[i] = SPI_receive();
+SPI_receiveBlock(data, 512); //read 512 bytes
 
 
 SPI_receive(); //receive incoming CRC (16-bit), CRC is ignored here
@@ -280,14 +345,29 @@ return 0;
 
 
 /**
- * @brief  Write single 512-byte block to SD card from buffer.
+ * @brief  Read single 512-byte block from SD card into buffer.
+ * @param  startBlock Block address to read.
+ * @return 0 on success, error code otherwise.
+ */
+unsigned char SD_readSingleBlock(unsigned long startBlock)
+{
+return SD_readBlock(startBlock, (unsigned char *) buffer);
+}
+
+
+/**
+ * @brief  Write single 512-byte block to SD card from given memory.
+ *         Returns once the card has accepted the data, without waiting
+ *         for it to be programmed (see SD_poll).
  * @param  startBlock Block address to write.
+ * @param  data       Source (512 bytes), free again on return.
  * @return 0 on success, error code otherwise.
  */
-unsigned char SD_writeSingleBlock(unsigned long startBlock)
+unsigned char SD_writeBlock(unsigned long startBlock, const unsigned char *data)
 {
 unsigned char response;
-unsigned int i, retry=0;
+unsigned int t0;
+blockWriteCount++;
 
 
  response = SD_sendCommand(WRITE_SINGLE_BLOCK, startBlock); //write a Block command
@@ -295,14 +375,14 @@ unsigned int i, retry=0;
  if(response != 0x00) return response; //check for SD status: 0x00 - OK (No flags set)
 
 
+t0 = TCNT1;
 SD_CS_ASSERT;
 
 
 SPI_transmit(0xfe);     //Send start block token 0xfe (0x11111110)
 
 
-for(i=0; i<512; i++)    //send 512 bytes data
-  SPI_transmit(buffer[i]);
+SPI_transmitBlock(data, 512); //send 512 bytes data
 
 
 SPI_transmit(0xff);     //transmit dummy CRC (16-bit), CRC is ignored here
@@ -310,6 +390,7 @@ SPI_transmit(0xff);
 
 
 response = SPI_receive();
+addLatency(SD_LATENCY_WRITE, t0);
 
 
 if( (response & 0x1f) != 0x05) //response= 0xXXX0AAA1 ; AAA='010' - data accepted
@@ -319,24 +400,301 @@ if( (response & 0x1f) != 0x05) //response= 0xXXX0AAA1 ; AAA='010' - data accepte
 }
 
 
-while(!SPI_receive()) //wait for SD card to complete writing and get idle
-if(retry++ > 0xfffe){SD_CS_DEASSERT; return 1;}
+writeBusy = 1; //card programs the block on its own, busy is polled by SD_poll() or the next access
+SD_CS_DEASSERT;
+SPI_transmit(0xff); //just spend 8 clock cycle delay before next command
+
+
+return 0;
+}
+
+
+/**
+ * @brief  Write single 512-byte block to SD card from buffer.
+ * @param  startBlock Block address to write.
+ * @return 0 on success, error code otherwise.
+ */
+unsigned char SD_writeSingleBlock(unsigned long startBlock)
+{
+return SD_writeBlock(startBlock, (const unsigned char *) buffer);
+}
+
+
+/**
+ * @brief  Write 512-byte block from buffer as part of a multiple block write.
+ *
+ * If the block directly follows the previous streamed block, it is sent as the
+ * next data packet of the open WRITE_MULTIPLE_BLOCKS (CMD25) transfer, so the
+ * card does not see a new command per block. Otherwise the open transfer is
+ * stopped and a new one is started at this block. The transfer stays open
+ * between calls and is stopped by SD_stopStream() or by the next command.
+ * Like SD_writeBlock() it does not wait for the block to be programmed;
+ * the next packet waits for it if the card is still busy.
+ *
+ * @param  startBlock Block address to write.
+ * @return 0 on success, error code otherwise.
+ */
+unsigned char SD_writeStreamBlock(unsigned long startBlock)
+{
+unsigned char response;
+unsigned int t0;
+blockWriteCount++;
+
+
+if(SD_waitReady()) return 1; //previous packet must be programmed before the next token
+
 
+if(startBlock != streamNextBlock)
+{
+  response = SD_sendCommand(WRITE_MULTIPLE_BLOCKS, startBlock); //start a multiple block write
+  if(response != 0x00) return response; //check for SD status: 0x00 - OK (No flags set)
+  streamStartCount++;
+}
+streamNextBlock = 0; //stream is not usable until this packet is accepted
+
+
+t0 = TCNT1;
+SD_CS_ASSERT;
+
+
+SPI_transmit(0xfc); //Send start block token 0xfc (0x11111100)
+
+
+SPI_transmitBlock((const unsigned char *) buffer, 512); //send 512 bytes data
+
+
+SPI_transmit(0xff); //transmit dummy CRC (16-bit), CRC is ignored here
+SPI_transmit(0xff);
 
+
+response = SPI_receive();
+streamNextBlock = startBlock + 1;
+addLatency(SD_LATENCY_WRITE, t0);
+
+if((response & 0x1f) != 0x05)
+{
+   SD_CS_DEASSERT;
+   SD_stopStream();
+   return response;
+}
+
+
+writeBusy = 1; //card programs the block on its own, busy is polled by SD_poll() or the next access
 SD_CS_DEASSERT;
-SPI_transmit(0xff);   //just spend 8 clock cycle delay before reasserting the CS line
-SD_CS_ASSERT;         //re-asserting the CS line to verify if card is still busy
+SPI_transmit(0xff); //just spend 8 clock cycle delay before next packet or command
+
+
+return 0;
+}
 
 
+/**
+ * @brief  Read bytes of a block as part of a multiple block read.
+ *
+ * The READ_MULTIPLE_BLOCKS (CMD18) transfer stays open between calls with
+ * CS held low, and the card sends the next byte only when it is clocked, so
+ * a read that continues where the previous one ended (in the same block or
+ * in the next one) costs no command and no access time. A read further
+ * ahead in the same or the next block clocks over the bytes in between;
+ * any other position stops the transfer and starts a new one. The transfer
+ * is stopped by SD_stopStream() or by the next command.
+ *
+ * @param  startBlock Block address.
+ * @param  offset     First byte inside the block.
+ * @param  data       Destination.
+ * @param  length     Number of bytes (offset + length <= 512).
+ * @return 0 on success, error code otherwise.
+ */
+unsigned char SD_readStream(unsigned long startBlock, unsigned int offset, unsigned char *data, unsigned int length)
+{
+unsigned char response;
+unsigned int retry, t0, chunk;
+
+
+if(offset + length > 512) return 1;
+
+
+if(!readStreamBlock ||
+   (((startBlock != readStreamBlock) || (offset < readStreamOffset)) && (startBlock != readStreamBlock + 1)))
+{
+  response = SD_sendCommand(READ_MULTIPLE_BLOCKS, startBlock); //start a multiple block read
+  if(response != 0x00) return response; //check for SD status: 0x00 - OK (No flags set)
+  readStreamStartCount++;
+  readStreamBlock = startBlock;
+  readStreamOffset = 0;
+}
+
+
+SD_CS_ASSERT;
+
+
+while(length)
+{
+  if(readStreamOffset == 0)
+  {
+    t0 = TCNT1;
+    retry = 0;
+    while(SPI_receive() != 0xfe) //wait for start block token 0xfe (0x11111110)
+      if(retry++ > 0xfffe){SD_stopStream(); return 1;} //return if time-out
+    addLatency(SD_LATENCY_READ, t0);
+    blockReadCount++;
+  }
+
+  if((readStreamBlock == startBlock) && (readStreamOffset >= offset))
+  {
+    chunk = 512 - readStreamOffset; //wanted bytes of this block in one go
+    if(chunk > length) chunk = length;
+    SPI_receiveBlock(data, chunk);
+    data += chunk;
+    length -= chunk;
+    readStreamOffset += chunk;
+  }
+  else
+  {
+    SPI_receive(); //clock over bytes in front of the wanted ones
+    readStreamOffset++;
+  }
+
+  if(readStreamOffset == 512)
+  {
+    SPI_receive(); //receive incoming CRC (16-bit), CRC is ignored here
+    SPI_receive();
+    readStreamBlock++;
+    readStreamOffset = 0;
+  }
+}
+
+
+return 0;
+}
+
+
+/**
+ * @brief  Stop open multiple block write started by SD_writeStreamBlock() or
+ *         multiple block read started by SD_readStream().
+ * @return 0 on success (or no open stream), 1 on busy time-out, otherwise the
+ *         R1 response of CMD12 (0xFF on time-out).
+ */
+unsigned char SD_stopStream(void)
+{
+unsigned char response;
+unsigned int retry=0, t0;
+
+if(readStreamBlock)
+{
+  readStreamBlock = 0;
+
+  SD_CS_ASSERT;
+  SPI_transmit(STOP_TRANSMISSION | 0x40); //CMD12 may interrupt a data block
+  SPI_transmit(0);
+  SPI_transmit(0);
+  SPI_transmit(0);
+  SPI_transmit(0);
+  SPI_transmit(0x95);
+  SPI_receive(); //stuff byte following CMD12
+
+
+  while((response = SPI_receive()) & 0x80) //R1 has bit 7 clear, data bytes the card was still sending are skipped
+    if(retry++ > 0xfe) break;
+
+  if(response){SD_CS_DEASSERT; SPI_transmit(0xff); return response;} //CMD12 rejected or no response
+
+
+  retry = 0;
+  while(!SPI_receive()) //wait for SD card to get idle (R1b)
+    if(retry++ > 0xfffe){SD_CS_DEASSERT; return 1;}
+
+
+  SD_CS_DEASSERT;
+  SPI_transmit(0xff);
+  return 0;
+}
+
+if(streamNextBlock == 0) return 0;
+streamNextBlock = 0;
+if(SD_waitReady()) return 1; //last packet must be programmed before the stop token
+
+
+SD_CS_ASSERT;
+SPI_transmit(0xfd); //send 'stop transmission token'
+SPI_receive();      //one byte gap before the card signals busy
+
+
+t0 = TCNT1;
 while(!SPI_receive()) //wait for SD card to complete writing and get idle
    if(retry++ > 0xfffe){SD_CS_DEASSERT; return 1;}
+addLatency(SD_LATENCY_BUSY, t0);
+
+
 SD_CS_DEASSERT;
+SPI_transmit(0xff);
 
 
 return 0;
 }
 
 
+/**
+ * @brief  Check without waiting whether the card has finished programming
+ *         the last written block.
+ *
+ * Block writes return as soon as the card has accepted the data packet; the
+ * card then programs the block on its own and holds DO low while it is busy
+ * (tens to hundreds of ms on some cards). The busy state is only looked at
+ * again here, with one byte clocked, or by SD_waitReady() at the next access,
+ * so the caller can do other work while the card programs.
+ *
+ * @return 0 - card ready, 1 - card still busy.
+ */
+unsigned char SD_poll(void)
+{
+if(!writeBusy) return 0;
+
+
+SD_CS_ASSERT;
+if(SPI_receive()) writeBusy = 0; //DO released - block programmed
+SD_CS_DEASSERT;
+SPI_transmit(0xff);
+
+
+return writeBusy;
+}
+
+
+/**
+ * @brief  Wait until the card has finished programming the last written block.
+ *
+ * The busy state is cleared only once DO is released, so after a time-out
+ * every later access waits again instead of talking to a busy card.
+ *
+ * @return 0 on success (or card not busy), 1 on busy time-out.
+ */
+unsigned char SD_waitReady(void)
+{
+unsigned int retry=0, t0;
+
+if(!writeBusy) return 0;
+
+
+SD_CS_ASSERT;
+if(!SPI_receive()) //still busy, the access has to wait
+{
+  t0 = TCNT1;
+  busyWaitCount++;
+  while(!SPI_receive()) //wait for SD card to complete writing and get idle
+     if(retry++ > 0xfffe){SD_CS_DEASSERT; return 1;} //still busy, the next access waits again
+  addLatency(SD_LATENCY_BUSY, t0);
+}
+writeBusy = 0; //DO released - block programmed
+
+
+SD_CS_DEASSERT;
+SPI_transmit(0xff);
+
+
+return 0;
+}
+
 
 #ifndef FAT_TESTING_ONLY
 
@@ -17,6 +17,9 @@
 #define _SD_ROUTINES_H_
 
 
+#include "SPI_routines.h"
+
+
 /** @brief Use this macro to disable multiple block access functions (not required for FAT32). */
 #define FAT_TESTING_ONLY
 
@@ -34,9 +37,15 @@
 // #define SD_CS_ASSERT     PORTB &= ~0x10
 // #define SD_CS_DEASSERT   PORTB |= 0x10
 
+#ifdef SPI_MSPIM
+//USART in SPI master mode (SPI_routines.h) clocks on XCK (PD4), so PB2 is used for Chip Select of SD
+#define SD_CS_ASSERT    PORTB &= ~0x04
+#define SD_CS_DEASSERT  PORTB |= 0x04
+#else
 //use following macros if SS (PD4) pin is used for Chip Select of SD (Arduino Ethernet Shield)
 #define SD_CS_ASSERT    PORTD &= ~0x10
 #define SD_CS_DEASSERT  PORTD |= 0x10
+#endif
 /** @} */
 
 
@@ -69,10 +78,46 @@
 #define OFF    0
 
 
+/**
+ * @defgroup SDLatency SD Operation Types for Latency Counters
+ * @{
+ */
+#define SD_LATENCY_COMMAND  0   //command frame until R1, including the wait for card ready
+#define SD_LATENCY_READ     1   //read command (or end of previous block) until data start token
+#define SD_LATENCY_WRITE    2   //data packet until data response
+#define SD_LATENCY_BUSY     3   //waiting for the card to program written blocks
+#define SD_LATENCY_TYPES    4
+/** @} */
+
+
+/** @brief Latency counters of one operation type, in Timer1 ticks (16 us at prescaler 256). */
+struct latency_Structure
+{
+unsigned long count;     //operations measured
+unsigned long ticks;     //sum of their durations
+unsigned int  maxTicks;  //longest one
+};
+
+
 /** @brief Global variables for SD card operations. */
 volatile unsigned long startBlock, totalBlocks; 
 volatile unsigned char SDHC_flag, cardType, buffer[512];
 
+/** @brief Number of single block reads/writes issued since power-up (I/O statistics). */
+unsigned long blockReadCount, blockWriteCount;
+
+/** @brief Number of multiple block writes started by SD_writeStreamBlock() (I/O statistics). */
+unsigned long streamStartCount;
+
+/** @brief Number of multiple block reads started by SD_readStream() (I/O statistics). */
+unsigned long readStreamStartCount;
+
+/** @brief Number of accesses that had to wait for the card to program a written block (I/O statistics). */
+unsigned long busyWaitCount;
+
+/** @brief Latency counters per operation type (SD_LATENCY_...); durations above ~1 s wrap. */
+struct latency_Structure sdLatency[SD_LATENCY_TYPES];
+
 
 /**
  * @brief  Initialize SD/SDHC card in SPI mode.
@@ -82,12 +127,33 @@ unsigned char SD_init(void);
 
 /**
  * @brief  Send command to SD card with argument.
+ *         Waits for the card to be ready (0xFF) instead of a fixed delay;
+ *         the four bytes of an R3 (CMD58) or R7 (CMD8) response are kept
+ *         for SD_init().
  * @param  cmd Command byte value.
  * @param  arg 32-bit command argument.
- * @return Response byte from card.
+ * @return R1 response byte from card (0xFF on time-out).
  */
 unsigned char SD_sendCommand(unsigned char cmd, unsigned long arg);
 
+/**
+ * @brief  Read single 512-byte block from SD card into given memory.
+ * @param  startBlock Block address to read.
+ * @param  data       Destination (512 bytes).
+ * @return 0 on success, error code otherwise.
+ */
+unsigned char SD_readBlock(unsigned long startBlock, unsigned char *data);
+
+/**
+ * @brief  Write single 512-byte block to SD card from given memory.
+ *         Returns once the card has accepted the data, without waiting
+ *         for it to be programmed (see SD_poll).
+ * @param  startBlock Block address to write.
+ * @param  data       Source (512 bytes), free again on return.
+ * @return 0 on success, error code otherwise.
+ */
+unsigned char SD_writeBlock(unsigned long startBlock, const unsigned char *data);
+
 /**
  * @brief  Read single 512-byte block from SD card into buffer.
  * @param  startBlock Block address to read.
@@ -102,6 +168,47 @@ unsigned char SD_readSingleBlock(unsigned long startBlock);
  */
 unsigned char SD_writeSingleBlock(unsigned long startBlock);
 
+/**
+ * @brief  Write 512-byte block from buffer, continuing an open multiple block
+ *         write (CMD25) when the block follows the previous streamed one.
+ * @param  startBlock Block address to write.
+ * @return 0 on success, error code otherwise.
+ */
+unsigned char SD_writeStreamBlock(unsigned long startBlock);
+
+/**
+ * @brief  Read bytes of a block, continuing an open multiple block read
+ *         (CMD18) when they follow the previously read bytes.
+ * @param  startBlock Block address.
+ * @param  offset     First byte inside the block.
+ * @param  data       Destination.
+ * @param  length     Number of bytes (offset + length <= 512).
+ * @return 0 on success, error code otherwise.
+ */
+unsigned char SD_readStream(unsigned long startBlock, unsigned int offset, unsigned char *data, unsigned int length);
+
+/**
+ * @brief  Stop open multiple block write or read (no-op if none is open).
+ *         Any other SD command stops it as well.
+ * @return 0 on success, 1 on busy time-out, otherwise the R1 response of
+ *         CMD12 (0xFF on time-out).
+ */
+unsigned char SD_stopStream(void);
+
+/**
+ * @brief  Check without waiting whether the card has finished programming
+ *         the last written block (block writes do not wait for it).
+ * @return 0 - card ready, 1 - card still busy.
+ */
+unsigned char SD_poll(void);
+
+/**
+ * @brief  Wait until the card has finished programming the last written
+ *         block. Every command and block write does this first.
+ * @return 0 on success (or card not busy), 1 on busy time-out.
+ */
+unsigned char SD_waitReady(void);
+
 /**
  * @brief  Read multiple blocks from SD card and send to UART.
  * @param  startBlock  Starting block address.
@@ -50,9 +50,6 @@
 #include "twi.h"
 
 
-#define SGP41_I2C_ADDRESS 0x59
-
-
 /**
  * @brief  Calculate Sensirion CRC-8 over input data.
  * @param  data Pointer to data bytes.
@@ -78,37 +75,36 @@ static uint8_t sensirion_crc(const uint8_t *data, size_t count) {
  * @brief  Send SGP41 command and optional data words with CRC.
  * @param  command      16-bit command code.
  * @param  words        Pointer to data words (may be NULL if words_count=0).
- * @param  words_count  Number of 16-bit data words.
+ * @param  words_count  Number of 16-bit data words (at most 2).
  * @return 0 on success, negative value on error.
  */
 static int write_command_with_words(uint16_t command, const uint16_t *words,
                                     size_t words_count) {
-    twi_start();
-    if (twi_write((SGP41_I2C_ADDRESS << 1) | TWI_WRITE)) {
-        twi_stop();
-        return -1; // address NACK
-    }
+    uint8_t tx[2 + 2 * 3]; // command + up to 2 words
+    uint8_t len = 0;
+
+
+    if (words_count > 2)
+        return -1;
 
 
     /* command high, low */
-    uint8_t cmd_hi = (uint8_t)((command >> 8) & 0xFF);
-    uint8_t cmd_lo = (uint8_t)(command & 0xFF);
-    if (twi_write(cmd_hi)) { twi_stop(); return -2; }
-    if (twi_write(cmd_lo)) { twi_stop(); return -3; }
+    tx[len++] = (uint8_t)((command >> 8) & 0xFF);
+    tx[len++] = (uint8_t)(command & 0xFF);
 
 
-    // send data words with CRC (each word = 2 bytes + 1 crc)
+    // data words with CRC (each word = 2 bytes + 1 crc)
     for (size_t i = 0; i < words_count; ++i) {
-        uint8_t b1 = (uint8_t)((words[i] >> 8) & 0xFF);
-        uint8_t b2 = (uint8_t)(words[i] & 0xFF);
-        if (twi_write(b1)) { twi_stop(); return -4; }
-        if (twi_write(b2)) { twi_stop(); return -5; }
-        uint8_t crc = sensirion_crc((const uint8_t[]){b1, b2}, 2);
-        if (twi_write(crc)) { twi_stop(); return -6; }
+        tx[len++] = (uint8_t)((words[i] >> 8) & 0xFF);
+        tx[len++] = (uint8_t)(words[i] & 0xFF);
+        tx[len] = sensirion_crc(&tx[len - 2], 2);
+        len++;
     }
 
 
-    twi_stop();
+    // one queued transfer, the TWI interrupt clocks the bytes out
+    if (twi_transfer(SGP41_I2C_ADDRESS, tx, len, NULL, 0) != TWI_OK)
+        return -2; // NACK, bus error or timeout
     return 0;
 }
 
@@ -120,16 +116,8 @@ static int write_command_with_words(uint16_t command, const uint16_t *words,
  * @return 0 on success, negative value on error.
  */
 static int read_bytes(uint8_t *buf, size_t num_bytes) {
-    twi_start();
-    if (twi_write((SGP41_I2C_ADDRESS << 1) | TWI_READ)) {
-        twi_stop();
+    if (twi_transfer(SGP41_I2C_ADDRESS, NULL, 0, (volatile uint8_t *)buf, (uint8_t)num_bytes) != TWI_OK)
         return -1;
-    }
-    for (size_t i = 0; i < num_bytes; ++i) {
-        uint8_t ack = (i + 1 < num_bytes) ? TWI_ACK : TWI_NACK;
-        buf[i] = twi_read(ack);
-    }
-    twi_stop();
     return 0;
 }
 
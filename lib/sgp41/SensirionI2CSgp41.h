@@ -43,6 +43,9 @@
 // Minimal SGP41 C interface using project's `twi` library (no Arduino/Wire)
 
 
+#define SGP41_I2C_ADDRESS 0x59 /**< @brief Fixed 7-bit I2C address of the SGP41 */
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
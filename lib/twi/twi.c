@@ -9,6 +9,357 @@
 
 // -- Includes ---------------------------------------------
 #include <twi.h>
+#include <gpio.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+
+
+// -- Defines ----------------------------------------------
+#define TWCR_IDLE  ((1<<TWINT) | (1<<TWEN))                               /* acknowledge, no interrupt */
+#define TWCR_NEXT  ((1<<TWINT) | (1<<TWEN) | (1<<TWIE))                   /* send byte / read with NACK */
+#define TWCR_ACK   ((1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWEA))       /* read with ACK */
+#define TWCR_START ((1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWSTA))
+#define TWCR_STOP  ((1<<TWINT) | (1<<TWEN) | (1<<TWSTO))
+
+
+// -- Global variables -------------------------------------
+static struct twi_transfer *volatile twi_head;  /* transfer on the bus, 0 - engine idle */
+static struct twi_transfer *twi_tail;           /* last queued transfer */
+static volatile uint8_t twi_polled;             /* 1 - twi_start() .. twi_stop() own the bus */
+static uint8_t twi_index;                       /* bytes of the current phase done */
+static uint8_t twi_phase;                       /* TWI_WRITE or TWI_READ */
+static uint16_t twi_t0;                         /* TCNT1 at the Start of the transaction */
+static volatile uint8_t twi_steps;              /* engine steps, for the wait timeouts */
+static uint8_t twi_polled_status;               /* TWI_OK or first error since twi_start() */
+static struct twi_stats twi_counters;
+
+
+/* Bit rate of one SCL frequency: TWBR and the TWPS prescaler bits */
+struct twi_rate
+{
+    uint8_t twbr;
+    uint8_t twps;
+};
+
+/* Device seen on the bus: own bit rate and error counters */
+struct twi_device
+{
+    struct twi_device_stats stats;              /* stats.addr 0 - free slot */
+    uint8_t has_rate;                           /* 0 - default bit rate */
+    struct twi_rate rate;
+};
+
+static struct twi_rate twi_default_rate;
+static struct twi_device twi_devices[TWI_DEVICE_SLOTS];
+static struct twi_device *twi_dev;              /* device of the transaction on the bus, 0 - untracked */
+
+
+
+// -- Bit rate ---------------------------------------------
+
+/**
+ * @brief  Compute TWBR and the prescaler for an SCL frequency.
+ * @param  scl_hz SCL frequency in Hz.
+ * @return Bit rate register values.
+ */
+static struct twi_rate twi_rate_of(uint32_t scl_hz)
+{
+    struct twi_rate rate = {0, 0};
+    uint32_t twbr;
+
+
+    if (scl_hz == 0 || F_CPU / scl_hz <= 16)
+        return rate;                    /* fastest: F_CPU/16 */
+
+
+    /* fscl = fcpu/(16 + 2*TWBR*4^TWPS) */
+    twbr = (F_CPU / scl_hz - 16) / 2;
+    while (twbr > 255 && rate.twps < 3)
+    {
+        twbr >>= 2;
+        rate.twps++;
+    }
+    rate.twbr = (twbr > 255) ? 255 : twbr;
+
+
+    return rate;
+}
+
+
+/**
+ * @brief  Find the slot of a device, or take a free one.
+ * @param  addr Slave address (7-bit).
+ * @return Slot, 0 if the device is new and all slots are taken.
+ */
+static struct twi_device *twi_device_of(uint8_t addr)
+{
+    struct twi_device *free = 0;
+    uint8_t i;
+
+
+    for (i = 0; i < TWI_DEVICE_SLOTS; i++)
+    {
+        if (twi_devices[i].stats.addr == addr)
+            return &twi_devices[i];
+        if (twi_devices[i].stats.addr == 0 && !free)
+            free = &twi_devices[i];
+    }
+    if (free)
+        free->stats.addr = addr;
+
+
+    return free;
+}
+
+
+/**
+ * @brief  Select the device of the next transaction: switch to its bit rate
+ *         before its Start condition or its SLA byte.
+ * @param  addr Slave address (7-bit).
+ * @return none
+ */
+static void twi_select(uint8_t addr)
+{
+    struct twi_rate rate = twi_default_rate;
+
+
+    twi_dev = twi_device_of(addr);
+    if (twi_dev && twi_dev->has_rate)
+        rate = twi_dev->rate;
+
+
+    TWBR = rate.twbr;
+    TWSR = rate.twps;                   /* status bits are read-only */
+}
+
+
+/**
+ * @brief  Count the result of a transaction for its device.
+ * @param  status TWI_OK or TWI_ERR_*.
+ * @return none
+ */
+static void twi_account(uint8_t status)
+{
+    twi_counters.transfers++;
+    twi_counters.bus_ticks += TCNT1 - twi_t0;
+    if (!twi_dev)
+        return;
+
+
+    twi_dev->stats.last = status;
+    if (status == TWI_ERR_NACK)
+        twi_dev->stats.nacks++;
+    else if (status == TWI_ERR_BUS)
+        twi_dev->stats.bus_errors++;
+    else if (status == TWI_ERR_TIMEOUT)
+        twi_dev->stats.timeouts++;
+}
+
+
+
+// -- Engine -----------------------------------------------
+
+/**
+ * @brief  Put the first queued transfer on the bus.
+ * @param  twcr TWCR_START, or TWCR_START | (1<<TWSTO) to end the previous
+ *              transfer by a Stop condition first.
+ * @return none
+ */
+static void twi_begin(uint8_t twcr)
+{
+    twi_phase = (twi_head->tx_len == 0 && twi_head->rx_len) ? TWI_READ : TWI_WRITE;
+    twi_select(twi_head->addr);
+    twi_t0 = TCNT1;
+    TWCR = twcr;
+}
+
+
+/**
+ * @brief  Complete the transfer on the bus and start the next one.
+ * @param  status TWI_OK or TWI_ERR_*.
+ * @return none
+ */
+static void twi_finish(uint8_t status)
+{
+    struct twi_transfer *transfer = twi_head;
+
+
+    twi_account(status);
+    twi_head = transfer->next;
+    if (twi_head)
+        twi_begin(TWCR_START | (1<<TWSTO));  /* Stop, then Start for the next transfer */
+    else
+        TWCR = TWCR_STOP;
+
+
+    transfer->status = status;
+    if (transfer->callback)
+        transfer->callback(transfer);
+}
+
+
+/**
+ * @brief  Advance the transfer on the bus by one step of the TWI state
+ *         machine; called when TWINT is set.
+ * @return none
+ */
+static void twi_service(void)
+{
+    struct twi_transfer *transfer = twi_head;
+
+
+    if (!transfer)
+    {
+        TWCR = TWCR_IDLE;
+        return;
+    }
+    twi_steps++;
+
+
+    switch (TWSR & 0xf8)
+    {
+    case 0x08:  /* Start transmitted */
+    case 0x10:  /* repeated Start transmitted */
+        twi_index = 0;
+        TWDR = (transfer->addr<<1) | twi_phase;
+        TWCR = TWCR_NEXT;
+        twi_counters.bytes++;
+        break;
+
+    case 0x18:  /* SLA+W transmitted, ACK received */
+    case 0x28:  /* data byte transmitted, ACK received */
+        if (twi_index < transfer->tx_len)
+        {
+            TWDR = transfer->tx[twi_index++];
+            TWCR = TWCR_NEXT;
+            twi_counters.bytes++;
+        }
+        else if (transfer->rx_len)
+        {
+            /* Repeated Start for the read phase, the bus stays owned */
+            twi_phase = TWI_READ;
+            TWCR = TWCR_START;
+        }
+        else
+            twi_finish(TWI_OK);
+        break;
+
+    case 0x40:  /* SLA+R transmitted, ACK received */
+        TWCR = (transfer->rx_len > 1) ? TWCR_ACK : TWCR_NEXT;
+        break;
+
+    case 0x50:  /* data byte received, ACK returned */
+        transfer->rx[twi_index++] = TWDR;
+        TWCR = (twi_index + 1 < transfer->rx_len) ? TWCR_ACK : TWCR_NEXT;
+        twi_counters.bytes++;
+        break;
+
+    case 0x58:  /* last data byte received, NACK returned */
+        transfer->rx[twi_index] = TWDR;
+        twi_counters.bytes++;
+        twi_finish(TWI_OK);
+        break;
+
+    case 0x20:  /* SLA+W transmitted, NACK received */
+    case 0x30:  /* data byte transmitted, NACK received */
+    case 0x48:  /* SLA+R transmitted, NACK received */
+        twi_finish(TWI_ERR_NACK);
+        break;
+
+    default:    /* 0x38 arbitration lost, 0x00 bus error */
+        twi_finish(TWI_ERR_BUS);
+        break;
+    }
+}
+
+
+/**
+ * @brief  TWI interrupt: one step of the transfer on the bus.
+ */
+ISR(TWI_vect)
+{
+    twi_service();
+}
+
+
+/**
+ * @brief  Step the engine from a wait loop while interrupts are disabled
+ *         (before sei() or inside another ISR), when TWI_vect cannot run.
+ * @return none
+ */
+static void twi_poll(void)
+{
+    if (!(SREG & (1<<SREG_I)) && (TWCR & (1<<TWINT)) && twi_head)
+        twi_service();
+}
+
+
+/**
+ * @brief  Fail the transfer on the bus after a timeout, clear the bus and
+ *         go on with the queue.
+ * @param  steps Engine steps seen by the waiting loop; nothing is done if
+ *               the engine moved on meanwhile or twi_start() owns the bus.
+ * @return none
+ */
+static void twi_abort(uint8_t steps)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (twi_head && twi_steps == steps && !twi_polled)
+        {
+            twi_recover();
+            twi_finish(TWI_ERR_TIMEOUT);
+        }
+    }
+}
+
+
+/**
+ * @brief  One microsecond of a loop waiting for the engine. Aborts the
+ *         transfer on the bus when the engine made no step for
+ *         TWI_TIMEOUT_US.
+ * @param  steps   Engine steps seen by the loop, initialised from twi_steps.
+ * @param  idle_us Time waited without a step, initialised to 0.
+ * @return none
+ */
+static void twi_watch(uint8_t *steps, uint16_t *idle_us)
+{
+    twi_poll();
+    if (*steps != twi_steps)
+    {
+        *steps = twi_steps;
+        *idle_us = 0;
+    }
+    else if (++*idle_us >= TWI_TIMEOUT_US)
+    {
+        twi_abort(*steps);
+        *idle_us = 0;
+    }
+    else
+        _delay_us(1);
+}
+
+
+/**
+ * @brief  Wait for TWINT in the polled twi_start() .. twi_stop() path.
+ * @return 0 when set, 1 after TWI_TIMEOUT_US.
+ */
+static uint8_t twi_wait_int(void)
+{
+    uint16_t us;
+
+
+    for (us = 0; (TWCR & (1<<TWINT)) == 0; us++)
+    {
+        if (us >= TWI_TIMEOUT_US)
+            return 1;
+        _delay_us(1);
+    }
+
+
+    return 0;
+}
 
 
 
@@ -26,21 +377,286 @@ void twi_init(void)
 
 
     /* Set SCL frequency */
-    TWSR &= ~((1<<TWPS1) | (1<<TWPS0));
-    TWBR = TWI_BIT_RATE_REG;
+    twi_set_speed(F_SCL);
 }
 
 
 
 /**
- * @brief  Start communication on I2C/TWI bus.
+ * @brief  Set the default SCL frequency.
+ * @param  scl_hz SCL frequency in Hz.
  * @return none
  */
-void twi_start(void)
+void twi_set_speed(uint32_t scl_hz)
+{
+    struct twi_rate rate = twi_rate_of(scl_hz);
+
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        twi_default_rate = rate;
+        if (!twi_head && !twi_polled)
+        {
+            TWBR = rate.twbr;
+            TWSR = rate.twps;
+        }
+    }
+}
+
+
+
+/**
+ * @brief  Set the SCL frequency of one device.
+ * @param  addr   Slave address (7-bit).
+ * @param  scl_hz SCL frequency in Hz, 0 - default.
+ * @return 0 on success, 1 if the table is full.
+ */
+uint8_t twi_set_device_speed(uint8_t addr, uint32_t scl_hz)
 {
+    struct twi_rate rate = twi_rate_of(scl_hz);
+    struct twi_device *dev;
+
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        dev = twi_device_of(addr);
+        if (dev)
+        {
+            dev->has_rate = (scl_hz != 0);
+            dev->rate = rate;
+        }
+    }
+
+
+    return dev ? 0 : 1;
+}
+
+
+
+/**
+ * @brief  Read the error counters of one device.
+ * @param  addr Slave address (7-bit).
+ * @return Counters, 0 if the device is not tracked.
+ */
+const struct twi_device_stats *twi_get_device_stats(uint8_t addr)
+{
+    uint8_t i;
+
+
+    for (i = 0; i < TWI_DEVICE_SLOTS; i++)
+        if (twi_devices[i].stats.addr == addr)
+            return &twi_devices[i].stats;
+
+
+    return 0;
+}
+
+
+
+/**
+ * @brief  Read the bus usage counters.
+ * @return Counters since the last reset.
+ */
+const struct twi_stats *twi_get_stats(void)
+{
+    return &twi_counters;
+}
+
+
+
+/**
+ * @brief  Clear the bus usage counters.
+ * @return none
+ */
+void twi_reset_stats(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        twi_counters.transfers = 0;
+        twi_counters.bytes = 0;
+        twi_counters.bus_ticks = 0;
+        twi_counters.recoveries = 0;
+    }
+}
+
+
+
+/**
+ * @brief  Clear a bus held by a slave: clock SCL until SDA is released
+ *         (at most 9 clocks), then send a Stop condition.
+ * @return TWI_OK if both lines are high, TWI_ERR_BUS otherwise.
+ */
+uint8_t twi_recover(void)
+{
+    uint8_t i;
+
+
+    /* TWI unit off: the pins are driven as open drain through DDR, low
+       by output 0, released by input with pull-up */
+    TWCR = 0;
+    gpio_mode_input_pullup(&DDR(TWI_PORT), TWI_SDA_PIN);
+    gpio_mode_input_pullup(&DDR(TWI_PORT), TWI_SCL_PIN);
+    _delay_us(5);
+
+
+    /* Clock out the byte the slave is sending */
+    for (i = 0; i < 9 && !gpio_read(&PIN(TWI_PORT), TWI_SDA_PIN); i++)
+    {
+        gpio_write_low(&TWI_PORT, TWI_SCL_PIN);
+        gpio_mode_output(&DDR(TWI_PORT), TWI_SCL_PIN);
+        _delay_us(5);
+        gpio_mode_input_pullup(&DDR(TWI_PORT), TWI_SCL_PIN);
+        _delay_us(5);
+    }
+
+
+    /* Stop condition: SDA rises while SCL is high */
+    gpio_write_low(&TWI_PORT, TWI_SDA_PIN);
+    gpio_mode_output(&DDR(TWI_PORT), TWI_SDA_PIN);
+    _delay_us(5);
+    gpio_mode_input_pullup(&DDR(TWI_PORT), TWI_SDA_PIN);
+    _delay_us(5);
+
+
+    twi_counters.recoveries++;
+    if (gpio_read(&PIN(TWI_PORT), TWI_SDA_PIN) && gpio_read(&PIN(TWI_PORT), TWI_SCL_PIN))
+        return TWI_OK;
+    else
+        return TWI_ERR_BUS;
+}
+
+
+
+/**
+ * @brief  Queue a transfer and start it if the bus is free.
+ * @param  transfer Descriptor filled in by the caller.
+ * @return none
+ */
+void twi_submit(struct twi_transfer *transfer)
+{
+    transfer->next = 0;
+    transfer->status = TWI_PENDING;
+
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (twi_head)
+            twi_tail->next = transfer;
+        else
+        {
+            twi_head = transfer;
+            if (!twi_polled)
+            {
+                uint16_t us;
+
+                /* previous Stop still on the bus */
+                for (us = 0; (TWCR & (1<<TWSTO)) && us < TWI_TIMEOUT_US; us++)
+                    _delay_us(1);
+                twi_begin(TWCR_START);
+            }
+        }
+        twi_tail = transfer;
+    }
+}
+
+
+
+/**
+ * @brief  Wait until a queued transfer completes.
+ * @param  transfer Transfer passed to twi_submit().
+ * @return TWI_OK or TWI_ERR_*.
+ */
+uint8_t twi_wait(struct twi_transfer *transfer)
+{
+    uint8_t steps = twi_steps;
+    uint16_t idle_us = 0;
+
+
+    while (transfer->status == TWI_PENDING)
+        twi_watch(&steps, &idle_us);
+
+
+    return transfer->status;
+}
+
+
+
+/**
+ * @brief  Test whether the engine still has queued transfers.
+ * @return 1 if busy, 0 if idle.
+ */
+uint8_t twi_busy(void)
+{
+    return twi_head != 0;
+}
+
+
+
+/**
+ * @brief  Write and then read bytes in one blocking transfer.
+ * @param  addr   Slave address (7-bit).
+ * @param  tx     Bytes to write.
+ * @param  tx_len Number of bytes to write.
+ * @param  rx     Buffer for the bytes read.
+ * @param  rx_len Number of bytes to read.
+ * @return TWI_OK or TWI_ERR_*.
+ */
+uint8_t twi_transfer(uint8_t addr, const uint8_t *tx, uint8_t tx_len, volatile uint8_t *rx, uint8_t rx_len)
+{
+    struct twi_transfer transfer;
+
+
+    transfer.addr = addr;
+    transfer.tx = tx;
+    transfer.tx_len = tx_len;
+    transfer.rx = rx;
+    transfer.rx_len = rx_len;
+    transfer.callback = 0;
+    twi_submit(&transfer);
+
+
+    return twi_wait(&transfer);
+}
+
+
+
+/**
+ * @brief  Start communication on I2C/TWI bus.
+ * @return TWI_OK, or TWI_ERR_TIMEOUT if the Start condition could not be sent.
+ */
+uint8_t twi_start(void)
+{
+    uint8_t owned = 0;
+    uint8_t steps = twi_steps;
+    uint16_t idle_us = 0;
+
+
+    /* Take the bus from the engine once its queue is empty */
+    while (!owned)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (!twi_head)
+            {
+                twi_polled = 1;
+                owned = 1;
+            }
+        }
+        if (!owned)
+            twi_watch(&steps, &idle_us);
+    }
+
+
     /* Send Start condition */
+    twi_dev = 0;
+    twi_polled_status = TWI_OK;
+    twi_t0 = TCNT1;
     TWCR = (1<<TWINT) | (1<<TWSTA) | (1<<TWEN);
-    while ((TWCR & (1<<TWINT)) == 0);
+    if (twi_wait_int())
+        twi_polled_status = TWI_ERR_TIMEOUT;
+
+
+    return twi_polled_status;
 }
 
 
@@ -55,10 +671,26 @@ uint8_t twi_write(uint8_t data)
     uint8_t twi_status;
 
 
+    /* Nothing more after a timeout, twi_stop() clears the bus */
+    if (twi_polled_status == TWI_ERR_TIMEOUT)
+        return 1;
+
+
+    /* After a (repeated) Start the byte is SLA+R/W: use the bit rate of that device */
+    twi_status = TWSR & 0xf8;
+    if (twi_status == 0x08 || twi_status == 0x10)
+        twi_select(data >> 1);
+
+
     /* Send SLA+R, SLA+W, or data byte on I2C/TWI bus */
+    twi_counters.bytes++;
     TWDR = data;
     TWCR = (1<<TWINT) | (1<<TWEN);
-    while ((TWCR & (1<<TWINT)) == 0);
+    if (twi_wait_int())
+    {
+        twi_polled_status = TWI_ERR_TIMEOUT;
+        return 1;
+    }
 
 
     /* Check value of TWI status register */
@@ -72,8 +704,11 @@ uint8_t twi_write(uint8_t data)
     */
     if (twi_status == 0x18 || twi_status == 0x28 || twi_status == 0x40)
         return 0;   /* ACK received */
-    else
-        return 1;   /* NACK received */
+
+
+    if (twi_polled_status == TWI_OK)
+        twi_polled_status = (twi_status == 0x20 || twi_status == 0x30 || twi_status == 0x48) ? TWI_ERR_NACK : TWI_ERR_BUS;
+    return 1;   /* NACK received */
 }
 
 
@@ -85,13 +720,22 @@ uint8_t twi_write(uint8_t data)
  */
 uint8_t twi_read(uint8_t ack)
 {
+    if (twi_polled_status == TWI_ERR_TIMEOUT)
+        return 0xff;
+
+
     if (ack == TWI_ACK)
         TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWEA);
     else
         TWCR = (1<<TWINT) | (1<<TWEN);
-    while ((TWCR & (1<<TWINT)) == 0);
+    if (twi_wait_int())
+    {
+        twi_polled_status = TWI_ERR_TIMEOUT;
+        return 0xff;
+    }
 
 
+    twi_counters.bytes++;
     return (TWDR);
 }
 
@@ -103,7 +747,18 @@ uint8_t twi_read(uint8_t ack)
  */
 void twi_stop(void)
 {
-    TWCR = (1<<TWINT) | (1<<TWSTO) | (1<<TWEN);
+    /* Hand the bus back to the engine, Stop then Start if transfers wait */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (twi_polled_status == TWI_ERR_TIMEOUT)
+            twi_recover();
+        twi_account(twi_polled_status);
+        twi_polled = 0;
+        if (twi_head)
+            twi_begin(TWCR_START | (1<<TWSTO));
+        else
+            TWCR = TWCR_STOP;
+    }
 }
 
 
@@ -111,19 +766,11 @@ void twi_stop(void)
 /**
  * @brief  Test presence of one I2C device on the bus.
  * @param  addr Slave address (7-bit).
- * @return 0 if device present (ACK), 1 otherwise.
+ * @return 0 if device present (ACK), TWI_ERR_* otherwise.
  */
 uint8_t twi_test_address(uint8_t addr)
 {
-    uint8_t ack;  // ACK response from Slave
-
-
-    twi_start();
-    ack = twi_write((addr<<1) | TWI_WRITE);
-    twi_stop();
-
-
-    return ack;
+    return twi_transfer(addr, 0, 0, 0, 0);
 }
 
 
@@ -134,36 +781,11 @@ uint8_t twi_test_address(uint8_t addr)
  * @param  memaddr Internal memory address to start reading from.
  * @param  buf     Pointer to buffer for received data.
  * @param  nbytes  Number of bytes to read.
- * @return none
+ * @return 0 on success, TWI_ERR_* on failure.
  */
-void twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf, uint8_t nbytes)
+uint8_t twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf, uint8_t nbytes)
 {
-    twi_start();
-    if (twi_write((addr<<1) | TWI_WRITE) == 0)
-    {
-        // Set starting address
-        twi_write(memaddr);
-        twi_stop();
-
-
-        // Read data into the buffer
-        twi_start();
-        twi_write((addr<<1) | TWI_READ);
-        if (nbytes >= 2)
-        {
-            for (uint8_t i=0; i<(nbytes-1); i++)
-            {
-                *buf++ = twi_read(TWI_ACK);
-            }
-        }
-        *buf = twi_read(TWI_NACK);
-        twi_stop();
-    }
-    else
-    {
-        twi_stop();
-    }
-    
+    return twi_transfer(addr, &memaddr, 1, buf, nbytes);
 }
 
 
@@ -172,27 +794,14 @@ void twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf,
  * @param  addr    Slave address (7-bit).
  * @param  memaddr Internal memory address to write to.
  * @param  data    Data byte to write.
- * @return 0 on success (ACK), 1 on failure.
+ * @return 0 on success (ACK), TWI_ERR_* on failure.
  */
 uint8_t twi_writeto_mem(uint8_t addr, uint8_t memaddr, uint8_t data)
 {
-    twi_start();
-    /* Send SLA+W and check ACK */
-    if (twi_write((addr<<1) | TWI_WRITE) == 0)
-    {
-        /* Send memory address */
-        if (twi_write(memaddr) == 0)
-        {
-            /* Send data byte */
-            if (twi_write(data) == 0)
-            {
-                twi_stop();
-                return 0; /* success (ACKs received) */
-            }
-        }
-    }
-    twi_stop();
-    return 1; /* failure (NACK or other error) */
+    uint8_t tx[2] = {memaddr, data};
+
+
+    return twi_transfer(addr, tx, sizeof(tx), 0, 0);
 }
 
 
@@ -202,29 +811,12 @@ uint8_t twi_writeto_mem(uint8_t addr, uint8_t memaddr, uint8_t data)
  * @param  memaddr       Internal memory address to write to.
  * @param  dataUpperHalf MSB of data.
  * @param  dataLowerHalf LSB of data.
- * @return 0 on success (ACK), 1 on failure.
+ * @return 0 on success (ACK), TWI_ERR_* on failure.
  */
 uint8_t twi_writeto_mem_16b(uint8_t addr, uint8_t memaddr, uint8_t dataUpperHalf,uint8_t dataLowerHalf)
 {
-    twi_start();
-    /* Send SLA+W and check ACK */
-    if (twi_write((addr<<1) | TWI_WRITE) == 0) //vyzva na komunikaciu
-    {
-        /* Send memory address */
-        if (twi_write(memaddr) == 0)    //zapis adresy pociatocnej
-        {
-            /* Send data byte */
-            if (twi_write(dataUpperHalf) == 0) //zapis upperHalf bytu
-            {
-                if (twi_write(dataLowerHalf) == 0) //zapis lowerHalf bytu
-                {
-                    twi_stop();
-                    return 0; /* success (ACKs received) */
-                }
-            
-            }
-        }
-    }
-    twi_stop();
-    return 1; /* failure (NACK or other error) */
+    uint8_t tx[3] = {memaddr, dataUpperHalf, dataLowerHalf};
+
+
+    return twi_transfer(addr, tx, sizeof(tx), 0, 0);
 }
@@ -18,6 +18,11 @@
  *
  * This library defines functions for the TWI (I2C) communication between
  * AVR and Slave device(s). Functions use internal TWI module of AVR.
+ * Transfers are queued as descriptors (struct twi_transfer) and run by the
+ * TWI interrupt, so the CPU is free while the bus works; the register
+ * helpers (twi_readfrom_mem_into() etc.) queue a transfer and wait for it.
+ * Every wait is bounded by TWI_TIMEOUT_US: a slave holding SDA low fails
+ * the transaction with TWI_ERR_TIMEOUT and twi_recover() clears the bus.
  *
  * @note Only Master transmitting and Master receiving modes are implemented. Based on Microchip Atmel ATmega16 and ATmega328P manuals.
  * @copyright (c) 2018-2025 Tomas Fryza, MIT license
@@ -35,8 +40,14 @@
 #ifndef F_CPU
 #define F_CPU 16000000 /**< @brief CPU frequency in Hz required TWI_BIT_RATE_REG */
 #endif
-#define F_SCL 100000 /**< @brief I2C/TWI bit rate. Must be greater than 31000 */
+#define TWI_SPEED_STANDARD 100000UL /**< @brief Standard-mode SCL frequency in Hz */
+#define TWI_SPEED_FAST 400000UL /**< @brief Fast-mode SCL frequency in Hz */
+#ifndef F_SCL
+#define F_SCL TWI_SPEED_STANDARD /**< @brief Default I2C/TWI bit rate, see twi_set_speed() */
+#endif
 #define TWI_BIT_RATE_REG ((F_CPU/F_SCL - 16) / 2) /**< @brief TWI bit rate register value */
+#define TWI_DEVICE_SLOTS 4 /**< @brief Devices with their own SCL frequency and error counters */
+#define TWI_TIMEOUT_US 2000 /**< @brief Bus silence that aborts a transaction; must exceed one byte (9/fscl) */
 
 
 /**
@@ -58,24 +69,200 @@
 #define PIN(_x) (*(&_x - 2)) /**< @brief Address of input register of port _x */
 
 
+/**
+ * @name Status of a queued transfer (struct twi_transfer)
+ */
+#define TWI_OK 0 /**< @brief Transfer completed, every byte acknowledged */
+#define TWI_ERR_NACK 1 /**< @brief Slave did not acknowledge its address or a written byte */
+#define TWI_ERR_BUS 2 /**< @brief Bus error or lost arbitration */
+#define TWI_ERR_TIMEOUT 3 /**< @brief No bus progress for TWI_TIMEOUT_US, bus cleared by twi_recover() */
+#define TWI_PENDING 0xff /**< @brief Transfer is queued or on the bus */
+
+
+// -- Types ------------------------------------------------
+struct twi_transfer;
+
+/**
+ * @brief  Completion callback of a queued transfer. Runs in the TWI
+ *         interrupt (or in twi_wait() while interrupts are disabled), so it
+ *         must be short; it may queue the next transfer.
+ */
+typedef void (*twi_callback_t)(struct twi_transfer *transfer);
+
+/**
+ * @brief  Transaction descriptor for the interrupt-driven engine.
+ *
+ * A transfer writes tx_len bytes after SLA+W, then reads rx_len bytes after
+ * a repeated Start and SLA+R, without releasing the bus in between; either
+ * phase may be empty (both empty: address probe). The caller
+ * owns the descriptor and its buffers until status leaves TWI_PENDING.
+ */
+struct twi_transfer
+{
+    uint8_t addr;                  /**< @brief Slave address (7-bit) */
+    uint8_t tx_len;                /**< @brief Number of bytes to write */
+    uint8_t rx_len;                /**< @brief Number of bytes to read */
+    volatile uint8_t status;       /**< @brief TWI_PENDING, then TWI_OK or TWI_ERR_* */
+    const uint8_t *tx;             /**< @brief Bytes to write (register address first) */
+    volatile uint8_t *rx;          /**< @brief Buffer for the bytes read */
+    twi_callback_t callback;       /**< @brief Called on completion (NULL - none, poll status) */
+    struct twi_transfer *next;     /**< @brief Queue link, used by the engine */
+};
+
+
+/**
+ * @brief  Bus usage counters, see twi_get_stats().
+ *
+ * Bus time runs from the Start condition to the Stop condition of each
+ * transaction and is counted in Timer1 ticks (16 us with the 1 s overflow
+ * prescaler of main.c); transactions longer than one Timer1 period wrap.
+ */
+struct twi_stats
+{
+    uint16_t transfers;            /**< @brief Transactions (Start .. Stop) */
+    uint16_t bytes;                /**< @brief Address and data bytes on the bus */
+    uint16_t bus_ticks;            /**< @brief Time the bus was owned, Timer1 ticks */
+    uint16_t recoveries;           /**< @brief Bus-clear sequences, see twi_recover() */
+};
+
+
+/**
+ * @brief  Error counters of one device, see twi_get_device_stats().
+ *
+ * The first TWI_DEVICE_SLOTS addresses on the bus are tracked; the
+ * counters are never cleared.
+ */
+struct twi_device_stats
+{
+    uint8_t addr;                  /**< @brief Slave address (7-bit) */
+    uint8_t last;                  /**< @brief Status of the last transaction, TWI_OK or TWI_ERR_* */
+    uint16_t nacks;                /**< @brief Transactions failed with TWI_ERR_NACK */
+    uint16_t bus_errors;           /**< @brief Transactions failed with TWI_ERR_BUS */
+    uint16_t timeouts;             /**< @brief Transactions failed with TWI_ERR_TIMEOUT */
+};
+
+
 // -- Function prototypes ----------------------------------
 /**
  * @brief  Initialize TWI unit, enable internal pull-ups, and set SCL frequency.
  * @par    Implementation notes:
  *           - AVR internal pull-up resistors at pins TWI_SDA_PIN and
  *             TWI_SCL_PIN are enabled
- *           - TWI bit rate register value is calculated as follows
- *             fscl = fcpu/(16 + 2*TWBR)
+ *           - all devices start at F_SCL, see twi_set_speed() and
+ *             twi_set_device_speed()
  * @return none
  */
 void twi_init(void);
 
 
 /**
- * @brief  Start communication on I2C/TWI bus.
+ * @brief  Set the default SCL frequency, used for devices without their own.
+ * @param  scl_hz SCL frequency in Hz, e.g. TWI_SPEED_STANDARD or
+ *                TWI_SPEED_FAST; any value from about 500 Hz to F_CPU/16.
  * @return none
+ * @par    Implementation notes:
+ *           - fscl = fcpu/(16 + 2*TWBR*prescaler), the smallest prescaler
+ *             (1, 4, 16, 64) that fits TWBR in 8 bits is used
+ *           - 400 kHz needs external pull-ups (4.7 kOhm or less); the
+ *             internal ones are too weak for fast-mode rise times
+ */
+void twi_set_speed(uint32_t scl_hz);
+
+
+/**
+ * @brief  Set the SCL frequency used for transactions with one device.
+ * @param  addr   Slave address (7-bit)
+ * @param  scl_hz SCL frequency in Hz, 0 - use the default again
+ * @return 0 on success, 1 if all TWI_DEVICE_SLOTS are taken
+ * @note   The bit rate is switched at every Start condition addressed to
+ *         the device, also for transfers driven by twi_start()/twi_write().
  */
-void twi_start(void);
+uint8_t twi_set_device_speed(uint8_t addr, uint32_t scl_hz);
+
+
+/**
+ * @brief  Read the bus usage counters.
+ * @return Counters since the last twi_reset_stats()
+ */
+const struct twi_stats *twi_get_stats(void);
+
+
+/**
+ * @brief  Clear the bus usage counters, e.g. before one sample.
+ * @return none
+ */
+void twi_reset_stats(void);
+
+
+/**
+ * @brief  Read the error counters of one device.
+ * @param  addr Slave address (7-bit)
+ * @return Counters, NULL if the device is not tracked
+ */
+const struct twi_device_stats *twi_get_device_stats(uint8_t addr);
+
+
+/**
+ * @brief  Clear a bus held by a slave with the TWI unit off: clock SCL
+ *         until the slave releases SDA (at most 9 clocks), then send a
+ *         Stop condition.
+ * @return TWI_OK if SDA and SCL are high afterwards, TWI_ERR_BUS otherwise
+ * @note   Called on every timeout; the next transaction enables the TWI
+ *         unit again.
+ */
+uint8_t twi_recover(void);
+
+
+/**
+ * @brief  Queue a transfer for the interrupt-driven engine and return.
+ * @param  transfer Descriptor filled in by the caller; status is set to
+ *                  TWI_PENDING and changes when the transfer completes.
+ * @return none
+ * @note   Can be called from an interrupt, e.g. from a completion callback.
+ */
+void twi_submit(struct twi_transfer *transfer);
+
+
+/**
+ * @brief  Wait until a queued transfer completes.
+ * @param  transfer Transfer passed to twi_submit().
+ * @return Final status, TWI_OK or TWI_ERR_*
+ * @note   With interrupts disabled (before sei() or inside an ISR) the engine
+ *         is run from this loop instead of the TWI interrupt.
+ */
+uint8_t twi_wait(struct twi_transfer *transfer);
+
+
+/**
+ * @brief  Test whether the engine still has queued transfers.
+ * @return 1 if a transfer is queued or on the bus, 0 if idle
+ */
+uint8_t twi_busy(void);
+
+
+/**
+ * @brief  Write and then read bytes in one blocking transfer
+ *         (twi_submit() followed by twi_wait()).
+ * @param  addr   Slave address
+ * @param  tx     Bytes to write
+ * @param  tx_len Number of bytes to write
+ * @param  rx     Buffer for the bytes read
+ * @param  rx_len Number of bytes to read
+ * @return TWI_OK or TWI_ERR_*
+ */
+uint8_t twi_transfer(uint8_t addr, const uint8_t *tx, uint8_t tx_len, volatile uint8_t *rx, uint8_t rx_len);
+
+
+/**
+ * @brief  Start communication on I2C/TWI bus.
+ * @return TWI_OK, or TWI_ERR_TIMEOUT if the Start condition was not sent
+ * @note   twi_start(), twi_write(), twi_read() and twi_stop() drive the bus
+ *         byte by byte without the interrupt; twi_start() waits for queued
+ *         transfers first and new ones wait until twi_stop(). After a
+ *         timeout twi_write() and twi_read() do nothing and twi_stop()
+ *         clears the bus.
+ */
+uint8_t twi_start(void);
 
 
 /**
@@ -83,7 +270,7 @@ void twi_start(void);
  * @param  data Byte to be transmitted
  * @return ACK/NACK received value
  * @retval 0 - ACK has been received
- * @retval 1 - NACK has been received
+ * @retval 1 - NACK has been received, bus error or timeout
  * @note   Function returns 0 if 0x18, 0x28, or 0x40 status code is detected\n
  *           - 0x18: SLA+W has been transmitted and ACK has been received\n
  *           - 0x28: Data byte has been transmitted and ACK has been received\n
@@ -96,7 +283,7 @@ uint8_t twi_write(uint8_t data);
  * @brief  Read one byte from the I2C/TWI bus and acknowledge
  *         it by ACK or NACK.
  * @param  ack - ACK/NACK value to be transmitted
- * @return Received data byte
+ * @return Received data byte, 0xff after a timeout
  */
 uint8_t twi_read(uint8_t ack);
 
@@ -114,26 +301,29 @@ void twi_stop(void);
  * @return ACK/NACK received value
  * @retval 0 - ACK has been received
  * @retval 1 - NACK has been received
+ * @retval 2 - Bus error
  */
 uint8_t twi_test_address(uint8_t addr);
 
 
 /**
  * @brief  Read into buf from the peripheral, starting from the memory address.
+ *         The address is written and the data read in one transaction
+ *         joined by a repeated Start.
  * @param  addr Slave address
  * @param  memaddr Starting address
  * @param  buf Buffer to be read into
  * @param  nbytes Number of bytes
- * @return none
+ * @return TWI_OK or TWI_ERR_*
  */
-void twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf, uint8_t nbytes);
+uint8_t twi_readfrom_mem_into(uint8_t addr, uint8_t memaddr, volatile uint8_t *buf, uint8_t nbytes);
 
 /**
  * @brief  Write into peripheral
  * @param  addr Slave address
  * @param  memaddr Memory address
  * @param  data Data to be written
- * @return none
+ * @return TWI_OK or TWI_ERR_*
  */
 uint8_t twi_writeto_mem(uint8_t addr, uint8_t memaddr, uint8_t data);
 
@@ -144,7 +334,7 @@ uint8_t twi_writeto_mem(uint8_t addr, uint8_t memaddr, uint8_t data);
  * @param  memaddr Memory address
  * @param  dataUpperHalf Data to be written
  * @param  dataLowerHalf Data to be written
- * @return none
+ * @return TWI_OK or TWI_ERR_*
  */
 uint8_t twi_writeto_mem_16b(uint8_t addr, uint8_t memaddr, uint8_t dataUpperHalf,uint8_t dataLowerHalf);
 
@@ -38,8 +38,6 @@ static inline void transmitString_P(const char* string)
  */
 static inline void transmitHex(unsigned char type, unsigned long value)
 {
-    char hex_string[12];
-    char *ptr = hex_string;
     unsigned char nibble;
     unsigned char i;
     unsigned char digits;
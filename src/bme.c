@@ -108,7 +108,8 @@ static BME280_INTF_RET_TYPE user_i2c_read(uint8_t reg_addr, uint8_t *reg_data, u
         return BME280_E_INVALID_LEN;
 
 
-    twi_readfrom_mem_into(dev_addr, reg_addr, (volatile uint8_t *)reg_data, (uint8_t)len);
+    if (twi_readfrom_mem_into(dev_addr, reg_addr, (volatile uint8_t *)reg_data, (uint8_t)len) != TWI_OK)
+        return BME280_E_COMM_FAIL;
     return BME280_INTF_RET_SUCCESS;
 }
 
@@ -124,18 +125,36 @@ static BME280_INTF_RET_TYPE user_i2c_read(uint8_t reg_addr, uint8_t *reg_data, u
 static BME280_INTF_RET_TYPE user_i2c_write(uint8_t reg_addr, const uint8_t *reg_data, uint32_t len, void *intf_ptr)
 {
     uint8_t dev_addr = *((uint8_t *)intf_ptr);
-    twi_start();
-    if (twi_write((dev_addr << 1) | TWI_WRITE) != 0) { twi_stop(); return BME280_E_COMM_FAIL; }
-    if (twi_write(reg_addr) != 0) { twi_stop(); return BME280_E_COMM_FAIL; }
+    uint8_t tx[1 + 19]; // register address + the longest burst of bme280_set_regs() (10 registers)
+    if (len >= sizeof(tx) || reg_data == NULL)
+        return BME280_E_INVALID_LEN;
+
+
+    tx[0] = reg_addr;
     for (uint32_t i = 0; i < len; i++)
-    {
-        if (twi_write(reg_data[i]) != 0) { twi_stop(); return BME280_E_COMM_FAIL; }
-    }
-    twi_stop();
+        tx[1 + i] = reg_data[i];
+    if (twi_transfer(dev_addr, tx, (uint8_t)(1 + len), NULL, 0) != TWI_OK)
+        return BME280_E_COMM_FAIL;
     return BME280_INTF_RET_SUCCESS;
 }
 
 
+/**
+ * @brief  Status of a failed driver call: the TWI status of the last
+ *         transaction with the sensor if that failed, else the fallback.
+ * @param  dev      Pointer to device structure.
+ * @param  fallback Driver error code.
+ * @return TWI_ERR_* or fallback.
+ */
+static int bme_status(const struct bme280_dev *dev, int fallback)
+{
+    const struct twi_device_stats *bus = twi_get_device_stats(*((uint8_t *)dev->intf_ptr));
+    if (bus && bus->last != TWI_OK)
+        return bus->last;
+    return fallback;
+}
+
+
 /**
  * @brief  Delay callback in microseconds.
  * @param  period   Delay in microseconds.
@@ -201,13 +220,14 @@ int bme_init_simple(struct bme280_dev *dev, uint8_t *dev_addr_ptr)
  * @param  t100      Output for temperature (0.01 degC).
  * @param  press_pa  Output for pressure (Pa).
  * @param  hum_x1024 Output for humidity (% * 1024).
- * @return 0 on success, non-zero on error.
+ * @return 0 on success, TWI_ERR_* if a bus transaction failed (the bus is
+ *         given up after the first one), negative on other driver errors.
  */
 int bme_read_once(struct bme280_dev *dev, int32_t *t100, uint32_t *press_pa, uint32_t *hum_x1024)
 {
     /* Trigger one-shot measurement (forced) */
     int8_t rslt = bme280_set_sensor_mode(BME280_POWERMODE_FORCED, dev);
-    if (rslt != BME280_OK) return -1;
+    if (rslt != BME280_OK) return bme_status(dev, -1);
 
 
     /* Wait required measurement time */
@@ -219,6 +239,8 @@ int bme_read_once(struct bme280_dev *dev, int32_t *t100, uint32_t *press_pa, uin
     uint32_t meas_delay_us = 0;
     if (rslt == BME280_OK)
         bme280_cal_meas_delay(&meas_delay_us, &settings);
+    else if (bme_status(dev, 0) != 0)
+        return bme_status(dev, 0); /* bus failed: no point waiting for the data */
     else
         meas_delay_us = 10000; /* 10 ms conservative */
 
@@ -231,7 +253,7 @@ int bme_read_once(struct bme280_dev *dev, int32_t *t100, uint32_t *press_pa, uin
     rslt = bme280_get_regs(BME280_REG_DATA, data, BME280_LEN_P_T_H_DATA, dev);
     if (rslt != BME280_OK)
     {
-        return -2;
+        return bme_status(dev, -2);
     }
 
 
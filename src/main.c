@@ -10,6 +10,8 @@
 #include "SPI_routines.h"
 #include "sd_routines.h"
 #include "FAT32.h"
+#include "logger.h"
+#include "ringlog.h"
 #include "gpio.h"
 #include "rtc.h"
 #include <twi.h>
@@ -22,11 +24,35 @@
 
 
 #define LOG_TIME_INTERVAL_SEC 5
+#define LOG_ROTATION LOG_ROTATE_DAY // one file per day, YYMMDD00.CSV
+#define LOG_MAX_BYTES 0 // continue in YYMMDD00.C01... above this size (0 = no limit)
+#define LOG_RESERVE_BYTES (86400UL / LOG_TIME_INTERVAL_SEC * 64) // one day of ~64 B records
+// #define LOG_BINARY // 20 B binary records (YYMMDD00.BIN, tools/bin2csv.cpp) instead of CSV lines
+// #define LOG_DELTA // with LOG_BINARY: delta/varint compressed records (YYMMDD00.DLT)
+// #define LOG_RING // CSV lines into the raw-sector ring RING.DAT, no FAT updates (tools/ringdump.cpp)
+#define LOG_RING_SECTORS (7 * 86400UL / LOG_TIME_INTERVAL_SEC / 8) // about a week of ~60 B lines, 8 per block
 #define UART_ON
 // #define UART_DEBUG
 #define SD_write
 // #define UPDATE_RTC_TIME_COMPILE
 #define DAY_NUMBER 2 // 1=Sunday ... 7=Saturday
+#define RTC_SYNC_MINUTES 10 // resync the software calendar with the DS3231 (after 1 min if it had drifted)
+#define TIM1_OVF_US (65536UL * 256 / (F_CPU / 1000000UL)) // Timer1 overflow period, prescaler 256
+#define TWI_SPEED_SENSORS TWI_SPEED_FAST // SCL of the DS3231, BME280 and SGP41 (all fast-mode parts, need external pull-ups)
+
+#ifdef SPI_MSPIM // SD card on the USART (SPI_routines.h), no serial console
+#undef UART_ON
+#undef UART_DEBUG
+#endif
+
+#ifdef LOG_RING // the ring stores CSV lines
+#undef LOG_BINARY
+#undef LOG_DELTA
+#endif
+
+#if defined(LOG_BINARY) && defined(LOG_DELTA) && !defined(LOG_DELTA_FORMAT)
+#error "LOG_DELTA needs the delta encoder, define LOG_DELTA_FORMAT in logger.h"
+#endif
 
 
 
@@ -41,7 +67,6 @@
 
 
 
-volatile uint8_t printRTC = 0;
 volatile uint8_t counterTim1 = 0;
 
 
@@ -81,6 +106,35 @@ uint8_t get_month_from_ascii_sum(uint16_t sum) {
 }
 
 
+/**
+ * @brief  Fill a timestamp with the compile time (__DATE__, __TIME__), the
+ *         time source when the RTC cannot be read.
+ * @param  ts Timestamp to fill, day of week is DAY_NUMBER.
+ * @return none
+ */
+static void get_compile_time(struct rtc_timestamp *ts)
+{
+    int hour_comp, minute_comp, second_comp;
+    sscanf(__TIME__, "%d:%d:%d", &hour_comp, &minute_comp, &second_comp);
+    ts->hour = (uint8_t)hour_comp;
+    ts->minute = (uint8_t)minute_comp;
+    ts->second = (uint8_t)second_comp;
+
+    int year_comp, month_comp, day_comp;
+    char month_str[4];
+    sscanf(__DATE__, "%s %d %d", month_str, &day_comp, &year_comp);
+
+    uint16_t month_sum = month_str[0] + month_str[1] + month_str[2];
+    month_comp = get_month_from_ascii_sum(month_sum);
+
+    ts->day = DAY_NUMBER;
+    ts->date = (uint8_t)day_comp;
+    ts->month = (uint8_t)month_comp;
+    ts->year = (uint8_t)(year_comp % 100);
+    ts->epoch = epoch_seconds(ts->year, ts->month, ts->date, ts->hour, ts->minute, ts->second);
+}
+
+
 /**
  * @brief  Configure external interrupt INT0 on falling edge (PD2).
  * @return none
@@ -124,15 +178,29 @@ void set_interrupt_source(void)
 int main(void)
 {
     tim1_ovf_1sec();
-    uint8_t hour, minute, second; 
-    uint8_t day, date, month, year;
+    struct rtc_timestamp now = {0}; // time of the current sample (RTC burst read, or compile time)
     
     // Initialize UART
+    #ifndef SPI_MSPIM
     uart_init(UART_BAUD_SELECT(115200, F_CPU));
+    #endif
 
     //Init I2C
     twi_init();
+    twi_set_device_speed(RTC_ADDRESS, TWI_SPEED_SENSORS);
+    twi_set_device_speed(BME280_I2C_ADDR_PRIM, TWI_SPEED_SENSORS);
+    twi_set_device_speed(SGP41_I2C_ADDRESS, TWI_SPEED_SENSORS);
+
+    #ifdef SPI_MSPIM
+    // Configure USART SPI master pins for ATmega328P
+    gpio_mode_output(&DDRD, PD1);  // TXD = MOSI
+    gpio_mode_output(&DDRD, PD4);  // XCK = SCK
+    gpio_mode_output(&DDRB, PB2);  // SS (Chip Select)
+    gpio_mode_input_nopull(&DDRD, PD0);  // RXD = MISO as input
 
+    // Set SS high initially (SD card deselected)
+    gpio_write_high(&PORTB, PB2);
+    #else
     // Configure SPI pins for ATmega328P
     gpio_mode_output(&DDRB, PB3);  // MOSI
     gpio_mode_output(&DDRB, PB5);  // SCK
@@ -141,6 +209,7 @@ int main(void)
     
     // Set SS high initially (SD card deselected)
     gpio_write_high(&PORTD, PIND4);
+    #endif
 
     gpio_mode_output(&DDRC, 0); //led red   ERROR
     gpio_mode_output(&DDRC, 1); //led green STATUS
@@ -165,6 +234,12 @@ int main(void)
     #ifdef UART_DEBUG
     uart_puts_P("SPI initialized\r\n");
     #endif
+
+    #ifdef SPI_BENCH
+    /* Card still deselected: SPI module (and MSPIM) block throughput */
+    SPI_benchmark((unsigned char *)buffer);
+    spi_init();
+    #endif
     
     #ifdef UART_DEBUG
     uart_puts_P("Initializing SD card...\r\n");
@@ -197,6 +272,29 @@ int main(void)
             uart_puts_P("FAT32 initialized successfully!\r\n");
         #endif
         FS_OK = 0;
+
+        /* Roll back or forward the files left open by a power loss */
+        uint8_t repaired = recoverJournal();
+        if (repaired == 0xff)
+            FS_OK = 1;
+        #ifdef UART_DEBUG
+        else if (repaired)
+            uart_puts_P("Unclean shutdown, log files repaired\r\n");
+        #endif
+
+        #ifdef LOG_RING
+        /* Records go to the ring sectors, the FAT is not updated */
+        if (ringlog_open("ring.dat", LOG_RING_SECTORS))
+            FS_OK = 1;
+        #endif
+
+        /* Log file is opened by log_rotate() with the first sample */
+        log_set_rotation(LOG_ROTATION, LOG_MAX_BYTES, LOG_RESERVE_BYTES);
+        #if defined(LOG_BINARY) && defined(LOG_DELTA)
+            log_set_format(LOG_FORMAT_DELTA);
+        #elif defined(LOG_BINARY)
+            log_set_format(LOG_FORMAT_BIN);
+        #endif
     }
     #endif
 
@@ -230,22 +328,8 @@ int main(void)
         RTC_OK = 1;
 
         // Set compile time to local variables (RTC not available)
-        int hour_comp, minute_comp, second_comp;
-        sscanf(__TIME__, "%d:%d:%d", &hour_comp, &minute_comp, &second_comp);
-        hour = (uint8_t)hour_comp;
-        minute = (uint8_t)minute_comp;
-        second = (uint8_t)second_comp;
-
-        int year_comp, month_comp, day_comp;
-        char month_str[4];
-        sscanf(__DATE__, "%s %d %d", month_str, &day_comp, &year_comp);
-
-        uint16_t month_sum = month_str[0] + month_str[1] + month_str[2];
-        month_comp = get_month_from_ascii_sum(month_sum);
-        
-        date = (uint8_t)day_comp;
-        month = (uint8_t)month_comp;
-        year = (uint8_t)(year_comp % 100);
+        get_compile_time(&now);
+        rtc_clock_set(&now); // advanced by Timer1 from here on
     }
     else
     {
@@ -253,27 +337,22 @@ int main(void)
             uart_puts_P("RTC found!\r\n");
         #endif
         #ifdef UPDATE_RTC_TIME_COMPILE
-            int hour_comp, minute_comp, second_comp;
-            sscanf(__TIME__, "%d:%d:%d", &hour_comp, &minute_comp, &second_comp);
-            hour = (uint8_t)hour_comp;
-            minute = (uint8_t)minute_comp;
-            second = (uint8_t)second_comp;
-
-            int year_comp, month_comp, day_comp;
-            char month_str[4];
-            sscanf(__DATE__, "%s %d %d", month_str, &day_comp, &year_comp);
-
-            uint16_t month_sum = month_str[0] + month_str[1] + month_str[2];
-            month_comp = get_month_from_ascii_sum(month_sum);
-            
-            date = (uint8_t)day_comp;
-            month = (uint8_t)month_comp;
-            year = (uint8_t)(year_comp % 100);
-            rtc_set_time(hour, minute, second);
-            rtc_set_date(DAY_NUMBER, day, month, (year % 100));
+            get_compile_time(&now);
+            rtc_set_time(now.hour, now.minute, now.second);
+            rtc_set_date(DAY_NUMBER, now.date, now.month, now.year);
         #endif
         rtc_write_reg(0x0e, 0x00);
+        if (rtc_clock_sync(NULL)) // seed the software calendar, advanced by INT0 from here on
+        {
+            // answered the probe but not the read: same as no RTC
+            RTC_OK = 1;
+            get_compile_time(&now);
+            rtc_clock_set(&now);
+        }
     }
+    rtc_clock_now(&now);
+    uint32_t last_sync = now.epoch;
+    uint16_t sync_interval = RTC_SYNC_MINUTES * 60;
     
     if (RTC_OK & SGP_OK & SD_OK & FS_OK & BM_OK)
     {
@@ -302,32 +381,12 @@ int main(void)
     }
     
     set_interrupt_source();
+    #ifdef UART_DEBUG
     char buffer[50];
+    #endif
     // Main loop
     while (1)
     {   
-        #ifdef UART_ON
-        if(printRTC == 1)
-        {
-            printRTC = 0;
-            if (!(twi_test_address(RTC_ADDRESS)))
-            {
-                rtc_get_time(&hour, &minute, &second);
-                sprintf(buffer, "Time RTC: %02d:%02d:%02d\r\n", hour, minute, second);
-                uart_puts(buffer);
-                rtc_get_date(&date, &month, &year);
-                sprintf(buffer, "Date RTC: %02d/%02d/20%02d\r\n", date, month, year);
-                uart_puts(buffer);
-                RTC_OK = 0;
-            }
-            else
-            {
-                uart_puts_P("RTC not found, using Compile time\r\n");
-                gpio_write_low(&ERROR_LED_PORT, L_ERROR);
-            }
-        }
-        #endif
-        
         if(RTC_OK | SGP_OK | BM_OK | SD_OK | FS_OK)
         {
             gpio_write_low(&ERROR_LED_PORT, L_ERROR);
@@ -337,34 +396,62 @@ int main(void)
             gpio_write_high(&ERROR_LED_PORT, L_ERROR);
         }
 
+        #ifdef SD_write
+        if (SD_OK == 0 && FS_OK == 0 && log_service())
+        {
+            #ifdef UART_ON
+            uart_puts_P("SD flush error!\r\n");
+            #endif
+            gpio_write_low(&ERROR_LED_PORT, L_ERROR);
+        }
+        #endif
+
         if (measurement_flag)
         {
             measurement_flag = 0;
 
+            #ifndef LOG_BINARY
             char sdString[100];
             memset(sdString, 0, sizeof(sdString)); 
+            #endif
             
             int32_t t100 = 0;
             uint32_t press_pa = 0;
             uint32_t hum_x1024 = 0;
+            #ifdef LOG_BINARY
+            struct log_record rec;
+            memset(&rec, 0, sizeof(rec));
+            #endif
+            twi_reset_stats();
             
-            if(twi_test_address(RTC_ADDRESS))
+            /* Time from the software calendar, no bus traffic; the same time
+               is used for the line and the FAT timestamps. The DS3231 is read
+               only to resync, and to notice it coming or going. */
+            if (rtc_clock_now(&now) || now.epoch - last_sync >= sync_interval)
             {
-                RTC_OK = 1;
-                set_interrupt_source();
-            }
-            else
-            {
-                RTC_OK = 0;
-                rtc_get_time(&hour, &minute, &second);
-                rtc_get_date(&date, &month, &year);
-                set_interrupt_source();
+                int32_t drift = 0;
+                uint8_t rtc_error = rtc_clock_sync(&drift) ? 1 : 0;
+                if (rtc_error != RTC_OK) // switch the tick source only when the RTC comes or goes
+                {
+                    RTC_OK = rtc_error;
+                    set_interrupt_source();
+                }
+                sync_interval = drift ? 60 : RTC_SYNC_MINUTES * 60;
+                rtc_clock_now(&now);
+                last_sync = now.epoch;
             }
+            #ifdef LOG_BINARY
+            if (RTC_OK)
+                rec.flags |= LOG_FLAG_RTC_ERROR;
+            rec.epoch = now.epoch;
+            #else
+            snprintf_P(sdString, sizeof(sdString), PSTR("%02d:%02d:%02d,%02d/%02d/20%02d,"),
+                       now.hour, now.minute, now.second, now.date, now.month, now.year);
+            #endif
             
-            snprintf(sdString, sizeof(sdString), "%02d:%02d:%02d,%02d/%02d/20%02d,",
-                     hour, minute, second, date, month, year);
-            
-            if (bme_read_once(&bme_dev, &t100, &press_pa, &hum_x1024) == 0) {
+            int bme_err = bme_read_once(&bme_dev, &t100, &press_pa, &hum_x1024);
+            if (bme_err == 0) {
+                #ifndef LOG_BINARY
                 int32_t temp_int = t100 / 100;
                 int32_t temp_frac = (t100 >= 0) ? (t100 % 100) : ((-t100) % 100);
                 
@@ -380,56 +467,108 @@ int main(void)
                 int32_t alt_int = (int32_t)alt;
                 int32_t alt_frac = (int32_t)(fabs(alt - (double)alt_int) * 100.0 + 0.5);
                 
-                char temp_buf[64];
-                snprintf(temp_buf, sizeof(temp_buf), "%02ld.%02ld,%03lu.%02lu,%02lu.%02lu,%03ld.%02ld,",
-                         (long)temp_int, (long)temp_frac,
-                         (unsigned long)press_hpa_int, (unsigned long)press_hpa_frac,
-                         (unsigned long)hum_int, (unsigned long)hum_frac,
-                         (long)alt_int, (long)alt_frac);
-                strncat(sdString, temp_buf, sizeof(sdString) - strlen(sdString) - 1);
+                size_t used = strlen(sdString); // formatted in place, no second line buffer on the stack
+                snprintf_P(&sdString[used], sizeof(sdString) - used, PSTR("%02ld.%02ld,%03lu.%02lu,%02lu.%02lu,%03ld.%02ld,"),
+                           (long)temp_int, (long)temp_frac,
+                           (unsigned long)press_hpa_int, (unsigned long)press_hpa_frac,
+                           (unsigned long)hum_int, (unsigned long)hum_frac,
+                           (long)alt_int, (long)alt_frac);
+                #endif
                 BM_OK = 0;
             } else {
                 gpio_write_low(&ERROR_LED_PORT, L_ERROR);
-                strncat(sdString, "ERR,ERR,ERR,ERR,", sizeof(sdString) - strlen(sdString) - 1);
+                #ifndef LOG_BINARY
+                strncat_P(sdString, PSTR("ERR,ERR,ERR,ERR,"), sizeof(sdString) - strlen(sdString) - 1);
+                #endif
                 BM_OK = 1;
+                #ifdef UART_DEBUG
+                snprintf(buffer, sizeof(buffer), "BME err %d\r\n", bme_err); // TWI_ERR_* > 0, driver < 0
+                uart_puts(buffer);
+                #endif
             }
             
             /* Read SGP41 */
             int32_t voc_idx = 0;
             int32_t nox_idx = 0;
-            if (sgp41_measure_once(&voc_idx, &nox_idx) == 0) {
-                char temp_buf[32];
-                snprintf(temp_buf, sizeof(temp_buf), "%ld,%ld\n", (long)voc_idx, (long)nox_idx);
-                strncat(sdString, temp_buf, sizeof(sdString) - strlen(sdString) - 1);
+            int sgp_err = sgp41_measure_once(&voc_idx, &nox_idx);
+            if (sgp_err == 0) {
+                #ifndef LOG_BINARY
+                size_t used = strlen(sdString);
+                snprintf_P(&sdString[used], sizeof(sdString) - used, PSTR("%ld,%ld\n"), (long)voc_idx, (long)nox_idx);
+                #endif
                 SGP_OK = 0;
             } else {
-                strncat(sdString, "ERR,ERR\n", sizeof(sdString) - strlen(sdString) - 1);
+                #ifndef LOG_BINARY
+                strncat_P(sdString, PSTR("ERR,ERR\n"), sizeof(sdString) - strlen(sdString) - 1);
+                #endif
                 SGP_OK = 1;
+                #ifdef UART_DEBUG
+                snprintf(buffer, sizeof(buffer), "SGP err %d\r\n", sgp_err);
+                uart_puts(buffer);
+                #endif
+            }
+
+            #ifdef UART_DEBUG
+            /* Bus time of this sample: RTC, BME280 and SGP41 transactions */
+            const struct twi_stats *bus = twi_get_stats();
+            snprintf(buffer, sizeof(buffer), "TWI xfer=%u bytes=%u bus=%lu us rec=%u\r\n",
+                     bus->transfers, bus->bytes, (unsigned long)bus->bus_ticks * 256 / (F_CPU / 1000000UL),
+                     bus->recoveries);
+            uart_puts(buffer);
+            #endif
+
+            #ifdef LOG_BINARY
+            if (BM_OK)
+                rec.flags |= LOG_FLAG_BME_ERROR;
+            else
+            {
+                rec.t100 = (int16_t)t100;
+                rec.press_pa = press_pa;
+                rec.hum_x1024 = hum_x1024;
             }
+            if (SGP_OK)
+                rec.flags |= LOG_FLAG_SGP_ERROR;
+            else
+            {
+                rec.voc_index = (uint16_t)voc_idx;
+                rec.nox_index = (uint16_t)nox_idx;
+            }
+            #endif
             
             uint8_t write_error = 0;
 
-            /* Write to SD card */
+            /* Write to SD card (write-behind, flushed by the logger deadlines) */
             #ifdef SD_write
             gpio_write_low(&ACTIVITY_LED_PORT, L_ACT);
             if (SD_OK == 0 && FS_OK == 0)
             {
-                memset(dataString, 0, MAX_STRING_SIZE);
-                strncpy((char*)dataString, sdString, MAX_STRING_SIZE - 1);
-                
-                unsigned char fileName[12];
-                strcpy((char*)fileName, "data1.csv");
-
-                write_error = writeFile(fileName);
+                #if defined(LOG_RING)
+                write_error = ringlog_write((const uint8_t *)sdString, strlen(sdString));
+                #elif defined(LOG_BINARY)
+                write_error = log_rotate(now.year, now.month, now.date, now.hour);
+                if (!write_error)
+                    write_error = log_write_record(&rec);
+                #else
+                write_error = log_rotate(now.year, now.month, now.date, now.hour);
+                /* Time of the line for the sidecar index (.IDX) */
+                log_set_time(RTC_OK ? 0 : now.epoch);
+                if (!write_error)
+                    write_error = log_write((const uint8_t *)sdString, strlen(sdString));
+                #endif
                  if (write_error) {
+                    #ifdef UART_ON
                     uart_puts_P("SD write error!\r\n");
+                    #endif
                     gpio_write_low(&ERROR_LED_PORT, L_ERROR);
                 }
                 gpio_write_high(&ACTIVITY_LED_PORT, L_ACT);
+                #ifdef UART_DEBUG
+                    log_print_stats();
+                #endif
             }
             #endif
             
-            #ifdef UART_ON
+            #if defined(UART_ON) && !defined(LOG_BINARY)
                 uart_puts(sdString);
             #endif
         }
@@ -444,10 +583,14 @@ int main(void)
  */
 ISR(TIMER1_OVF_vect)
 {   
+    rtc_clock_tick(TIM1_OVF_US);
+    log_tick();
     counterTim1++;
     if (counterTim1 >= LOG_TIME_INTERVAL_SEC) 
     {
         counterTim1 = 0;    
+        if (measurement_flag)
+            log_sample_missed(); // previous sample not taken yet
         measurement_flag = 1;
     }
 }
@@ -459,10 +602,14 @@ ISR(TIMER1_OVF_vect)
  */
 ISR(INT0_vect)
 {
+    rtc_clock_tick(1000000UL);
+    log_tick();
     counterTim1++;
     if (counterTim1 >= LOG_TIME_INTERVAL_SEC)
     {
         counterTim1 = 0;    
+        if (measurement_flag)
+            log_sample_missed(); // previous sample not taken yet
         measurement_flag = 1;
     }
 }
@@ -103,7 +103,8 @@ int sgp41_init_simple(void)
  *         Includes conditioning phase during first 10 measurements.
  * @param  voc_index Pointer to store VOC index (0-500+).
  * @param  nox_index Pointer to store NOx index (0-500+).
- * @return 0 on success, non-zero error code otherwise.
+ * @return 0 on success, TWI_ERR_* if a bus transaction failed, negative
+ *         on other errors (-1 not initialized, -3 CRC mismatch).
  */
 int sgp41_measure_once(int32_t *voc_index, int32_t *nox_index)
 {
@@ -119,16 +120,22 @@ int sgp41_measure_once(int32_t *voc_index, int32_t *nox_index)
     uint16_t err;
     if (conditioning_s > 0) {
         /* run conditioning command to keep sensor heater conditioned */
-        (void)sgp41_executeConditioning(defaultRh, defaultT, &srawVoc);
-        /* always perform a measurement to obtain both VOC and NOx */
-        err = sgp41_measureRawSignals(defaultRh, defaultT, &srawVoc, &srawNox);
+        err = sgp41_executeConditioning(defaultRh, defaultT, &srawVoc);
+        /* always perform a measurement to obtain both VOC and NOx, unless
+         * the sensor did not answer (1: command, 2: read) */
+        if (err != 1 && err != 2)
+            err = sgp41_measureRawSignals(defaultRh, defaultT, &srawVoc, &srawNox);
         conditioning_s--;
     } else {
         err = sgp41_measureRawSignals(defaultRh, defaultT, &srawVoc, &srawNox);
     }
 
 
-    if (err) return (int)err;
+    if (err) {
+        const struct twi_device_stats *bus = twi_get_device_stats(SGP41_I2C_ADDRESS);
+        if (bus && bus->last != TWI_OK) return bus->last;
+        return -(int)err;
+    }
 
 
     /* Process raw sraw values through gas index algorithms */
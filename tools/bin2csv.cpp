@@ -0,0 +1,114 @@
+// Host-side decoder for binary log files (YYMMDDhh.BIN) written by the
+// datalogger in LOG_BINARY mode. Converts the 20-byte records described in
+// lib/logger/log_record.h back to the CSV lines the firmware writes in text
+// mode. Delta-compressed files (YYMMDDhh.DLT, .Dnn, lib/logger/log_delta.h)
+// are recognised by their extension or forced with -d.
+//
+// Build: g++ -std=c++17 -O2 -o bin2csv tools/bin2csv.cpp
+// Usage: bin2csv [-r] [-d] FILE.BIN [FILE.DLT ...] > out.csv
+//        -r  raw columns: epoch,t100,press_pa,hum_x1024,voc,nox,flags
+//        -d  treat all following files as delta-compressed
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "log_format.hpp"
+
+namespace {
+
+using namespace logfmt;
+
+// Extension .DLT or .Dnn (rotated continuation files).
+bool is_delta_name(const std::string &name)
+{
+    std::size_t dot = name.rfind('.');
+    if (dot == std::string::npos || name.size() - dot != 4)
+        return false;
+    std::string ext = name.substr(dot + 1);
+    for (char &c : ext)
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return ext == "DLT" || (ext[0] == 'D' && std::isdigit(static_cast<unsigned char>(ext[1])) &&
+                            std::isdigit(static_cast<unsigned char>(ext[2])));
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    bool raw = false;
+    bool force_delta = false;
+    int files = 0;
+    unsigned long records = 0, bad = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-r") == 0) {
+            raw = true;
+            continue;
+        }
+        if (std::strcmp(argv[i], "-d") == 0) {
+            force_delta = true;
+            continue;
+        }
+
+        std::ifstream in(argv[i], std::ios::binary);
+        if (!in) {
+            std::cerr << "bin2csv: cannot open " << argv[i] << "\n";
+            return 1;
+        }
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        ++files;
+
+        if (raw && files == 1)
+            std::printf("epoch,t100,press_pa,hum_x1024,voc,nox,flags\n");
+
+        auto print = [&](const Record &r) {
+            raw ? print_raw(r) : print_csv(r);
+            ++records;
+        };
+
+        if (force_delta || is_delta_name(argv[i])) {
+            DeltaDecoder decoder;
+            for (std::size_t sector = 0; sector < data.size(); sector += kSectorSize) {
+                std::size_t length = std::min(kSectorSize, data.size() - sector);
+                if (!decoder.sector(&data[sector], length, print))
+                    ++bad;
+            }
+            continue;
+        }
+
+        for (std::size_t sector = 0; sector < data.size(); sector += kSectorSize) {
+            for (std::size_t n = 0; n < kRecordsPerSector; ++n) {
+                std::size_t off = sector + n * kRecordSize;
+                if (off + kRecordSize > data.size())
+                    break;
+
+                const uint8_t *p = &data[off];
+                static const uint8_t kZero[kRecordSize] = {0};
+                if (std::memcmp(p, kZero, kRecordSize) == 0)
+                    continue;  // unused slot or sector padding
+
+                if (crc8(p, kRecordSize - 1) != p[kRecordSize - 1]) {
+                    ++bad;
+                    continue;
+                }
+
+                print(decode_fields(p, p[kRecordSize - 2]));
+            }
+        }
+    }
+
+    if (files == 0) {
+        std::cerr << "usage: bin2csv [-r] [-d] FILE.BIN [FILE.DLT ...]\n";
+        return 1;
+    }
+    std::cerr << "bin2csv: " << records << " records, " << bad << " with bad CRC (records or delta sectors)\n";
+    return bad ? 2 : 0;
+}
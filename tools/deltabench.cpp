@@ -0,0 +1,193 @@
+// Compression benchmark of the delta/varint record stream on captured CSV
+// traces (data1.csv, YYMMDDhh.CSV). Every line is converted to the record the
+// firmware would log in LOG_BINARY mode, encoded with lib/logger/log_delta.c
+// using the same sector packing as log_write_record(), decoded again with the
+// host decoder and compared. Prints sizes of the CSV, .BIN and .DLT forms and
+// the host encode time; the on-device encode cost is printed by
+// log_print_stats() ("REC enc=... cyc/rec").
+//
+// Build: cc -O2 -Ilib/logger -c lib/logger/log_delta.c -o /tmp/log_delta.o
+//        c++ -std=c++17 -O2 -Ilib/logger -o deltabench tools/deltabench.cpp /tmp/log_delta.o
+// Usage: deltabench [-o OUT.DLT] data1.csv [more.csv ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "log_format.hpp"
+
+extern "C" {
+#include "log_delta.h"
+
+// log_record.c uses avr-libc; the encoder only needs the CRC.
+uint8_t log_crc8(const uint8_t *data, uint16_t length) { return logfmt::crc8(data, length); }
+}
+
+namespace {
+
+using namespace logfmt;
+
+// Fixed-point field "12.34" or "-5.30" scaled by 100.
+bool parse_x100(const std::string &field, long &value)
+{
+    int whole = 0, frac = 0;
+    if (std::sscanf(field.c_str(), "%d.%d", &whole, &frac) != 2)
+        return false;
+    value = std::labs(whole) * 100L + frac;
+    if (field[0] == '-')
+        value = -value;
+    return true;
+}
+
+// One firmware CSV line: time,date,temp,press_hpa,hum,alt,voc,nox
+bool parse_line(const std::string &line, log_record &rec)
+{
+    std::vector<std::string> f;
+    std::size_t start = 0;
+    for (;;) {
+        std::size_t comma = line.find(',', start);
+        f.push_back(line.substr(start, comma - start));
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
+    }
+    if (f.size() != 8)
+        return false;
+
+    uint32_t t;
+    if (!csv_time(line.c_str(), t))
+        return false;
+
+    std::memset(&rec, 0, sizeof(rec));
+    rec.epoch = t;
+
+    long t100, press, hum;
+    if (f[2] == "ERR" || !parse_x100(f[2], t100) || !parse_x100(f[3], press) || !parse_x100(f[4], hum)) {
+        rec.flags |= kFlagBmeError;
+    } else {
+        rec.t100 = static_cast<int16_t>(t100);
+        rec.press_pa = static_cast<uint32_t>(press);
+        // The CSV keeps 0.01 %RH; this is the value that prints back the same.
+        rec.hum_x1024 = static_cast<uint32_t>((hum * 1024 + 50) / 100);
+    }
+
+    if (f[6] == "ERR") {
+        rec.flags |= kFlagSgpError;
+    } else {
+        rec.voc_index = static_cast<uint16_t>(std::atoi(f[6].c_str()));
+        rec.nox_index = static_cast<uint16_t>(std::atoi(f[7].c_str()));
+    }
+    return true;
+}
+
+Record to_host(const log_record &rec)
+{
+    Record r;
+    r.epoch = rec.epoch;
+    r.t100 = rec.t100;
+    r.press_pa = rec.press_pa;
+    r.hum_x1024 = rec.hum_x1024;
+    r.voc_index = rec.voc_index;
+    r.nox_index = rec.nox_index;
+    r.flags = rec.flags;
+    return r;
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    const char *out_name = nullptr;
+    std::vector<log_record> records;
+    unsigned long csv_bytes = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_name = argv[++i];
+            continue;
+        }
+        std::ifstream in(argv[i]);
+        if (!in) {
+            std::cerr << "deltabench: cannot open " << argv[i] << "\n";
+            return 1;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            log_record rec;
+            if (!parse_line(line, rec))
+                continue;
+            records.push_back(rec);
+            csv_bytes += line.size() + 1;
+        }
+    }
+    if (records.empty()) {
+        std::cerr << "usage: deltabench [-o OUT.DLT] data1.csv [more.csv ...]\n";
+        return 1;
+    }
+
+    // Pack exactly like log_write_record() in LOG_FORMAT_DELTA.
+    std::vector<uint8_t> stream;
+    unsigned long keyframes = 0;
+    log_delta state;
+    uint8_t encoded[LOG_DELTA_BUFFER_SIZE];
+    log_delta_reset(&state);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (const log_record &rec : records) {
+        std::size_t used = stream.size() % kSectorSize;
+        uint8_t length = log_delta_encode(&state, &rec, used == 0, encoded);
+        if (used + length > kSectorSize) {
+            stream.resize(stream.size() + kSectorSize - used, 0);
+            length = log_delta_encode(&state, &rec, 1, encoded);
+        }
+        if ((encoded[0] & ~kTagFlagsMask) == kTagKeyframe)
+            ++keyframes;
+        stream.insert(stream.end(), encoded, encoded + length);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    // Round trip through the streaming decoder.
+    std::vector<Record> decoded;
+    DeltaDecoder decoder;
+    unsigned long bad = 0;
+    for (std::size_t sector = 0; sector < stream.size(); sector += kSectorSize) {
+        std::size_t length = std::min(kSectorSize, stream.size() - sector);
+        if (!decoder.sector(&stream[sector], length, [&](const Record &r) { decoded.push_back(r); }))
+            ++bad;
+    }
+    bool mismatch = decoded.size() != records.size();
+    for (std::size_t i = 0; !mismatch && i < records.size(); ++i) {
+        if (!(decoded[i] == to_host(records[i]))) {
+            std::fprintf(stderr, "deltabench: record %zu differs after decoding\n", i);
+            mismatch = true;
+        }
+    }
+
+    if (out_name) {
+        std::ofstream out(out_name, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(stream.data()), static_cast<std::streamsize>(stream.size()));
+    }
+
+    const unsigned long n = static_cast<unsigned long>(records.size());
+    const unsigned long bin_bytes = (n / kRecordsPerSector) * kSectorSize + (n % kRecordsPerSector) * kRecordSize;
+    const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+
+    std::printf("records    %lu (%lu keyframes)\n", n, keyframes);
+    std::printf("csv        %lu B  %.2f B/rec\n", csv_bytes, double(csv_bytes) / n);
+    std::printf("bin        %lu B  %.2f B/rec  %.2fx vs csv\n", bin_bytes, double(bin_bytes) / n,
+                double(csv_bytes) / bin_bytes);
+    std::printf("delta      %zu B  %.2f B/rec  %.2fx vs csv  %.2fx vs bin\n", stream.size(),
+                double(stream.size()) / n, double(csv_bytes) / stream.size(), double(bin_bytes) / stream.size());
+    std::printf("encode     %.1f ns/rec on host\n", ns / n);
+    std::printf("round trip %s\n", (bad || mismatch) ? "FAILED" : "ok");
+    return (bad || mismatch) ? 2 : 0;
+}
@@ -0,0 +1,26 @@
+/* Host stand-in for <avr/eeprom.h>: EEMEM variables live in RAM, in their
+ * own section so sd_host_erase_eeprom() finds them. Writes are dropped after
+ * a simulated power cut (sd_host_cut). */
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM __attribute__((section("host_eeprom")))
+
+extern uint8_t host_power_lost;
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    if (!host_power_lost)
+        memcpy(dst, src, n);
+}
+
+#endif
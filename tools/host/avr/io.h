@@ -0,0 +1,9 @@
+/* Host stand-in for <avr/io.h>: only the registers the storage code reads. */
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+extern volatile uint16_t TCNT1; /* never advances on the host, latencies read 0 */
+
+#endif
@@ -0,0 +1,12 @@
+/* Host stand-in for <avr/pgmspace.h>: flash strings are ordinary strings. */
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const unsigned char *)(p))
+#define pgm_read_word(p) (*(const unsigned short *)(p))
+#define snprintf_P snprintf
+#define strncat_P strncat
+
+#endif
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Host build of the FAT32 stack and the logger over a card image file
+# (tools/host/fatbench.c, tools/host/powercut.c). sd_host.c stands in for lib/sd/SD_routines.c and
+# lib/SPI, the other headers here for avr-libc and the UART library.
+#
+# The library sources are compiled as they are: the on-disk FAT structures
+# use fixed-width packed types, so they map the same on the host as on AVR.
+#
+# Usage: tools/host/build.sh [OUT_DIR]   (default: $TMPDIR/datalogger-host, builds OUT_DIR/fatbench and OUT_DIR/powercut)
+set -e
+root=$(cd "$(dirname "$0")/../.." && pwd)
+out=${1:-${TMPDIR:-/tmp}/datalogger-host}
+
+mkdir -p "$out"
+for tool in fatbench powercut; do
+    ${CC:-cc} -O2 -fcommon -fno-strict-aliasing -Wall -Wextra -I"$root/tools/host" \
+        -I"$root/lib/FAT32" -I"$root/lib/sd" -I"$root/lib/SPI" -I"$root/lib/rtc" \
+        -I"$root/lib/uart" -I"$root/lib/logger" -I"$root/lib/epoch" \
+        -o "$out/$tool" "$root/tools/host/$tool.c" "$root/tools/host/sd_host.c" \
+        "$root/lib/FAT32/FAT32.c" "$root/lib/epoch/epoch.c" "$root"/lib/logger/*.c
+    echo "built $out/$tool"
+done
@@ -0,0 +1,174 @@
+/* Storage benchmark of the FAT32 stack and the logger on the host: appends
+ * CSV records like main.c (one every LOG_TIME_INTERVAL_SEC = 5 s, log_tick()
+ * every second, log_service() in the main loop) to DATA1.CSV on a FAT32
+ * card image through sd_host.c, and counts the block I/O of every call.
+ *
+ * Build: tools/host/build.sh            (writes $TMPDIR/datalogger-host/fatbench)
+ * Image: mkfs.fat -F 32 -s 8 -C card.img 1048576   (1 GB sparse, 4 KB clusters)
+ * Usage: fatbench [-n RECORDS] [-s STEP] [-r RESERVE_BYTES] card.img > io.csv
+ *        (defaults: 1000000 records, a line every 10000 records, no reserve)
+ * Plot:  gnuplot -p -e "set datafile separator ','; set key autotitle columnhead;
+ *        set xlabel 'file size [B]'; set ylabel 'per record';
+ *        plot for [c=3:5] 'io.csv' using 1:c with lines"
+ *
+ * stdout: file size, records and block reads / writes / commands per record
+ *         over the last STEP records (CSV).
+ * stderr: per call totals and the worst single call.
+ * Use a freshly formatted image: DATA1.CSV is appended to if it exists. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FAT32.h"
+#include "sd_routines.h"
+#include "rtc.h"
+#include "logger.h"
+#include "sd_host.h"
+
+#define INTERVAL_SEC 5
+
+enum { CALL_OPEN, CALL_WRITE, CALL_SERVICE, CALL_CLOSE, CALL_TYPES };
+
+static const char *const call_names[CALL_TYPES] = {"log_open", "log_write", "log_service", "log_close"};
+
+struct call_stats
+{
+    unsigned long calls;
+    unsigned long with_io;   /* calls that touched the card */
+    unsigned long reads, writes, commands;
+    unsigned long long bytes;
+    unsigned long max_blocks; /* most blocks moved by one call */
+};
+
+static struct call_stats stats[CALL_TYPES];
+static struct tm now;
+
+/* Called by FAT32.c for directory entry time stamps. */
+unsigned char getDateTime_FAT(void)
+{
+    dateFAT = ((now.tm_year - 80) << 9) | ((now.tm_mon + 1) << 5) | now.tm_mday;
+    timeFAT = (now.tm_hour << 11) | (now.tm_min << 5) | (now.tm_sec / 2);
+    return 0;
+}
+
+/* Run one logger call and charge its block I/O to TYPE. */
+static uint8_t measure(int type, uint8_t result, struct sd_host_io before)
+{
+    struct call_stats *s = &stats[type];
+    unsigned long reads = sd_host_io.reads - before.reads;
+    unsigned long writes = sd_host_io.writes - before.writes;
+
+    s->calls++;
+    s->reads += reads;
+    s->writes += writes;
+    s->commands += sd_host_io.commands - before.commands;
+    s->bytes += (sd_host_io.bytes_read - before.bytes_read) + (sd_host_io.bytes_written - before.bytes_written);
+    if (reads + writes || sd_host_io.commands != before.commands)
+        s->with_io++;
+    if (reads + writes > s->max_blocks)
+        s->max_blocks = reads + writes;
+    return result;
+}
+
+#define CALL(type, expr) (io = sd_host_io, measure((type), (expr), io))
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: fatbench [-n RECORDS] [-s STEP] [-r RESERVE_BYTES] card.img > io.csv\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long records = 1000000, step = 10000, reserve = 0, file_bytes = 0, i;
+    const char *path = NULL;
+    struct sd_host_io io, window;
+    time_t t;
+    char line[80];
+    int a, len;
+
+    for (a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-n") && a + 1 < argc)
+            records = strtoul(argv[++a], NULL, 0);
+        else if (!strcmp(argv[a], "-s") && a + 1 < argc)
+            step = strtoul(argv[++a], NULL, 0);
+        else if (!strcmp(argv[a], "-r") && a + 1 < argc)
+            reserve = strtoul(argv[++a], NULL, 0);
+        else if (argv[a][0] != '-' && !path)
+            path = argv[a];
+        else
+            usage();
+    }
+    if (!path || !step)
+        usage();
+
+    if (sd_host_open(path) || SD_init()) {
+        fprintf(stderr, "fatbench: cannot open %s\n", path);
+        return 1;
+    }
+    if (getBootSectorData()) {
+        fprintf(stderr, "fatbench: no FAT32 volume on %s\n", path);
+        return 1;
+    }
+
+    memset(&now, 0, sizeof(now));
+    now.tm_year = 2026 - 1900;
+    now.tm_mon = 9;
+    now.tm_mday = 16;
+    t = timegm(&now);
+
+    log_set_rotation(LOG_ROTATE_NONE, 0, 0);
+    if (CALL(CALL_OPEN, log_open("data1.csv", reserve))) {
+        fprintf(stderr, "fatbench: log_open failed\n");
+        return 1;
+    }
+
+    printf("file_bytes,records,reads_per_record,writes_per_record,commands_per_record\n");
+    window = sd_host_io;
+    for (i = 0; i < records; i++) {
+        for (a = 0; a < INTERVAL_SEC; a++)
+            log_tick();
+        t += INTERVAL_SEC;
+        gmtime_r(&t, &now);
+
+        /* same columns as data1.csv: time, date, T, p, RH, VOC raw, VOC index, NOx index */
+        len = snprintf(line, sizeof(line), "%02d:%02d:%02d,%02d/%02d/%04d,%d.%02lu,%lu.%02lu,%lu.%02lu,%lu.%02lu,%lu,%lu\n",
+                       now.tm_hour, now.tm_min, now.tm_sec, now.tm_mday, now.tm_mon + 1, now.tm_year + 1900,
+                       21, i % 100, 980 + i % 40, (i * 7) % 100, 40 + i % 20, (i * 3) % 100,
+                       200 + i % 50, (i * 11) % 100, 90 + i % 20, 1 + i % 3);
+        log_set_time(epoch_seconds(now.tm_year - 100, now.tm_mon + 1, now.tm_mday, now.tm_hour, now.tm_min, now.tm_sec));
+        if (CALL(CALL_WRITE, log_write((const uint8_t *)line, len))) {
+            fprintf(stderr, "fatbench: log_write failed at record %lu\n", i);
+            return 1;
+        }
+        file_bytes += len;
+        if (CALL(CALL_SERVICE, log_service())) {
+            fprintf(stderr, "fatbench: log_service failed at record %lu\n", i);
+            return 1;
+        }
+
+        if ((i + 1) % step == 0 || i + 1 == records) {
+            unsigned long n = (i + 1) % step ? (i + 1) % step : step;
+            printf("%lu,%lu,%.4f,%.4f,%.4f\n", file_bytes, i + 1,
+                   (double)(sd_host_io.reads - window.reads) / n,
+                   (double)(sd_host_io.writes - window.writes) / n,
+                   (double)(sd_host_io.commands - window.commands) / n);
+            window = sd_host_io;
+        }
+    }
+    if (CALL(CALL_CLOSE, log_close()))
+        fprintf(stderr, "fatbench: log_close failed\n");
+    sd_host_close();
+
+    fprintf(stderr, "%-12s %9s %9s %10s %10s %10s %12s %6s\n",
+            "call", "calls", "with I/O", "reads", "writes", "commands", "bytes", "max");
+    for (a = 0; a < CALL_TYPES; a++)
+        fprintf(stderr, "%-12s %9lu %9lu %10lu %10lu %10lu %12llu %6lu\n", call_names[a],
+                stats[a].calls, stats[a].with_io, stats[a].reads, stats[a].writes,
+                stats[a].commands, stats[a].bytes, stats[a].max_blocks);
+    fprintf(stderr, "total: %lu reads, %lu writes, %lu commands, %.3f blocks per record\n",
+            (unsigned long)sd_host_io.reads, (unsigned long)sd_host_io.writes,
+            (unsigned long)sd_host_io.commands,
+            records ? (double)(sd_host_io.reads + sd_host_io.writes) / records : 0.0);
+    return 0;
+}
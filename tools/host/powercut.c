@@ -0,0 +1,390 @@
+/* Power-cut test of the append journal on the host: runs the logger (and
+ * optionally a second file appended through appendData()) on a copy of a
+ * FAT32 card image, cuts the power after block write 1, 2, ... of the run,
+ * then mounts the copy like main.c does (getBootSectorData(), recoverJournal())
+ * and checks it without the FAT32 library:
+ *   - every file's cluster chain is as long as its size needs,
+ *   - no cluster is in two chains or allocated outside any chain (lost),
+ *   - each test file holds a prefix of its records that ends on a record,
+ *   - a second recoverJournal() finds nothing left to repair.
+ * Block writes are atomic; the EEPROM (FAT_EEPROM cursors) keeps what was
+ * written before the cut.
+ *
+ * Build: tools/host/build.sh            (writes $TMPDIR/datalogger-host/powercut)
+ * Image: mkfs.fat -F 32 -s 1 -C card.img 65536   (64 MB, 512 B clusters)
+ * Usage: powercut [-n RECORDS] [-r RESERVE_BYTES] [-a] [-s STEP] card.img work.img
+ *        (defaults: 300 records, no reserve, a cut after every write)
+ *        -a also appends every record to OTHER.CSV, synced every 10 records.
+ *
+ * stdout: a line per failed cut and a summary; exit status 1 if a cut failed.
+ * card.img is not modified, work.img is overwritten for every cut. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "FAT32.h"
+#include "sd_routines.h"
+#include "rtc.h"
+#include "logger.h"
+#include "sd_host.h"
+
+#define INTERVAL_SEC 5
+#define OTHER_SYNC   10
+#define TEST_FILES   2
+
+static const char *const file_names[TEST_FILES] = {"data1.csv", "other.csv"};
+static const char *const fat_names[TEST_FILES] = {"DATA1   CSV", "OTHER   CSV"};
+
+static unsigned char *base;
+static long base_size;
+static uint32_t *touched;         /* blocks written since the last restore() */
+static unsigned long touched_count;
+static unsigned char *is_touched;
+static char *expect[TEST_FILES];
+static unsigned long expect_length;
+
+/* Called by FAT32.c for directory entry time stamps. */
+unsigned char getDateTime_FAT(void)
+{
+    dateFAT = ((2026 - 1980) << 9) | (10 << 5) | 16;
+    timeFAT = 12 << 11;
+    return 0;
+}
+
+static int record(unsigned long i, char *line)
+{
+    return sprintf(line, "%lu,16/10/2026 %02lu:%02lu:%02lu,21.%02lu,1013.25,45.00\n",
+                   i, (i / 720) % 24, (i / 12) % 60, (i % 12) * INTERVAL_SEC, i % 100);
+}
+
+static void written(uint32_t block)
+{
+    if ((long)block < base_size / 512 && !is_touched[block]) {
+        is_touched[block] = 1;
+        touched[touched_count++] = block;
+    }
+}
+
+static void load_base(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+
+    if (!f || fseek(f, 0, SEEK_END) || (base_size = ftell(f)) <= 0) {
+        fprintf(stderr, "powercut: cannot read %s\n", path);
+        exit(1);
+    }
+    base = malloc(base_size);
+    rewind(f);
+    if (!base || fread(base, 1, base_size, f) != (size_t)base_size) {
+        fprintf(stderr, "powercut: cannot read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+
+    touched = malloc(base_size / 512 * sizeof(*touched));
+    is_touched = calloc(base_size / 512, 1);
+    if (!touched || !is_touched) {
+        fprintf(stderr, "powercut: out of memory\n");
+        exit(1);
+    }
+    sd_host_written = written;
+}
+
+/* Copy card.img to work.img, later only the blocks written since. */
+static void restore(const char *path)
+{
+    static int copied;
+    FILE *f = fopen(path, copied ? "r+b" : "wb");
+    uint32_t block;
+    int error = !f;
+
+    if (!copied && !error)
+        error = fwrite(base, 1, base_size, f) != (size_t)base_size;
+    while (!error && touched_count) {
+        block = touched[--touched_count];
+        is_touched[block] = 0;
+        error = fseek(f, (long)block * 512, SEEK_SET) || fwrite(base + (long)block * 512, 1, 512, f) != 512;
+    }
+    if (error || fclose(f)) {
+        fprintf(stderr, "powercut: cannot write %s\n", path);
+        exit(1);
+    }
+    copied = 1;
+}
+
+/* The workload; errors are ignored, after the cut the card takes no writes. */
+static void run(unsigned long records, unsigned long reserve, int other)
+{
+    struct appendHandle_Structure handle;
+    unsigned char name[13];
+    char line[80];
+    unsigned long i;
+    int a, len;
+
+    log_set_rotation(LOG_ROTATE_NONE, 0, 0);
+    log_open(file_names[0], reserve);
+    if (other) {
+        strcpy((char *)name, file_names[1]);
+        openAppendFile(&handle, name);
+    }
+
+    for (i = 0; i < records; i++) {
+        for (a = 0; a < INTERVAL_SEC; a++)
+            log_tick();
+        len = record(i, line);
+        log_write((const uint8_t *)line, len);
+        if (other) {
+            appendData(&handle, (const unsigned char *)line, len);
+            if (i % OTHER_SYNC == OTHER_SYNC - 1)
+                syncFile(&handle);
+        }
+        log_service();
+    }
+
+    log_close();
+    if (other)
+        closeAppendFile(&handle);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/* Check the image as found on the card; returns 0 or prints why not. */
+static int check(const char *path, unsigned long cut)
+{
+    FILE *f = fopen(path, "rb");
+    unsigned char sector[512], *fat = NULL, *owner = NULL;
+    uint32_t part = 0, spc, rsv, fatsz, root, clusters, first, c, n, links, need, size;
+    unsigned long lost = 0, i;
+    int bad = 0, k;
+
+#define SECTOR(s, buf) (fseek(f, (long)(s) * 512, SEEK_SET) || fread((buf), 1, 512, f) != 512)
+#define FAIL(...) do { printf("cut %lu: ", cut); printf(__VA_ARGS__); printf("\n"); bad = 1; } while (0)
+
+    if (!f || SECTOR(0, sector)) {
+        FAIL("cannot read %s", path);
+        goto out;
+    }
+    if (sector[0] != 0xeb && sector[0] != 0xe9) {
+        part = get32(&sector[446 + 8]);
+        if (SECTOR(part, sector)) {
+            FAIL("no boot sector");
+            goto out;
+        }
+    }
+    spc = sector[13];
+    rsv = get16(&sector[14]);
+    fatsz = get32(&sector[36]);
+    root = get32(&sector[44]);
+    first = part + rsv + sector[16] * fatsz;
+    clusters = (get32(&sector[32]) - rsv - sector[16] * fatsz) / spc;
+
+    fat = malloc((size_t)fatsz * 512);
+    owner = calloc(clusters + 2, 1);
+    if (!fat || !owner) {
+        FAIL("out of memory");
+        goto out;
+    }
+    for (i = 0; i < fatsz; i++)
+        if (SECTOR(part + rsv + i, fat + i * 512)) {
+            FAIL("cannot read the FAT");
+            goto out;
+        }
+
+#define NEXT(c) (get32(&fat[(c) * 4]) & 0x0fffffff)
+#define IN_CHAIN(c) ((c) >= 2 && (c) < clusters + 2)
+
+    /* root directory chain, then the files of its entries */
+    for (c = root; IN_CHAIN(c); c = NEXT(c)) {
+        if (owner[c]) {
+            FAIL("root directory chain loops");
+            goto out;
+        }
+        owner[c] = 1;
+    }
+    for (c = root; IN_CHAIN(c); c = NEXT(c)) {
+        for (i = 0; i < spc; i++) {
+            unsigned char dir[512];
+            unsigned int e;
+
+            if (SECTOR(first + (c - 2) * spc + i, dir)) {
+                FAIL("cannot read the root directory");
+                goto out;
+            }
+            for (e = 0; e < 512; e += 32) {
+                unsigned char *entry = &dir[e];
+                uint32_t file;
+                unsigned long got = 0;
+
+                if (entry[0] == 0)
+                    goto done;
+                if (entry[0] == 0xe5 || entry[11] == 0x0f || (entry[11] & 0x08))
+                    continue;
+                file = ((uint32_t)get16(&entry[20]) << 16) | get16(&entry[26]);
+                size = get32(&entry[28]);
+                links = 0;
+                for (n = file; IN_CHAIN(n); n = NEXT(n)) {
+                    if (owner[n]) {
+                        FAIL("%.11s: cluster %lu is in two chains", entry, (unsigned long)n);
+                        goto out;
+                    }
+                    owner[n] = 1;
+                    links++;
+                }
+                need = (size + spc * 512 - 1) / (spc * 512);
+                if (links != need && !(size == 0 && links == 1))
+                    FAIL("%.11s: size %lu needs %lu clusters, chain has %lu", entry,
+                         (unsigned long)size, (unsigned long)need, (unsigned long)links);
+
+                for (k = 0; k < TEST_FILES && memcmp(entry, fat_names[k], 11); k++)
+                    ;
+                if (k == TEST_FILES || entry[11] & 0x10)
+                    continue;
+
+                /* the test file: a record prefix of what was written */
+                if (size > expect_length) {
+                    FAIL("%.11s: size %lu beyond the %lu bytes written", entry, (unsigned long)size, expect_length);
+                    continue;
+                }
+                for (n = file; got < size; n = NEXT(n)) {
+                    unsigned int s;
+
+                    for (s = 0; s < spc && got < size; s++) {
+                        unsigned int part_len = size - got < 512 ? size - got : 512;
+
+                        if (SECTOR(first + (n - 2) * spc + s, sector)) {
+                            FAIL("cannot read %.11s", entry);
+                            goto out;
+                        }
+                        if (memcmp(sector, expect[k] + got, part_len)) {
+                            FAIL("%.11s: data differs in bytes %lu-%lu", entry, got, got + part_len - 1);
+                            got = size;
+                            break;
+                        }
+                        got += part_len;
+                    }
+                }
+                if (size && expect[k][size - 1] != '\n')
+                    FAIL("%.11s: size %lu ends inside a record", entry, (unsigned long)size);
+            }
+        }
+    }
+done:
+    for (c = 2; c < clusters + 2; c++)
+        if (NEXT(c) && !owner[c])
+            lost++;
+    if (lost)
+        FAIL("%lu lost clusters", lost);
+
+out:
+    if (f)
+        fclose(f);
+    free(fat);
+    free(owner);
+    return bad;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: powercut [-n RECORDS] [-r RESERVE_BYTES] [-a] [-s STEP] card.img work.img\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long records = 300, reserve = 0, step = 1, total, cut, failed = 0, repaired = 0, i;
+    const char *card = NULL, *work = NULL;
+    unsigned char result;
+    char line[80];
+    int a, len, other = 0;
+
+    for (a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-n") && a + 1 < argc)
+            records = strtoul(argv[++a], NULL, 0);
+        else if (!strcmp(argv[a], "-r") && a + 1 < argc)
+            reserve = strtoul(argv[++a], NULL, 0);
+        else if (!strcmp(argv[a], "-s") && a + 1 < argc)
+            step = strtoul(argv[++a], NULL, 0);
+        else if (!strcmp(argv[a], "-a"))
+            other = 1;
+        else if (argv[a][0] != '-' && !card)
+            card = argv[a];
+        else if (argv[a][0] != '-' && !work)
+            work = argv[a];
+        else
+            usage();
+    }
+    if (!card || !work || !step)
+        usage();
+
+    for (a = 0; a < TEST_FILES; a++) {
+        expect[a] = malloc(records * sizeof(line));
+        if (!expect[a])
+            return 1;
+    }
+    for (i = 0; i < records; i++) {
+        len = record(i, line);
+        memcpy(expect[0] + expect_length, line, len);
+        memcpy(expect[1] + expect_length, line, len);
+        expect_length += len;
+    }
+    load_base(card);
+
+    /* uncut run: number of block writes, and the image must check clean */
+    restore(work);
+    sd_host_erase_eeprom();
+    sd_host_cut(0);
+    if (sd_host_open(work) || SD_init() || getBootSectorData() || recoverJournal()) {
+        fprintf(stderr, "powercut: %s is not a clean FAT32 volume\n", card);
+        return 1;
+    }
+    total = sd_host_io.writes;
+    run(records, reserve, other);
+    total = sd_host_io.writes - total;
+    sd_host_close();
+    if (check(work, 0))
+        return 1;
+
+    for (cut = 1; cut <= total; cut += step) {
+        restore(work);
+        sd_host_erase_eeprom();
+        sd_host_open(work);
+        SD_init();
+        getBootSectorData();
+
+        sd_host_cut(cut);
+        run(records, reserve, other);
+        sd_host_cut(0);
+
+        /* power back: mount and repair like main.c */
+        result = getBootSectorData() ? 0xff : recoverJournal();
+        if (result == 0xff) {
+            printf("cut %lu: mount or recovery failed\n", cut);
+            failed++;
+            sd_host_close();
+            continue;
+        }
+        if (result)
+            repaired++;
+        result = recoverJournal();
+        sd_host_close();
+
+        a = check(work, cut);
+        if (result) {
+            printf("cut %lu: second recovery repaired %u files\n", cut, result);
+            a = 1;
+        }
+        failed += a;
+    }
+
+    printf("%lu records, %lu block writes, %lu cuts: %lu repaired, %lu failed\n",
+           records, total, (total + step - 1) / step, repaired, failed);
+    return failed != 0;
+}
@@ -0,0 +1,192 @@
+/* Host stand-in for lib/sd/SD_routines.c: block n of the card is the 512
+ * bytes at offset n * 512 of an image file (a whole-disk image with an MBR
+ * or a bare FAT32 volume, see getBootSectorData()). The open multiple block
+ * transfers of SD_writeStreamBlock() and SD_readStream() are tracked like
+ * on the card, so sd_host_io counts the commands the firmware would send. */
+#include <stdio.h>
+#include <string.h>
+#include "sd_routines.h"
+#include "sd_host.h"
+#include "uart.h"
+
+volatile uint16_t TCNT1;
+struct sd_host_io sd_host_io;
+uint8_t host_power_lost;
+void (*sd_host_written)(uint32_t block);
+
+/* Bounds of the EEMEM variables (avr/eeprom.h), set by the linker */
+extern char __start_host_eeprom[] __attribute__((weak));
+extern char __stop_host_eeprom[] __attribute__((weak));
+
+static FILE *image;
+static uint32_t stream_next;      /* block expected by the open write stream (0 - none) */
+static uint32_t read_block;       /* block of the open read stream (0 - none) */
+static uint16_t read_offset;      /* next byte the read stream delivers */
+static unsigned char read_data[512];
+static uint32_t writes_left;      /* block writes before the power cut (0 - no cut) */
+
+int sd_host_open(const char *path)
+{
+    image = fopen(path, "r+b");
+    return image == NULL;
+}
+
+void sd_host_close(void)
+{
+    if (image)
+        fclose(image);
+    image = NULL;
+}
+
+void sd_host_cut(uint32_t writes)
+{
+    writes_left = writes;
+    host_power_lost = 0;
+}
+
+void sd_host_erase_eeprom(void)
+{
+    if (__start_host_eeprom)
+        memset(__start_host_eeprom, 0xff, __stop_host_eeprom - __start_host_eeprom);
+}
+
+static unsigned char load(uint32_t block, unsigned char *data)
+{
+    sd_host_io.reads++;
+    blockReadCount++;
+    if (fseek(image, (long)block * 512, SEEK_SET) || fread(data, 1, 512, image) != 512)
+        memset(data, 0, 512); /* past the end of a sparse image */
+    return 0;
+}
+
+static unsigned char store(uint32_t block, const unsigned char *data)
+{
+    sd_host_io.writes++;
+    sd_host_io.bytes_written += 512;
+    blockWriteCount++;
+    if (host_power_lost)
+        return 0; /* the firmware does not notice, nothing reaches the card */
+    if (writes_left && !--writes_left)
+        host_power_lost = 1;
+    if (sd_host_written)
+        sd_host_written(block);
+    if (fseek(image, (long)block * 512, SEEK_SET) || fwrite(data, 1, 512, image) != 512)
+        return 1;
+    return 0;
+}
+
+unsigned char SD_init(void)
+{
+    if (!image)
+        return 1;
+    SDHC_flag = 1;
+    cardType = 2;
+    return 0;
+}
+
+unsigned char SD_sendCommand(unsigned char cmd, unsigned long arg)
+{
+    (void)cmd;
+    (void)arg;
+    SD_stopStream(); /* any command ends an open transfer */
+    sd_host_io.commands++;
+    return 0;
+}
+
+unsigned char SD_readBlock(unsigned long startBlock, unsigned char *data)
+{
+    SD_sendCommand(READ_SINGLE_BLOCK, startBlock);
+    sd_host_io.bytes_read += 512;
+    return load(startBlock, data);
+}
+
+unsigned char SD_readSingleBlock(unsigned long startBlock)
+{
+    return SD_readBlock(startBlock, (unsigned char *)buffer);
+}
+
+unsigned char SD_writeBlock(unsigned long startBlock, const unsigned char *data)
+{
+    SD_sendCommand(WRITE_SINGLE_BLOCK, startBlock);
+    return store(startBlock, data);
+}
+
+unsigned char SD_writeSingleBlock(unsigned long startBlock)
+{
+    return SD_writeBlock(startBlock, (const unsigned char *)buffer);
+}
+
+unsigned char SD_writeStreamBlock(unsigned long startBlock)
+{
+    if (startBlock != stream_next) {
+        SD_sendCommand(WRITE_MULTIPLE_BLOCKS, startBlock);
+        streamStartCount++;
+    }
+    stream_next = startBlock + 1;
+    return store(startBlock, (const unsigned char *)buffer);
+}
+
+unsigned char SD_readStream(unsigned long startBlock, unsigned int offset, unsigned char *data, unsigned int length)
+{
+    if (offset + length > 512)
+        return 1;
+
+    /* same rule as the card driver: continue forward in this or the next block */
+    if (!read_block ||
+        ((startBlock != read_block || offset < read_offset) && startBlock != read_block + 1)) {
+        SD_sendCommand(READ_MULTIPLE_BLOCKS, startBlock);
+        readStreamStartCount++;
+        read_block = startBlock;
+        read_offset = 0;
+    }
+    if (startBlock != read_block) { /* rest of the current block is clocked over */
+        if (!read_offset)
+            load(read_block, read_data);
+        sd_host_io.bytes_read += 512 - read_offset;
+        read_block = startBlock;
+        read_offset = 0;
+    }
+
+    if (!read_offset)
+        load(read_block, read_data);
+    sd_host_io.bytes_read += offset + length - read_offset;
+    memcpy(data, read_data + offset, length);
+    read_offset = offset + length;
+    if (read_offset == 512) {
+        read_block++;
+        read_offset = 0;
+    }
+    return 0;
+}
+
+unsigned char SD_stopStream(void)
+{
+    if (read_block) { /* CMD12 */
+        read_block = 0;
+        sd_host_io.commands++;
+    } else if (stream_next) { /* stop transmission token */
+        stream_next = 0;
+        sd_host_io.commands++;
+    }
+    return 0;
+}
+
+unsigned char SD_poll(void)
+{
+    return 0; /* the image is never busy */
+}
+
+unsigned char SD_waitReady(void)
+{
+    return 0;
+}
+
+void host_uart_putc(unsigned char c)
+{
+    fputc(c, stderr);
+}
+
+void host_uart_puts(const char *s)
+{
+    fputs(s, stderr);
+}
@@ -0,0 +1,36 @@
+/* Host block device for the FAT32 stack: the SD_* block functions of
+ * lib/sd/sd_routines.h backed by a card image file (sd_host.c). */
+#ifndef SD_HOST_H
+#define SD_HOST_H
+
+#include <stdint.h>
+
+/* Traffic the SPI driver would have had on a real card. */
+struct sd_host_io
+{
+    uint32_t reads;         /* 512-byte blocks read */
+    uint32_t writes;        /* 512-byte blocks written */
+    uint32_t commands;      /* commands sent (CMD17/18/24/25, CMD12 and the stop token) */
+    uint64_t bytes_read;    /* data bytes clocked out of the card */
+    uint64_t bytes_written; /* data bytes clocked into the card */
+};
+
+extern struct sd_host_io sd_host_io;
+
+/* Open the image used as card; returns 0 on success. */
+int sd_host_open(const char *path);
+
+/* Write back and close the image. */
+void sd_host_close(void);
+
+/* Power cut (powercut.c): after WRITES more block writes the image and the
+ * EEPROM take no more writes until sd_host_cut(0); 0 - power stays on. */
+void sd_host_cut(uint32_t writes);
+
+/* Called with every block that reaches the image (0 - none). */
+extern void (*sd_host_written)(uint32_t block);
+
+/* Erase the EEMEM variables (0xff) like a new chip. */
+void sd_host_erase_eeprom(void);
+
+#endif
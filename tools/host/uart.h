@@ -0,0 +1,14 @@
+/* Host stand-in for Peter Fleury's <uart.h>: console output goes to stderr
+ * (sd_host.c). No <stdio.h> here, its EOF would replace the one of FAT32.h. */
+#ifndef HOST_UART_H
+#define HOST_UART_H
+
+void host_uart_putc(unsigned char c);
+void host_uart_puts(const char *s);
+
+#define uart_putc(c) host_uart_putc(c)
+#define uart_puts(s) host_uart_puts((const char *)(s))
+#define uart_puts_p(s) host_uart_puts((const char *)(s))
+#define uart_puts_P(s) host_uart_puts(s)
+
+#endif
@@ -0,0 +1,8 @@
+/* Host stand-in for <util/atomic.h>: no interrupts on the host. */
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (int atomic_once_ = 1; atomic_once_; atomic_once_ = 0)
+
+#endif
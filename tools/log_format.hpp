@@ -0,0 +1,239 @@
+// Host-side helpers shared by the log tools: record layout of
+// lib/logger/log_record.h, CRC-8, calendar conversion, CSV input and output
+// and the streaming decoder of the delta/varint format of
+// lib/logger/log_delta.h.
+
+#ifndef TOOLS_LOG_FORMAT_HPP
+#define TOOLS_LOG_FORMAT_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace logfmt {
+
+constexpr std::size_t kSectorSize = 512;
+constexpr std::size_t kRecordSize = 20;
+constexpr std::size_t kRecordsPerSector = kSectorSize / kRecordSize;
+constexpr std::size_t kKeyframeSize = 20;
+
+constexpr uint8_t kFlagBmeError = 0x02;
+constexpr uint8_t kFlagSgpError = 0x04;
+
+constexpr uint8_t kTagPad = 0x00;
+constexpr uint8_t kTagKeyframe = 0x40;
+constexpr uint8_t kTagDelta = 0x80;
+constexpr uint8_t kTagFlagsMask = 0x3F;
+
+struct Record {
+    uint32_t epoch = 0;
+    int16_t t100 = 0;
+    uint32_t press_pa = 0;
+    uint32_t hum_x1024 = 0;
+    uint16_t voc_index = 0;
+    uint16_t nox_index = 0;
+    uint8_t flags = 0;
+};
+
+inline bool operator==(const Record &a, const Record &b)
+{
+    return a.epoch == b.epoch && a.t100 == b.t100 && a.press_pa == b.press_pa &&
+           a.hum_x1024 == b.hum_x1024 && a.voc_index == b.voc_index &&
+           a.nox_index == b.nox_index && a.flags == b.flags;
+}
+
+inline uint16_t le16(const uint8_t *p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+
+inline uint32_t le32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Same as avr-libc _crc8_ccitt_update(): polynomial 0x07, initial value 0.
+inline uint8_t crc8(const uint8_t *data, std::size_t length)
+{
+    uint8_t crc = 0;
+    while (length--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i)
+            crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+    }
+    return crc;
+}
+
+// Fields at offsets 0-17 of struct log_record (also the keyframe payload).
+inline Record decode_fields(const uint8_t *p, uint8_t flags)
+{
+    Record r;
+    r.epoch = le32(p + 0);
+    r.t100 = static_cast<int16_t>(le16(p + 4));
+    r.press_pa = le32(p + 6);
+    r.hum_x1024 = le32(p + 10);
+    r.voc_index = le16(p + 14);
+    r.nox_index = le16(p + 16);
+    r.flags = flags;
+    return r;
+}
+
+// Same as epoch_seconds() in lib/epoch/epoch.c (year 0-99 = 2000-2099).
+inline uint32_t epoch(int year, int month, int day, int hour, int minute, int second)
+{
+    static const int kBefore[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+    uint32_t days = 365u * year + (year + 3) / 4 + kBefore[month - 1] + day - 1;
+    if (month > 2 && year % 4 == 0)
+        ++days;
+    return (days * 24u + hour) * 3600u + minute * 60u + second;
+}
+
+// Time of a firmware CSV line "hh:mm:ss,dd/mm/20yy,...".
+inline bool csv_time(const char *line, uint32_t &t)
+{
+    int hh, mm, ss, day, month, year;
+    if (std::sscanf(line, "%d:%d:%d,%d/%d/20%d", &hh, &mm, &ss, &day, &month, &year) != 6 || month < 1 ||
+        month > 12)
+        return false;
+    t = epoch(year, month, day, hh, mm, ss);
+    return true;
+}
+
+// Inverse of epoch_seconds(): seconds since 2000-01-01 to calendar time.
+inline void calendar(uint32_t epoch, int &year, int &month, int &day, int &hour, int &minute, int &second)
+{
+    static const int kDays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    uint32_t days = epoch / 86400;
+    uint32_t rest = epoch % 86400;
+
+    hour = static_cast<int>(rest / 3600);
+    minute = static_cast<int>((rest / 60) % 60);
+    second = static_cast<int>(rest % 60);
+
+    year = 0;
+    for (;;) {
+        uint32_t len = (year % 4 == 0) ? 366 : 365;
+        if (days < len)
+            break;
+        days -= len;
+        ++year;
+    }
+    month = 0;
+    for (;;) {
+        uint32_t len = kDays[month] + ((month == 1 && year % 4 == 0) ? 1 : 0);
+        if (days < len)
+            break;
+        days -= len;
+        ++month;
+    }
+    ++month;
+    day = static_cast<int>(days) + 1;
+}
+
+// Same line as the firmware writes in CSV mode.
+inline void print_csv(const Record &r)
+{
+    int year, month, day, hour, minute, second;
+    calendar(r.epoch, year, month, day, hour, minute, second);
+    std::printf("%02d:%02d:%02d,%02d/%02d/20%02d,", hour, minute, second, day, month, year);
+
+    if (r.flags & kFlagBmeError) {
+        std::printf("ERR,ERR,ERR,ERR,");
+    } else {
+        long t_int = r.t100 / 100;
+        long t_frac = (r.t100 >= 0) ? (r.t100 % 100) : ((-r.t100) % 100);
+        unsigned long hum_x100 = (static_cast<unsigned long>(r.hum_x1024) * 100 + 512) / 1024;
+        double alt = 44330.0 * (1.0 - std::pow(r.press_pa / 101325.0, 0.19029495718363465));
+        long alt_int = static_cast<long>(alt);
+        long alt_frac = static_cast<long>(std::fabs(alt - alt_int) * 100.0 + 0.5);
+        std::printf("%02ld.%02ld,%03lu.%02lu,%02lu.%02lu,%03ld.%02ld,", t_int, t_frac,
+                    static_cast<unsigned long>(r.press_pa / 100), static_cast<unsigned long>(r.press_pa % 100),
+                    hum_x100 / 100, hum_x100 % 100, alt_int, alt_frac);
+    }
+
+    if (r.flags & kFlagSgpError)
+        std::printf("ERR,ERR\n");
+    else
+        std::printf("%u,%u\n", r.voc_index, r.nox_index);
+}
+
+inline void print_raw(const Record &r)
+{
+    std::printf("%lu,%d,%lu,%lu,%u,%u,%u\n", static_cast<unsigned long>(r.epoch), r.t100,
+                static_cast<unsigned long>(r.press_pa), static_cast<unsigned long>(r.hum_x1024),
+                r.voc_index, r.nox_index, r.flags);
+}
+
+// Streaming decoder of a delta/varint file: feed it one 512-byte sector at a
+// time (the last one may be short). Every sector starts with a keyframe, so a
+// corrupted sector only loses its own records.
+class DeltaDecoder {
+public:
+    // Calls emit(const Record &) for every record; returns false if the
+    // sector held a corrupted record (the rest of the sector is skipped).
+    template <typename Emit>
+    bool sector(const uint8_t *data, std::size_t length, Emit emit)
+    {
+        bool have_prev = false;
+        std::size_t pos = 0;
+
+        while (pos < length && data[pos] != kTagPad) {
+            const std::size_t start = pos;
+            const uint8_t tag = data[pos++];
+            Record r;
+
+            if ((tag & ~kTagFlagsMask) == kTagKeyframe) {
+                if (pos + kKeyframeSize - 1 > length)
+                    return false;
+                r = decode_fields(&data[pos], tag & kTagFlagsMask);
+                pos += kKeyframeSize - 2;
+            } else if ((tag & ~kTagFlagsMask) == kTagDelta && have_prev) {
+                int32_t d[6];
+                for (int32_t &v : d) {
+                    if (!varint(data, length, pos, v))
+                        return false;
+                }
+                r.epoch = prev_.epoch + static_cast<uint32_t>(d[0]);
+                r.t100 = static_cast<int16_t>(prev_.t100 + d[1]);
+                r.press_pa = prev_.press_pa + static_cast<uint32_t>(d[2]);
+                r.hum_x1024 = prev_.hum_x1024 + static_cast<uint32_t>(d[3]);
+                r.voc_index = static_cast<uint16_t>(prev_.voc_index + d[4]);
+                r.nox_index = static_cast<uint16_t>(prev_.nox_index + d[5]);
+                r.flags = tag & kTagFlagsMask;
+            } else {
+                return false;
+            }
+
+            if (pos >= length || crc8(&data[start], pos - start) != data[pos])
+                return false;
+            ++pos;
+
+            prev_ = r;
+            have_prev = true;
+            emit(r);
+        }
+        return true;
+    }
+
+private:
+    static bool varint(const uint8_t *data, std::size_t length, std::size_t &pos, int32_t &value)
+    {
+        uint32_t zz = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (pos >= length)
+                return false;
+            const uint8_t b = data[pos++];
+            zz |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                value = static_cast<int32_t>((zz >> 1) ^ (0u - (zz & 1)));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Record prev_;
+};
+
+}  // namespace logfmt
+
+#endif  // TOOLS_LOG_FORMAT_HPP
@@ -0,0 +1,216 @@
+// Host-side time-range query for log files copied from the card. Looks up the
+// start time in the sidecar index (YYMMDDhh.IDX, .Inn, lib/logger/logger.h)
+// by binary search if its header names the format of FILE, starts reading the data file at the indexed offset and
+// prints the records from FROM up to (not including) TO. CSV files are
+// printed as they are, .BIN/.DLT files are decoded like bin2csv does.
+//
+// Build: g++ -std=c++17 -O2 -o logquery tools/logquery.cpp
+// Usage: logquery [-r] [-n] [-f FROM] [-t TO] FILE > out.csv
+//        FROM, TO  "YYYY-MM-DD[ hh[:mm[:ss]]]" (default: whole file)
+//        -r  raw columns for binary files: epoch,t100,press_pa,hum_x1024,voc,nox,flags
+//        -n  ignore the index (linear scan, for comparison)
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "log_format.hpp"
+
+namespace {
+
+using namespace logfmt;
+
+enum class Format { Csv, Bin, Delta };
+
+bool load(const std::string &path, std::vector<uint8_t> &data)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Data file extension CSV/BIN/DLT or its continuation Cnn/Bnn/Dnn.
+Format format_of(const std::string &path)
+{
+    std::size_t dot = path.rfind('.');
+    char kind = dot == std::string::npos ? 'C' : static_cast<char>(std::toupper(static_cast<unsigned char>(path[dot + 1])));
+    return kind == 'B' ? Format::Bin : kind == 'D' ? Format::Delta : Format::Csv;
+}
+
+// Same rule as log_index_name() in lib/logger/logger.c; the case of the
+// extension follows the data file (a copy may have been renamed to lower case).
+std::string index_name(const std::string &path)
+{
+    std::size_t dot = path.rfind('.');
+    std::size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + ".IDX";
+
+    std::string ext = path.substr(dot + 1);
+    bool lower = !ext.empty() && std::islower(static_cast<unsigned char>(ext[0]));
+    std::string index = "IDX";
+    if (ext.size() == 3 && std::isdigit(static_cast<unsigned char>(ext[1])) &&
+        std::isdigit(static_cast<unsigned char>(ext[2])))
+        index = std::string("I") + ext.substr(1);
+    if (lower)
+        for (char &c : index)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return path.substr(0, dot + 1) + index;
+}
+
+// "2026-10-16", "2026-10-16 12", "2026-10-16 12:30" or "2026-10-16 12:30:15".
+bool parse_when(const char *text, uint32_t &t)
+{
+    int year, month, day, hour = 0, minute = 0, second = 0;
+    int n = std::sscanf(text, "%d-%d-%d%*[ T]%d:%d:%d", &year, &month, &day, &hour, &minute, &second);
+    if (n < 3 || year < 2000 || year > 2099 || month < 1 || month > 12 || day < 1 || day > 31)
+        return false;
+    t = epoch(year - 2000, month, day, hour, minute, second);
+    return true;
+}
+
+// Header entry of an index of this format: epoch 0 and LOG_INDEX_HEADER(format)
+// of lib/logger/logger.h. CSV, BIN and DLT files of a period share the index name.
+bool index_valid(const std::vector<uint8_t> &index, Format format)
+{
+    const uint32_t tag = 0x58444900u | (format == Format::Bin ? 1u : format == Format::Delta ? 2u : 0u);
+    return index.size() >= 8 && le32(&index[0]) == 0 && le32(&index[4]) == tag;
+}
+
+// Offset of the last index entry older than t that points inside the data
+// (0 without one); the same search as log_seek_time() on the device.
+uint32_t index_lookup(const std::vector<uint8_t> &index, uint32_t t, std::size_t data_size, unsigned &probes)
+{
+    std::size_t low = 1, high = index.size() / 8;  // entry 0 is the header
+    uint32_t offset = 0;
+    while (low < high) {
+        std::size_t mid = low + (high - low) / 2;
+        const uint32_t entry_time = le32(&index[mid * 8]);
+        const uint32_t entry_offset = le32(&index[mid * 8 + 4]);
+        ++probes;
+        if (entry_time < t && entry_offset <= data_size) {
+            offset = entry_offset;
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return offset;
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    bool raw = false, use_index = true;
+    uint32_t from = 0, to = UINT32_MAX;
+    const char *file = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-r") == 0)
+            raw = true;
+        else if (std::strcmp(argv[i], "-n") == 0)
+            use_index = false;
+        else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc && parse_when(argv[i + 1], from))
+            ++i;
+        else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc && parse_when(argv[i + 1], to))
+            ++i;
+        else if (argv[i][0] != '-')
+            file = argv[i];
+        else
+            file = nullptr, i = argc;
+    }
+    if (!file) {
+        std::cerr << "usage: logquery [-r] [-n] [-f YYYY-MM-DD[ hh[:mm[:ss]]]] [-t ...] FILE\n";
+        return 1;
+    }
+
+    std::vector<uint8_t> data, index;
+    if (!load(file, data)) {
+        std::cerr << "logquery: cannot open " << file << "\n";
+        return 1;
+    }
+    const Format format = format_of(file);
+    const std::string index_path = index_name(file);
+    const bool have_index = use_index && load(index_path, index) && index_valid(index, format);
+
+    unsigned probes = 0;
+    std::size_t start = have_index ? index_lookup(index, from, data.size(), probes) : 0;
+    unsigned long printed = 0, bad = 0;
+    bool done = false;
+
+    auto emit = [&](const Record &r) {
+        if (done || r.epoch < from)
+            return;
+        if (r.epoch >= to) {
+            done = true;
+            return;
+        }
+        raw ? print_raw(r) : print_csv(r);
+        ++printed;
+    };
+
+    if (raw && format != Format::Csv)
+        std::printf("epoch,t100,press_pa,hum_x1024,voc,nox,flags\n");
+
+    if (format == Format::Csv) {
+        std::size_t pos = start;
+        while (pos < data.size() && !done) {
+            std::size_t end = pos;
+            while (end < data.size() && data[end] != '\n')
+                ++end;
+            std::string line(data.begin() + pos, data.begin() + end);
+            uint32_t t;
+            if (csv_time(line.c_str(), t) && t >= from) {
+                if (t >= to)
+                    done = true;
+                else {
+                    std::printf("%s\n", line.c_str());
+                    ++printed;
+                }
+            }
+            pos = end + 1;
+        }
+    } else if (format == Format::Bin) {
+        for (std::size_t pos = start; pos + kRecordSize <= data.size() && !done; pos += kRecordSize) {
+            if ((pos % kSectorSize) / kRecordSize >= kRecordsPerSector) {
+                pos = (pos / kSectorSize + 1) * kSectorSize - kRecordSize;  // skip the sector padding
+                continue;
+            }
+            const uint8_t *p = &data[pos];
+            static const uint8_t kZero[kRecordSize] = {0};
+            if (std::memcmp(p, kZero, kRecordSize) == 0)
+                continue;
+            if (crc8(p, kRecordSize - 1) != p[kRecordSize - 1]) {
+                ++bad;
+                continue;
+            }
+            emit(decode_fields(p, p[kRecordSize - 2]));
+        }
+    } else {
+        // Every sector starts with a keyframe, so decoding starts at the sector of the entry.
+        DeltaDecoder decoder;
+        for (std::size_t sector = start / kSectorSize * kSectorSize; sector < data.size() && !done;
+             sector += kSectorSize) {
+            if (!decoder.sector(&data[sector], std::min(kSectorSize, data.size() - sector), emit))
+                ++bad;
+        }
+    }
+
+    std::fprintf(stderr, "logquery: ");
+    if (have_index)
+        std::fprintf(stderr, "%zu index entries, %u probes, ", index.size() / 8 - 1, probes);
+    else
+        std::fprintf(stderr, "no usable index (%s), ", use_index ? index_path.c_str() : "-n");
+    std::fprintf(stderr, "start at %zu of %zu bytes, %lu records, %lu bad\n", start, data.size(), printed, bad);
+    return bad ? 2 : 0;
+}
@@ -0,0 +1,226 @@
+// Host-side extractor for the raw-sector ring log (lib/ringlog/ringlog.h).
+// Reads the ring either from a copy of RING.DAT or directly from a card image
+// (the file is looked up in the root directory of the FAT32 volume), orders
+// the valid blocks by sequence number and writes their records to stdout.
+//
+// Build: g++ -std=c++17 -O2 -o ringdump tools/ringdump.cpp
+// Usage: ringdump [-v] RING.DAT > log.csv
+//        ringdump [-v] -i card.img [-f RING.DAT] > log.csv
+//        -v  list the blocks on stderr
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t kSectorSize = 512;
+constexpr std::size_t kHeaderSize = 10;
+constexpr std::size_t kPayloadSize = kSectorSize - kHeaderSize;
+constexpr uint16_t kMagic = 0x4752;
+
+uint16_t le16(const uint8_t *p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+
+uint32_t le32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Same as avr-libc _crc_ccitt_update() (reflected 0x1021), started at 0xFFFF.
+uint16_t crc16(uint16_t crc, const uint8_t *data, std::size_t length)
+{
+    while (length--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i)
+            crc = (crc & 1) ? static_cast<uint16_t>((crc >> 1) ^ 0x8408) : static_cast<uint16_t>(crc >> 1);
+    }
+    return crc;
+}
+
+// "ring.dat" -> "RING    DAT"
+std::string fat_name(const std::string &name)
+{
+    std::string base = name, ext;
+    std::size_t dot = name.rfind('.');
+    if (dot != std::string::npos) {
+        base = name.substr(0, dot);
+        ext = name.substr(dot + 1);
+    }
+    base.resize(8, ' ');
+    ext.resize(3, ' ');
+    std::string out = base.substr(0, 8) + ext.substr(0, 3);
+    for (char &c : out)
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return out;
+}
+
+// Locates a file in the root directory of the FAT32 volume of a card image
+// (with or without MBR) and returns its contents following the cluster chain.
+bool read_from_image(const std::vector<uint8_t> &img, const std::string &name, std::vector<uint8_t> &out)
+{
+    if (img.size() < kSectorSize)
+        return false;
+
+    uint64_t base = 0;
+    if (img[0] != 0xEB && img[0] != 0xE9)
+        base = static_cast<uint64_t>(le32(&img[0x1C6])) * kSectorSize;  // first MBR partition
+    if (base + kSectorSize > img.size())
+        return false;
+
+    const uint8_t *bpb = &img[base];
+    const uint32_t bytes_per_sector = le16(bpb + 11);
+    const uint32_t spc = bpb[13];
+    const uint32_t reserved = le16(bpb + 14);
+    const uint32_t fats = bpb[16];
+    const uint32_t fat_size = le32(bpb + 36);
+    const uint32_t root_cluster = le32(bpb + 44);
+    if (bytes_per_sector != kSectorSize || spc == 0)
+        return false;
+
+    const uint64_t fat_start = base + static_cast<uint64_t>(reserved) * kSectorSize;
+    const uint64_t data_start = fat_start + static_cast<uint64_t>(fats) * fat_size * kSectorSize;
+    const uint64_t cluster_bytes = static_cast<uint64_t>(spc) * kSectorSize;
+
+    auto next = [&](uint32_t cluster) -> uint32_t {
+        uint64_t pos = fat_start + static_cast<uint64_t>(cluster) * 4;
+        return pos + 4 <= img.size() ? (le32(&img[pos]) & 0x0FFFFFFF) : 0x0FFFFFFF;
+    };
+    auto chain = [&](uint32_t cluster, std::vector<uint32_t> &clusters) {
+        while (cluster >= 2 && cluster < 0x0FFFFFF7 && clusters.size() < img.size() / cluster_bytes) {
+            clusters.push_back(cluster);
+            cluster = next(cluster);
+        }
+    };
+    auto at = [&](uint32_t cluster) { return data_start + static_cast<uint64_t>(cluster - 2) * cluster_bytes; };
+
+    std::vector<uint32_t> root;
+    chain(root_cluster, root);
+    const std::string wanted = fat_name(name);
+
+    for (uint32_t cluster : root) {
+        for (uint64_t off = 0; off + 32 <= cluster_bytes; off += 32) {
+            uint64_t pos = at(cluster) + off;
+            if (pos + 32 > img.size())
+                return false;
+            const uint8_t *entry = &img[pos];
+            if (entry[0] == 0x00)
+                return false;
+            if (entry[0] == 0xE5 || (entry[11] & 0x0F) == 0x0F || std::memcmp(entry, wanted.data(), 11) != 0)
+                continue;
+
+            uint32_t first = (static_cast<uint32_t>(le16(entry + 20)) << 16) | le16(entry + 26);
+            uint32_t size = le32(entry + 28);
+            std::vector<uint32_t> clusters;
+            chain(first, clusters);
+            for (uint32_t c : clusters) {
+                uint64_t p = at(c);
+                if (p + cluster_bytes > img.size())
+                    return false;
+                out.insert(out.end(), img.begin() + p, img.begin() + p + cluster_bytes);
+            }
+            if (out.size() > size)
+                out.resize(size);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Block {
+    uint32_t sequence;
+    std::size_t index;
+    const uint8_t *payload;
+    uint16_t length;
+};
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    bool verbose = false;
+    const char *image = nullptr;
+    std::string ring_name = "RING.DAT";
+    const char *file = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-v") == 0)
+            verbose = true;
+        else if (std::strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            image = argv[++i];
+        else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            ring_name = argv[++i];
+        else
+            file = argv[i];
+    }
+    if (!image && !file) {
+        std::cerr << "usage: ringdump [-v] RING.DAT | ringdump [-v] -i card.img [-f RING.DAT]\n";
+        return 1;
+    }
+
+    std::ifstream in(image ? image : file, std::ios::binary);
+    if (!in) {
+        std::cerr << "ringdump: cannot open " << (image ? image : file) << "\n";
+        return 1;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<uint8_t> ring;
+    if (image) {
+        if (!read_from_image(data, ring_name, ring)) {
+            std::cerr << "ringdump: " << ring_name << " not found in " << image << "\n";
+            return 1;
+        }
+    } else {
+        ring.swap(data);
+    }
+
+    std::vector<Block> blocks;
+    unsigned long torn = 0;
+    for (std::size_t index = 0; (index + 1) * kSectorSize <= ring.size(); ++index) {
+        const uint8_t *b = &ring[index * kSectorSize];
+        if (le16(b) != kMagic)
+            continue;
+        uint16_t length = le16(b + 6);
+        if (length > kPayloadSize) {
+            ++torn;
+            continue;
+        }
+        uint16_t crc = crc16(0xFFFF, b + kHeaderSize, length);
+        crc = crc16(crc, b, 8);
+        if (crc != le16(b + 8)) {
+            ++torn;
+            continue;
+        }
+        blocks.push_back({le32(b + 2), index, b + kHeaderSize, length});
+    }
+
+    std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) { return a.sequence < b.sequence; });
+
+    unsigned long gaps = 0;
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        const Block &b = blocks[i];
+        if (i && b.sequence != blocks[i - 1].sequence + 1)
+            ++gaps;
+        if (verbose)
+            std::fprintf(stderr, "seq %lu block %zu length %u\n", static_cast<unsigned long>(b.sequence), b.index,
+                         b.length);
+        std::fwrite(b.payload, 1, b.length, stdout);
+        bytes += b.length;
+    }
+
+    std::fprintf(stderr, "ringdump: %zu of %zu blocks valid", blocks.size(), ring.size() / kSectorSize);
+    if (!blocks.empty())
+        std::fprintf(stderr, ", seq %lu-%lu", static_cast<unsigned long>(blocks.front().sequence),
+                     static_cast<unsigned long>(blocks.back().sequence));
+    std::fprintf(stderr, ", %zu bytes, %lu torn, %lu gaps\n", bytes, torn, gaps);
+    return 0;
+}
@@ -0,0 +1,62 @@
+// Cycle count of one 512-byte SD block moved through the SPI module at
+// F_CPU/2: once byte by byte through SPI_receive()/SPI_transmit() (the loop
+// SD_readBlock()/SD_writeBlock() used) and once through the block kernels
+// SPI_receiveBlock()/SPI_transmitBlock() (lib/SPI/SPI_routines.c). Runs
+// without a card or hardware in simavr, which models the SPI transfer time;
+// 512 bytes at 16 cycles each are 8192 cycles at best.
+//
+// Build: pio run -e spibench
+// Run:   simavr -m atmega328p -f 16000000 .pio/build/spibench/firmware.elf
+//        (prints "SPI cycles/512 B rx byte=... block=... tx byte=... block=..."
+//        on the UART and stops)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdio.h>
+#include <uart.h>
+#include "SPI_routines.h"
+
+static unsigned char block[512];
+
+int main(void)
+{
+    unsigned int t0, cycles[4], k;
+    char line[80];
+
+    uart_init(UART_BAUD_SELECT(115200, F_CPU));
+    DDRB |= (1 << PB2) | (1 << PB3) | (1 << PB5); // SS must not be an input in master mode
+    TCCR1A = 0;
+    TCCR1B = (1 << CS10); // Timer1 counts CPU cycles
+    spi_init();
+    SPI_HIGH_SPEED;
+    for (k = 0; k < 512; k++)
+        block[k] = k;
+
+    t0 = TCNT1;
+    for (k = 0; k < 512; k++)
+        block[k] = SPI_receive();
+    cycles[0] = TCNT1 - t0;
+    t0 = TCNT1;
+    SPI_receiveBlock(block, 512);
+    cycles[1] = TCNT1 - t0;
+
+    t0 = TCNT1;
+    for (k = 0; k < 512; k++)
+        SPI_transmit(block[k]);
+    cycles[2] = TCNT1 - t0;
+    t0 = TCNT1;
+    SPI_transmitBlock(block, 512);
+    cycles[3] = TCNT1 - t0;
+
+    sei();
+    snprintf(line, sizeof(line), "SPI cycles/512 B rx byte=%u block=%u tx byte=%u block=%u\r\n",
+             cycles[0], cycles[1], cycles[2], cycles[3]);
+    uart_puts(line);
+
+    while (UCSR0B & (1 << UDRIE0)); // let the UART drain, then stop the simulator
+    while (!(UCSR0A & (1 << TXC0)));
+    cli();
+    sleep_mode();
+    return 0;
+}